@@ -40,6 +40,9 @@ sudo apt-get install -y libdbus-1-dev
 # For gtk3
 sudo apt-get -y install libxrandr-dev
 
+# Python bindings and their tests
+sudo apt-get -y install python3-dev pybind11-dev python3-numpy python3-pytest
+
 # vcpkg dependencies
 sudo apt-get -y install curl zip unzip tar
 
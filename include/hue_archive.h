@@ -0,0 +1,567 @@
+#pragma once
+#include <opencv2/opencv.hpp>   // Include OpenCV API
+#include <hue_codec.h>          // The header-only hue codec
+#include <hue_async.h>          // HueExecutor worker pool
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef HUE_HAVE_LIBURING
+#include <fcntl.h>
+#include <unistd.h>
+#include <liburing.h>
+#endif
+
+// Asynchronous image archives
+//
+// HueArchiveWriter stores hue-encoded depth frames as compressed images (e.g.
+// WebP) at sensor rate. Frames are hue-encoded and compressed on a pool of
+// worker threads, and a writer thread appends them in order to chunk files and
+// records each one in an index:
+//
+//     HueArchiveOptions options;
+//     options.format = ".webp";
+//     HueArchiveWriter archive(codec, options);
+//     archive.open("run.hca", depth.size());
+//     archive.write(depth, timestamp);            // copies the frame and returns
+//     archive.close();                            // waits for the queued frames
+//
+//     HueArchiveReader reader("run.hca");
+//     cv::Mat depth = reader.depth(0);            // decoded with the archive's codec settings
+//
+// write() blocks while max_pending frames are being compressed or written, so a
+// slow disk slows the caller down instead of using more and more memory, and
+// try_write() drops the frame instead of blocking.
+//
+// When built with liburing (HUE_HAVE_LIBURING, see CMakeLists.txt) the chunk
+// files are written through io_uring with several writes in flight. Otherwise,
+// or if io_uring is not available at run time, the writer thread writes them
+// with stdio. If io_uring fails part way through a chunk, the writes in flight
+// are waited for and the rest of the chunk is written with stdio.
+//
+// Frames that cannot be compressed (cv::imencode fails or throws, e.g. for an
+// unknown format) are counted in dropped() and do not stop the archive.
+//
+// The index ("run.hca") holds a 64-byte header and a 24-byte entry per frame,
+// and the chunks ("run.hca.00000", "run.hca.00001", ...) hold the compressed
+// images back to back. Layout (little-endian):
+//
+//   header
+//        0    4  magic "HCA1"
+//        4    4  width
+//        8    4  height
+//       12    4  depth_min_m (float)
+//       16    4  depth_max_m (float)
+//       20    4  depth_scale (float)
+//       24    4  inverse colorization flag
+//       28    8  image format extension, e.g. ".webp"
+//       36   28  reserved
+//
+//   entry
+//        0    4  chunk number
+//        4    4  size in bytes
+//        8    8  offset in the chunk
+//       16    8  timestamp given to write()
+
+struct HueArchiveOptions
+{
+	std::string format = ".webp";	// image format for cv::imencode
+	std::vector<int> params { cv::IMWRITE_WEBP_QUALITY, 90 };	// cv::imencode parameters
+	unsigned threads = 0;			// compression threads (0: one per hardware thread)
+	size_t max_pending = 0;			// frames compressing or waiting to be written (0: 2 per thread)
+	uint64_t chunk_bytes = 256ull << 20;	// start a new chunk file when a frame would exceed this
+	bool io_uring = true;			// use io_uring when it is available
+};
+
+namespace hue_archive_detail
+{
+	const char MAGIC[4] = { 'H', 'C', 'A', '1' };
+	const size_t HEADER_SIZE = 64;
+	const size_t ENTRY_SIZE = 24;
+	const size_t FORMAT_SIZE = 8;
+
+	template <typename T>
+	void put(uint8_t* p, T v)
+	{	// Little-endian store of an integer or float
+		uint64_t u = 0;
+		std::memcpy(&u, &v, sizeof(T));
+		for (size_t k=0; k<sizeof(T); k++) p[k] = (uint8_t)(u >> (8*k));
+	}
+
+	template <typename T>
+	T get(const uint8_t* p)
+	{
+		uint64_t u = 0;
+		for (size_t k=0; k<sizeof(T); k++) u |= (uint64_t)p[k] << (8*k);
+		T v;
+		std::memcpy(&v, &u, sizeof(T));
+		return v;
+	}
+
+	inline std::string chunk_path(const std::string& path, uint32_t chunk)
+	{
+		char suffix[16];
+		std::snprintf(suffix, sizeof(suffix), ".%05u", chunk);
+		return path + suffix;
+	}
+
+	class ChunkFile
+	{	// Append-only file written by a single thread, through io_uring if possible
+
+		public:
+
+		~ChunkFile() { close(); }
+
+		bool open(const std::string& path, bool use_io_uring)
+		{
+			close();
+			m_size = 0;
+			m_ok = true;
+#ifdef HUE_HAVE_LIBURING
+			if (use_io_uring && io_uring_queue_init(QUEUE_DEPTH, &m_ring, 0) == 0)
+			{
+				m_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+				m_ring_ok = true;
+				if (m_fd >= 0) return true;
+				io_uring_queue_exit(&m_ring);
+				return false;
+			}
+#else
+			(void)use_io_uring;
+#endif
+			m_file = std::fopen(path.c_str(), "wb");
+			return m_file != nullptr;
+		}
+
+		bool write(std::vector<uchar>&& data)
+		{	// Append data and return false if this or an earlier write failed
+#ifdef HUE_HAVE_LIBURING
+			if (m_fd >= 0)
+			{
+				while (m_in_flight >= QUEUE_DEPTH) reap();
+				Write* w = new Write { std::move(data), 0, m_size };
+				m_size += w->data.size();
+				submit(w);
+				if (!m_ring_ok) fall_back();
+				return m_ok;
+			}
+#endif
+			if (!m_file) return false;
+			m_size += data.size();
+			m_ok = std::fwrite(data.data(), 1, data.size(), m_file) == data.size() && m_ok;
+			return m_ok;
+		}
+
+		bool close()
+		{	// Wait for the writes in flight and close the file
+#ifdef HUE_HAVE_LIBURING
+			if (m_fd >= 0)
+			{
+				while (m_in_flight > 0) reap();
+				if (m_ring_ok)
+				{
+					m_ok = ::close(m_fd) == 0 && m_ok;
+					m_fd = -1;
+					io_uring_queue_exit(&m_ring);
+				}
+				else fall_back();	// moves the file to stdio
+			}
+#endif
+			if (m_file)
+			{
+				m_ok = std::fclose(m_file) == 0 && m_ok;
+				m_file = nullptr;
+			}
+			return m_ok;
+		}
+
+		uint64_t size() const { return m_size; }
+
+		private:
+
+		std::FILE* m_file = nullptr;
+		uint64_t m_size = 0;
+		bool m_ok = true;
+
+#ifdef HUE_HAVE_LIBURING
+		enum { QUEUE_DEPTH = 32 };
+
+		struct Write
+		{
+			std::vector<uchar> data;
+			size_t done;
+			uint64_t offset;
+		};
+
+		void submit(Write* w)
+		{	// Queue the rest of a write. Once io_uring fails, nothing more is submitted
+			// and the write is kept for fall_back.
+			io_uring_sqe* sqe = m_ring_ok ? io_uring_get_sqe(&m_ring) : nullptr;
+			if (sqe)
+			{
+				io_uring_prep_write(sqe, m_fd, w->data.data() + w->done, (unsigned)(w->data.size() - w->done), w->offset + w->done);
+				io_uring_sqe_set_data(sqe, w);
+				if (io_uring_submit(&m_ring) == 1)
+				{
+					m_in_flight++;
+					return;
+				}
+			}
+			m_ring_ok = false;
+			m_unsubmitted.push_back(w);
+		}
+
+		void reap()
+		{	// Wait for a write to complete, and resubmit the rest of a short write
+			io_uring_cqe* cqe;
+			if (io_uring_wait_cqe(&m_ring, &cqe) < 0)
+			{	// nothing more will complete
+				m_ok = false;
+				m_ring_ok = false;
+				m_in_flight = 0;
+				return;
+			}
+			Write* w = (Write*)io_uring_cqe_get_data(cqe);
+			int res = cqe->res;
+			io_uring_cqe_seen(&m_ring, cqe);
+			m_in_flight--;
+
+			if (res > 0) w->done += res;
+			else m_ok = false;
+
+			if (res > 0 && w->done < w->data.size()) submit(w);
+			else delete w;
+		}
+
+		void fall_back()
+		{	// Drop the ring after the writes in flight, write the unsubmitted writes
+			// with stdio, and append the rest of the file with stdio
+			while (m_in_flight > 0) reap();
+			io_uring_queue_exit(&m_ring);
+			m_file = ::fdopen(m_fd, "wb");	// does not truncate
+			if (!m_file)
+			{
+				::close(m_fd);
+				m_ok = false;
+			}
+			m_fd = -1;
+
+			for (Write* w : m_unsubmitted)
+			{
+				size_t n = w->data.size() - w->done;
+				m_ok = m_file && ::fseeko(m_file, (off_t)(w->offset + w->done), SEEK_SET) == 0
+				    && std::fwrite(w->data.data() + w->done, 1, n, m_file) == n && m_ok;
+				delete w;
+			}
+			m_unsubmitted.clear();
+			m_ok = m_file && ::fseeko(m_file, (off_t)m_size, SEEK_SET) == 0 && m_ok;
+		}
+
+		io_uring m_ring;
+		int m_fd = -1;
+		int m_in_flight = 0;
+		bool m_ring_ok = false;				// no io_uring call has failed
+		std::vector<Write*> m_unsubmitted;	// writes left for fall_back
+#endif
+	};
+}
+
+class HueArchiveWriter
+{
+	public:
+
+	explicit HueArchiveWriter(const HueCodec& codec, const HueArchiveOptions& options=HueArchiveOptions())
+	: m_codec(codec)
+	, m_options(options)
+	{
+	}
+
+	~HueArchiveWriter() { close(); }
+
+	HueArchiveWriter(const HueArchiveWriter&) = delete;
+	HueArchiveWriter& operator=(const HueArchiveWriter&) = delete;
+
+	bool open(const std::string& path, cv::Size size)
+	{	// Create (or overwrite) an archive of depth frames of the given size
+		using namespace hue_archive_detail;
+		close();
+		if (size.empty()) return false;
+
+		m_index = std::fopen(path.c_str(), "wb");
+		if (!m_index) return false;
+
+		uint8_t h[HEADER_SIZE] = {};
+		std::memcpy(h, MAGIC, 4);
+		put<uint32_t>(h + 4, size.width);
+		put<uint32_t>(h + 8, size.height);
+		put<float>(h + 12, m_codec.depth_min_m());
+		put<float>(h + 16, m_codec.depth_max_m());
+		put<float>(h + 20, m_codec.depth_scale());
+		put<uint32_t>(h + 24, m_codec.m_inverse_colorization ? 1 : 0);
+		std::strncpy((char*)h + 28, m_options.format.c_str(), FORMAT_SIZE);
+		if (std::fwrite(h, 1, HEADER_SIZE, m_index) != HEADER_SIZE)
+		{
+			std::fclose(m_index);
+			m_index = nullptr;
+			return false;
+		}
+
+		m_path = path;
+		m_size = size;
+		m_chunk = 0;
+		m_frames = m_bytes = m_dropped = 0;
+		m_failed = false;
+		m_closing = false;
+		if (!m_file.open(chunk_path(path, m_chunk), m_options.io_uring)) m_failed = true;
+
+		m_executor.reset(new HueExecutor(m_options.threads));
+		m_max_pending = m_options.max_pending ? m_options.max_pending : 2 * m_executor->threads();
+		m_writer = std::thread(&HueArchiveWriter::run, this);
+		return true;
+	}
+
+	bool write(const cv::Mat& depth, uint64_t timestamp=0)
+	{	// Queue a CV_16U (depth_scale units) or CV_32F (metres) depth frame,
+		// waiting while max_pending frames are queued. The frame is copied.
+		return queue(depth, timestamp, true);
+	}
+
+	bool try_write(const cv::Mat& depth, uint64_t timestamp=0)
+	{	// As write, but drop the frame (and count it in dropped()) instead of waiting
+		return queue(depth, timestamp, false);
+	}
+
+	bool close()
+	{	// Write the queued frames and close the files. Returns false if any write failed.
+		if (!m_writer.joinable()) return !m_failed;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_closing = true;
+		}
+		m_cv.notify_all();
+		m_writer.join();
+		m_executor.reset();
+
+		if (!m_file.close()) m_failed = true;
+		if (std::fclose(m_index) != 0) m_failed = true;
+		m_index = nullptr;
+		return !m_failed;
+	}
+
+	bool is_open() const { return m_index != nullptr; }
+	bool failed() const { return m_failed; }
+	uint64_t size() const { return m_frames; }		// frames written
+	uint64_t bytes() const { return m_bytes; }		// compressed bytes written
+	uint64_t dropped() const { return m_dropped; }	// frames dropped by try_write or not compressed
+
+	size_t pending() const
+	{	// Frames compressing or waiting to be written
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_queue.size();
+	}
+
+	private:
+
+	struct Frame
+	{
+		HueTask<std::vector<uchar>> task;
+		uint64_t timestamp;
+	};
+
+	bool queue(const cv::Mat& depth, uint64_t timestamp, bool wait)
+	{
+		if (!m_writer.joinable() || m_failed) return false;
+		if (depth.size() != m_size || (depth.type() != CV_16U && depth.type() != CV_32F)) return false;
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		if (m_queue.size() >= m_max_pending)
+		{
+			if (!wait)
+			{
+				m_dropped++;
+				return false;
+			}
+			m_space.wait(lock, [&] { return m_queue.size() < m_max_pending; });
+		}
+
+		cv::Mat frame = depth.clone();
+		const HueCodec& codec = m_codec;
+		const HueArchiveOptions& options = m_options;
+		m_queue.push_back(Frame { m_executor->submit([&codec, &options, frame]
+		{
+			std::vector<uchar> buffer;
+			if (!cv::imencode(options.format, codec.encode(frame), buffer, options.params)) buffer.clear();
+			return buffer;
+		}), timestamp });
+		lock.unlock();
+		m_cv.notify_all();
+		return true;
+	}
+
+	void run()
+	{	// Writer thread: store the frames in the order they were queued
+		for (;;)
+		{
+			Frame frame;
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_cv.wait(lock, [&] { return m_closing || !m_queue.empty(); });
+				if (m_queue.empty()) return;
+				frame = m_queue.front();	// stays queued (and counted as pending) until it is written
+			}
+
+			std::vector<uchar> data;
+			try
+			{
+				data = frame.task.get();
+			}
+			catch (const std::exception&)
+			{	// e.g. cv::Exception from cv::imencode for an unknown format
+			}
+
+			if (data.empty()) m_dropped++;	// could not be compressed
+			else if (!store(std::move(data), frame.timestamp)) m_failed = true;
+
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_queue.pop_front();
+			}
+			m_space.notify_all();
+		}
+	}
+
+	bool store(std::vector<uchar>&& data, uint64_t timestamp)
+	{	// Append a compressed frame to the current chunk (or a new one) and index it
+		using namespace hue_archive_detail;
+		if (m_file.size() > 0 && m_file.size() + data.size() > m_options.chunk_bytes)
+		{
+			if (!m_file.close() || !m_file.open(chunk_path(m_path, ++m_chunk), m_options.io_uring)) return false;
+		}
+
+		uint8_t e[ENTRY_SIZE];
+		put<uint32_t>(e, m_chunk);
+		put<uint32_t>(e + 4, (uint32_t)data.size());
+		put<uint64_t>(e + 8, m_file.size());
+		put<uint64_t>(e + 16, timestamp);
+
+		size_t bytes = data.size();
+		if (!m_file.write(std::move(data))) return false;
+		if (std::fwrite(e, 1, ENTRY_SIZE, m_index) != ENTRY_SIZE) return false;
+
+		m_frames++;
+		m_bytes += bytes;
+		return true;
+	}
+
+	HueCodec m_codec;
+	HueArchiveOptions m_options;
+	std::string m_path;
+	cv::Size m_size;
+
+	std::FILE* m_index = nullptr;
+	hue_archive_detail::ChunkFile m_file;	// used by the writer thread only
+	uint32_t m_chunk = 0;
+
+	mutable std::mutex m_mutex;
+	std::condition_variable m_cv, m_space;
+	std::deque<Frame> m_queue;
+	size_t m_max_pending = 0;
+	bool m_closing = false;
+
+	std::atomic<uint64_t> m_frames { 0 }, m_bytes { 0 }, m_dropped { 0 };
+	std::atomic<bool> m_failed { false };
+
+	std::unique_ptr<HueExecutor> m_executor;
+	std::thread m_writer;
+};
+
+class HueArchiveReader
+{
+	public:
+
+	HueArchiveReader() {}
+	explicit HueArchiveReader(const std::string& path) { open(path); }
+
+	bool open(const std::string& path)
+	{	// Read the index of an archive. Entries of frames that were still being
+		// written are included, and read() fails for them.
+		using namespace hue_archive_detail;
+		m_entries.clear();
+		m_path.clear();
+
+		std::FILE* f = std::fopen(path.c_str(), "rb");
+		if (!f) return false;
+
+		uint8_t h[HEADER_SIZE];
+		bool ok = std::fread(h, 1, HEADER_SIZE, f) == HEADER_SIZE && std::memcmp(h, MAGIC, 4) == 0;
+		uint8_t e[ENTRY_SIZE];
+		while (ok && std::fread(e, 1, ENTRY_SIZE, f) == ENTRY_SIZE)
+		{
+			m_entries.push_back(Entry { get<uint32_t>(e), get<uint32_t>(e + 4), get<uint64_t>(e + 8), get<uint64_t>(e + 16) });
+		}
+		std::fclose(f);
+		if (!ok) return false;
+
+		m_path = path;
+		m_size = cv::Size(get<uint32_t>(h + 4), get<uint32_t>(h + 8));
+		m_codec = HueCodec(get<float>(h + 12), get<float>(h + 16), get<float>(h + 20), get<uint32_t>(h + 24) & 1);
+		m_format = std::string((const char*)h + 28, strnlen((const char*)h + 28, FORMAT_SIZE));
+		return true;
+	}
+
+	bool is_open() const { return !m_path.empty(); }
+	size_t size() const { return m_entries.size(); }	// frames
+	cv::Size frame_size() const { return m_size; }
+	const std::string& format() const { return m_format; }
+	const HueCodec& codec() const { return m_codec; }
+	uint64_t timestamp(size_t i) const { return m_entries[i].timestamp; }
+
+	bool read(size_t i, std::vector<uchar>& buffer) const
+	{	// The compressed image of frame i
+		if (i >= m_entries.size()) return false;
+		const Entry& entry = m_entries[i];
+
+		std::FILE* f = std::fopen(hue_archive_detail::chunk_path(m_path, entry.chunk).c_str(), "rb");
+		if (!f) return false;
+		buffer.resize(entry.bytes);
+		bool ok = std::fseek(f, (long)entry.offset, SEEK_SET) == 0 && std::fread(buffer.data(), 1, entry.bytes, f) == entry.bytes;
+		std::fclose(f);
+		return ok;
+	}
+
+	cv::Mat image(size_t i) const
+	{	// The hue-encoded BGR image of frame i (empty if it cannot be read)
+		std::vector<uchar> buffer;
+		if (!read(i, buffer)) return cv::Mat();
+		return cv::imdecode(buffer, cv::IMREAD_COLOR);
+	}
+
+	cv::Mat depth(size_t i, int ddepth=CV_16U) const
+	{	// Frame i decoded to CV_16U (depth_scale units) or CV_32F (metres) depth
+		cv::Mat encoded = image(i), dst;
+		if (!encoded.empty()) m_codec.decode(encoded, dst, ddepth);
+		return dst;
+	}
+
+	private:
+
+	struct Entry
+	{
+		uint32_t chunk, bytes;
+		uint64_t offset, timestamp;
+	};
+
+	std::string m_path, m_format;
+	cv::Size m_size;
+	HueCodec m_codec { 0.0f, 1.0f };
+	std::vector<Entry> m_entries;
+};
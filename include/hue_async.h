@@ -0,0 +1,356 @@
+#pragma once
+#include <hue_codec.h>	      	// The header-only hue codec
+#include <opencv2/opencv.hpp>   // Include OpenCV API
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(__cpp_impl_coroutine)
+#include <coroutine>
+#define HUE_ASYNC_COROUTINES 1
+#endif
+
+// Asynchronous encoding and decoding
+//
+// HueAsyncCodec submits encode, decode, and median filter jobs to a pool of
+// worker threads and returns a HueTask for each job, so that an event loop can
+// hand frames off without blocking:
+//
+//     HueAsyncCodec async_codec(HueCodec(0.3f, 6.0f));
+//     HueTask<cv::Mat> task = async_codec.encode(depth, HuePriority::High,
+//         [](const cv::Mat& encoded) { /* called on the worker thread */ });
+//     ...
+//     cv::Mat encoded = task.get();	// or co_await task; with C++20
+//
+// Jobs run highest priority first, and in submission order within a priority.
+// A job can be cancelled until a worker has started it; a cancelled job does not
+// run its callback and its result is an empty Mat. An exception thrown by a job
+// or its callback (e.g. a cv::Exception) is rethrown by get() or co_await.
+//
+// The input Mat is shared with the job (not copied), so it must not be written
+// to until the job has finished.
+//
+// When compiled as C++20 (see HUE_CXX20 in CMakeLists.txt), HueTask can also be
+// awaited with co_await. The awaiting coroutine is resumed on the worker thread
+// that completed the job (or on the thread that cancelled it).
+
+enum class HuePriority : int { Low = 0, Normal = 1, High = 2 };
+
+namespace hue_async_detail
+{
+	enum Status : int { QUEUED, RUNNING, DONE, CANCELLED };
+
+	template <typename T> struct Identity { typedef T type; };	// keeps callbacks out of template deduction
+
+	template <typename T>
+	struct TaskState
+	{	// Shared between a HueTask and the job that completes it
+		std::atomic<int> status { QUEUED };
+		std::mutex mutex;
+		std::condition_variable cv;
+		bool finished = false;
+		T result {};
+		std::exception_ptr error;			// thrown by the job or its callback
+		std::function<void()> continuation;	// awaiting coroutine
+
+		T get() const
+		{	// The result, or the exception of a job that threw
+			if (error) std::rethrow_exception(error);
+			return result;
+		}
+
+		bool start()
+		{
+			int expected = QUEUED;
+			return status.compare_exchange_strong(expected, RUNNING);
+		}
+
+		bool cancel()
+		{
+			int expected = QUEUED;
+			if (!status.compare_exchange_strong(expected, CANCELLED)) return false;
+			finish();
+			return true;
+		}
+
+		void finish()
+		{	// Wake waiters and resume an awaiting coroutine (outside of the lock)
+			std::function<void()> resume;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				finished = true;
+				resume.swap(continuation);
+			}
+			cv.notify_all();
+			if (resume) resume();
+		}
+	};
+}
+
+template <typename T>
+class HueTask
+{	// Handle to the result of an asynchronous job
+
+	public:
+
+	HueTask() {}
+	explicit HueTask(std::shared_ptr<hue_async_detail::TaskState<T>> state) : m_state(std::move(state)) {}
+
+	bool valid() const { return m_state != nullptr; }	// false for a default-constructed task
+
+	bool ready() const
+	{
+		if (!m_state) return false;
+		std::lock_guard<std::mutex> lock(m_state->mutex);
+		return m_state->finished;
+	}
+
+	void wait() const
+	{	// Throws std::future_error (no_state) if the task is not valid(), as get() does
+		if (!m_state) throw std::future_error(std::future_errc::no_state);
+		std::unique_lock<std::mutex> lock(m_state->mutex);
+		m_state->cv.wait(lock, [&] { return m_state->finished; });
+	}
+
+	bool wait_for(std::chrono::milliseconds timeout) const
+	{
+		if (!m_state) return false;
+		std::unique_lock<std::mutex> lock(m_state->mutex);
+		return m_state->cv.wait_for(lock, timeout, [&] { return m_state->finished; });
+	}
+
+	T get() const
+	{	// Wait for the job and return its result (a default T if it was cancelled).
+		// Rethrows an exception thrown by the job or its callback.
+		wait();
+		return m_state->get();
+	}
+
+	bool cancel()
+	{	// Cancel the job if no worker has started it yet
+		return m_state && m_state->cancel();
+	}
+
+	bool cancelled() const { return m_state && m_state->status == hue_async_detail::CANCELLED; }
+
+#ifdef HUE_ASYNC_COROUTINES
+	struct Awaiter
+	{
+		std::shared_ptr<hue_async_detail::TaskState<T>> state;
+
+		bool await_ready() const
+		{
+			if (!state) return true;	// await_resume throws
+			std::lock_guard<std::mutex> lock(state->mutex);
+			return state->finished;
+		}
+
+		bool await_suspend(std::coroutine_handle<> handle)
+		{	// Suspend unless the job finished in the meantime
+			std::lock_guard<std::mutex> lock(state->mutex);
+			if (state->finished) return false;
+			state->continuation = [handle] { handle.resume(); };
+			return true;
+		}
+
+		T await_resume() const
+		{
+			if (!state) throw std::future_error(std::future_errc::no_state);
+			return state->get();
+		}
+	};
+
+	Awaiter operator co_await() const { return Awaiter { m_state }; }
+#endif
+
+	private:
+
+	std::shared_ptr<hue_async_detail::TaskState<T>> m_state;
+};
+
+class HueExecutor
+{	// Fixed pool of worker threads that runs jobs in priority order
+
+	public:
+
+	explicit HueExecutor(unsigned threads=0)
+	{
+		if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+		for (unsigned i=0; i<threads; i++) m_threads.emplace_back(&HueExecutor::run, this);
+	}
+
+	~HueExecutor()
+	{	// Cancel queued jobs and wait for running jobs to finish
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stopping = true;
+		}
+		m_cv.notify_all();
+		for (std::thread& t : m_threads) t.join();
+
+		while (!m_queue.empty())
+		{
+			m_queue.top().cancel();
+			m_queue.pop();
+		}
+	}
+
+	HueExecutor(const HueExecutor&) = delete;
+	HueExecutor& operator=(const HueExecutor&) = delete;
+
+	template <typename F, typename T=typename std::decay<decltype(std::declval<F&>()())>::type>
+	HueTask<T> submit(F job, HuePriority priority=HuePriority::Normal,
+	                  typename hue_async_detail::Identity<std::function<void(const T&)>>::type callback={})
+	{	// Queue job() to run on a worker thread. callback, if given, is called with
+		// the result on the worker thread before the task becomes ready.
+		auto state = std::make_shared<hue_async_detail::TaskState<T>>();
+
+		Job entry;
+		entry.priority = (int)priority;
+		entry.run = [state, job, callback]() mutable
+		{
+			if (!state->start()) return;	// cancelled while queued
+			try
+			{
+				state->result = job();
+				if (callback) callback(state->result);
+			}
+			catch (...)
+			{	// Keep the worker alive and pass the exception on to the task
+				state->error = std::current_exception();
+			}
+			state->status = hue_async_detail::DONE;
+			state->finish();
+		};
+		entry.cancel = [state] { state->cancel(); };
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			entry.sequence = m_sequence++;
+			m_queue.push(std::move(entry));
+		}
+		m_cv.notify_one();
+		return HueTask<T>(state);
+	}
+
+	size_t pending() const
+	{	// Jobs waiting for a worker (including cancelled jobs not yet removed)
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_queue.size();
+	}
+
+	size_t threads() const { return m_threads.size(); }
+
+	private:
+
+	struct Job
+	{
+		int priority;
+		uint64_t sequence;
+		std::function<void()> run;
+		std::function<void()> cancel;
+
+		bool operator<(const Job& other) const
+		{	// std::priority_queue pops the largest: highest priority, then oldest
+			if (priority != other.priority) return priority < other.priority;
+			return sequence > other.sequence;
+		}
+	};
+
+	void run()
+	{
+		for (;;)
+		{
+			Job job;
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_cv.wait(lock, [&] { return m_stopping || !m_queue.empty(); });
+				if (m_stopping) return;
+				job = m_queue.top();
+				m_queue.pop();
+			}
+			job.run();
+		}
+	}
+
+	mutable std::mutex m_mutex;
+	std::condition_variable m_cv;
+	std::priority_queue<Job> m_queue;
+	uint64_t m_sequence = 0;
+	bool m_stopping = false;
+	std::vector<std::thread> m_threads;
+};
+
+class HueAsyncCodec
+{	// HueCodec with asynchronous encode, decode, and median filter jobs.
+	// Each job allocates its own output Mat.
+
+	public:
+
+	typedef std::function<void(const cv::Mat&)> Callback;
+
+	explicit HueAsyncCodec(const HueCodec& codec, unsigned threads=0)
+	: m_codec(codec)
+	, m_executor(threads)
+	{
+	}
+
+	HueTask<cv::Mat> encode(const cv::Mat& src, HuePriority priority=HuePriority::Normal, Callback callback={})
+	{
+		const HueCodec& codec = m_codec;
+		return m_executor.submit([&codec, src] { return codec.encode(src); }, priority, callback);
+	}
+
+	HueTask<cv::Mat> decode(const cv::Mat& src, HuePriority priority=HuePriority::Normal, Callback callback={}, int ddepth=CV_16U)
+	{
+		const HueCodec& codec = m_codec;
+		return m_executor.submit([&codec, src, ddepth]
+		{
+			cv::Mat dst;
+			codec.decode(src, dst, ddepth);
+			return dst;
+		}, priority, callback);
+	}
+
+	HueTask<cv::Mat> median_filter(const cv::Mat& src, int kernel_size, float diff_threshold,
+	                               HuePriority priority=HuePriority::Normal, Callback callback={})
+	{
+		cv::Mat input = src;	// median_filter takes a non-const Mat
+		return m_executor.submit([input, kernel_size, diff_threshold]() mutable
+		{
+			cv::Mat dst;
+			::median_filter(input, dst, kernel_size, diff_threshold);
+			return dst;
+		}, priority, callback);
+	}
+
+	HueTask<cv::Mat> decode_filtered(const cv::Mat& src, int kernel_size, float diff_threshold,
+	                                 HuePriority priority=HuePriority::Normal, Callback callback={})
+	{	// Decode and median filter in one job
+		const HueCodec& codec = m_codec;
+		return m_executor.submit([&codec, src, kernel_size, diff_threshold]
+		{
+			cv::Mat decoded = codec.decode(src), dst;
+			::median_filter(decoded, dst, kernel_size, diff_threshold);
+			return dst;
+		}, priority, callback);
+	}
+
+	const HueCodec& codec() const { return m_codec; }
+	HueExecutor& executor() { return m_executor; }
+
+	private:
+
+	HueCodec m_codec;
+	HueExecutor m_executor;		// declared last, so workers stop before the codec is destroyed
+};
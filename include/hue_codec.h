@@ -1,4 +1,9 @@
+#pragma once
 #include <opencv2/opencv.hpp>   // Include OpenCV API
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <type_traits>
 
 // Encoding Scheme:
 //
@@ -39,12 +44,12 @@ const uint16_t HUE_ENCODER_MAX = 1530;
 const float    HUE_MM_SCALE = 0.001f;	// uint16_t depth values in mm
 const float    HUE_CM_SCALE = 0.01f;	// uint16_t depth values in cm
 
-float clamp(float value, float lower, float upper)
+constexpr float clamp(float value, float lower, float upper)
 {
 	return std::max(lower, std::min(value, upper));
 }
 
-void hue_encode_value(uint16_t v, uint8_t& r, uint8_t& g, uint8_t& b)
+constexpr void hue_encode_value(uint16_t v, uint8_t& r, uint8_t& g, uint8_t& b)
 {	// Conversion from a 16-bit unsigned integer value in the range of 0 to 1530
 	// to an RGB color
 
@@ -58,7 +63,7 @@ void hue_encode_value(uint16_t v, uint8_t& r, uint8_t& g, uint8_t& b)
 	else               { r=255;    g=0;      b=0;      }
 }
 
-cv::Vec3b hue_encode_value(uint16_t v)
+inline cv::Vec3b hue_encode_value(uint16_t v)
 {	// Conversion from a 16-bit unsigned integer in the range of 0 to 1530
 	// and returns an OpenCV Vec3b (OpenCV BGR pixel value)
 	// Note that this Vec3b is in OpenCV-compatible BGR format
@@ -67,7 +72,7 @@ cv::Vec3b hue_encode_value(uint16_t v)
 	return bgr;
 }
 
-uint16_t hue_decode_value(uint8_t r, uint8_t g, uint8_t b)
+constexpr uint16_t hue_decode_value(uint8_t r, uint8_t g, uint8_t b)
 {	// Conversion from RGB color values
 	// to a quantized depth value in the range of 0 to 1530
 
@@ -84,25 +89,112 @@ uint16_t hue_decode_value(uint8_t r, uint8_t g, uint8_t b)
 	return 0;
 }
 
-uint16_t hue_decode_value(const cv::Vec3b& bgr)
+inline uint16_t hue_decode_value(const cv::Vec3b& bgr)
 {	// Conversion from an OpenCV Vec3b (OpenCV BGR pixel value)
 	// to a quantized depth value in the range of 0 to 1530
 	return hue_decode_value(bgr[2], bgr[1], bgr[0]);
 }
 
-class HueCodec
-{
+inline int hue_decode_value_branchless(int r, int g, int b)
+{	// Equivalent to hue_decode_value, written with bit masks instead of branches
+	// so that it can be auto-vectorized in the per-pixel decoding loops.
+	// (Compilers turn conditional selects against constants back into branches.)
+	int g_ge_b    = -(g >= b);
+	int r_largest = -((r >= g) & (r >= b));
+	int g_largest = ~r_largest & g_ge_b;
+	int b_largest = ~(r_largest | g_largest);
+	int v_r = g - b + 1 + (~g_ge_b & 1530);
+	int v_g = b - r + 511;
+	int v_b = r - g + 1021;
+	int v = (v_r & r_largest) | (v_g & g_largest) | (v_b & b_largest);
+	return v & -(b + g + r > 128);
+}
+
+inline int hue_decode_error(int r, int g, int b)
+{	// Distance of a colour from the hue encoding curve, in the range of 0 to 510.
+	// Every encoded colour has its largest channel at 255 and its smallest at 0,
+	// so lossy compression shows up as a lowered maximum or a raised minimum.
+	// Colours that decode to 0 (no data) are measured against black instead.
+	int mx = std::max(r, std::max(g, b));
+	int mn = std::min(r, std::min(g, b));
+	int valid = -(b + g + r > 128);
+	return ((255 - mx + mn) & valid) | (mx & ~valid);
+}
+
+inline uint8_t hue_decode_confidence(int r, int g, int b)
+{	// 255 for colours on the hue encoding curve, decreasing by one per unit of error
+	return (uint8_t)(255 - std::min(hue_decode_error(r, g, b), 255));
+}
+
+inline float hue_select(bool condition, float a, float b)
+{	// condition ? a : b, selected on the bit patterns so that neither value is
+	// computed conditionally and the per-pixel loops stay vectorizable.
+	uint32_t ua, ub;
+	std::memcpy(&ua, &a, sizeof(ua));
+	std::memcpy(&ub, &b, sizeof(ub));
+	uint32_t mask = -(uint32_t)condition;
+	uint32_t r = (ua & mask) | (ub & ~mask);
+	float f;
+	std::memcpy(&f, &r, sizeof(f));
+	return f;
+}
+
+struct HueEncodeTable
+{	// Lookup table of BGR values for every hue-encoded value (0 to 1530).
+	// This is generated at compile time.
+	uint8_t bgr[HUE_ENCODER_MAX + 1][3];
+
+	constexpr HueEncodeTable() : bgr{}
+	{
+		for (int v=0; v<=HUE_ENCODER_MAX; v++)
+		{
+			hue_encode_value(v, bgr[v][2], bgr[v][1], bgr[v][0]);
+		}
+	}
+};
+
+constexpr HueEncodeTable HUE_ENCODE_TABLE{};
+
+struct HueScheme
+{	// The hue encoding above as a per-pixel scheme for HueCodecT and HueSchemeCodec.
+	// A scheme maps values 0 (no data) to MAX to BGR colours and back, and measures
+	// how far a colour is from the scheme's colours (see hue_schemes.h for others).
+	static constexpr int MAX = HUE_ENCODER_MAX;
+
+	static const uint8_t* encode(int v) { return HUE_ENCODE_TABLE.bgr[v]; }	// BGR
+	static int decode(int r, int g, int b) { return hue_decode_value_branchless(r, g, b); }
+	static int error(int r, int g, int b) { return hue_decode_error(r, g, b); }
+};
+
+struct HueIntrinsics
+{	// Pinhole camera intrinsics in pixels (without distortion)
+	float fx, fy;	// focal lengths
+	float cx, cy;	// principal point
+};
+
+template <bool Inverse, typename DepthT=uint16_t, typename PixelT=cv::Vec3b, typename Scheme=HueScheme>
+class HueCodecT
+{	// Hue codec specialised at compile time on the colorization mode, on the
+	// depth (uint16_t or float) and pixel (cv::Vec3b BGR or cv::Vec4b BGRA) types,
+	// and on the per-pixel encoding scheme (HueScheme by default).
+	// The per-pixel loops contain no colorization branches.
+	//
+	// Depth values are in units of depth_scale metres, so a depth_scale of 1.0
+	// encodes and decodes float depth in metres.
+	//
+	// Construction only calculates the scaled depth range, so short-lived objects are cheap.
+	// HueCodec dispatches into these kernels once per frame.
+
+	static_assert(PixelT::channels == 3 || PixelT::channels == 4, "PixelT must be cv::Vec3b or cv::Vec4b");
+
 	public:
 
-	HueCodec(float depth_min_m, float depth_max_m, float depth_scale=HUE_MM_SCALE, bool inverse_colorization=true)
-	: m_depth_min_m(depth_min_m)
-	, m_depth_max_m(depth_max_m)
-	, m_depth_scale(depth_scale)
-	, m_inverse_colorization(inverse_colorization)
-	, m_depth_min_u(depth_min_m / depth_scale)
+	HueCodecT(float depth_min_m, float depth_max_m, float depth_scale=HUE_MM_SCALE)
+	: m_depth_min_u(depth_min_m / depth_scale)
 	, m_depth_max_u(depth_max_m / depth_scale)
+	, m_depth_scale(depth_scale)
 	{
-		if (m_inverse_colorization)
+		if (Inverse)
 		{
 			if (m_depth_min_u == 0.0f) m_depth_min_u = 1E-9;
 			m_depth_min_u = 1.0f/m_depth_min_u;
@@ -110,15 +202,201 @@ class HueCodec
 		}
 
 		m_depth_range_u = m_depth_max_u - m_depth_min_u;
+	}
+
+	static int depth_type() { return cv::DataType<DepthT>::type; }
+	static int pixel_type() { return cv::DataType<PixelT>::type; }
+
+	void encode_row(const DepthT* src, PixelT* dst, int cols) const
+	{	// Hue-encode one row of depth values
+		for (int j=0; j<cols; j++)
+		{
+			float d = src[j];
+			float u = Inverse ? 1.0f / d : d;
+			float scaled = (u - m_depth_min_u) / m_depth_range_u;
+			int v = (int)(Scheme::MAX * clamp(scaled, 0.0f, 1.0f) + 0.5f);
+			if (!(d > 0)) v = 0;	// zero, negative, and NaN values are invalid
+
+			const uint8_t* bgr = Scheme::encode(v);
+			dst[j][0] = bgr[0];
+			dst[j][1] = bgr[1];
+			dst[j][2] = bgr[2];
+			if (PixelT::channels == 4) dst[j][3] = 255;
+		}
+	}
+
+	void decode_row(const PixelT* src, DepthT* dst, int cols) const
+	{	// Hue-decode one row of pixels
+		for (int j=0; j<cols; j++)
+		{
+			int v = Scheme::decode(src[j][2], src[j][1], src[j][0]);
+
+			float u = m_depth_min_u + (m_depth_range_u * v / Scheme::MAX);
+			float d = hue_select(v != 0, Inverse ? 1.0f / u : u, 0.0f);
+
+			dst[j] = to_depth(d);
+		}
+	}
+
+	static void confidence_row(const PixelT* src, uint8_t* confidence, int cols)
+	{	// Decoding confidence of one row of pixels (see hue_decode_confidence)
+		for (int j=0; j<cols; j++)
+		{
+			confidence[j] = (uint8_t)(255 - std::min(Scheme::error(src[j][2], src[j][1], src[j][0]), 255));
+		}
+	}
+
+	template <bool Dense, typename PointT>
+	int decode_points_row(const PixelT* src, PointT* dst, int cols, int row, const HueIntrinsics& k) const
+	{	// Hue-decode one row of pixels straight to camera-frame XYZ points in metres.
+		// Organised (Dense=false): one point per pixel, NaN for pixels without data.
+		// Dense: only valid points are written. Returns the number of points written.
+		// The organised loop is branch-free so that it can be auto-vectorized.
+		const float y_factor = (row - k.cy) / k.fy;
+		const float inv_fx = 1.0f / k.fx;
+		const float nan = std::numeric_limits<float>::quiet_NaN();
+
+		int n = 0;
+		for (int j=0; j<cols; j++)
+		{
+			int v = Scheme::decode(src[j][2], src[j][1], src[j][0]);
+
+			float u = m_depth_min_u + (m_depth_range_u * v / Scheme::MAX);
+			float d = (Inverse ? 1.0f / u : u) * m_depth_scale;
+			if (!Dense) d = hue_select(v != 0, d, nan);
+
+			dst[n] = PointT((j - k.cx) * inv_fx * d, y_factor * d, d);
+			n += Dense ? (v != 0) : 1;
+		}
+		return n;
+	}
+
+	void decode_points(const cv::Mat& src, cv::Mat& dst, const HueIntrinsics& k) const
+	{	// Decode to an organised CV_32FC3 point cloud (NaN where there is no data)
+		if (src.empty() || src.type() != pixel_type()) return;
+		if (dst.size() != src.size() || dst.type() != CV_32FC3) dst.create(src.size(), CV_32FC3);
+
+		for (int i=0; i<src.rows; i++)
+		{
+			decode_points_row<false>(src.ptr<PixelT>(i), dst.ptr<cv::Vec3f>(i), src.cols, i, k);
+		}
+	}
+
+	void decode_points(const cv::Mat& src, std::vector<cv::Point3f>& points, const HueIntrinsics& k) const
+	{	// Decode to the valid points only, in row-major order.
+		// The capacity of points is kept, so reusing the vector avoids reallocation.
+		points.resize(src.empty() || src.type() != pixel_type() ? 0 : src.total());
+		size_t n = 0;
+		for (int i=0; i<src.rows && !points.empty(); i++)
+		{
+			n += decode_points_row<true>(src.ptr<PixelT>(i), &points[n], src.cols, i, k);
+		}
+		points.resize(n);
+	}
+
+	void encode(const cv::Mat& src, cv::Mat& dst) const
+	{	// Convert from a depth Mat of DepthT to a hue-encoded Mat of PixelT
+		if (src.empty() || src.type() != depth_type()) return;
+
+		cv::Mat tmp; // Create a temporary matrix to hold the output.
+		if (dst.data != src.data) tmp = dst; // Use dst as tmp if it's not the same as src.
+		if (tmp.size() != src.size() || tmp.type() != pixel_type())
+		{	// Initialize tmp if necessary (create keeps the allocator of dst)
+			tmp.create(src.size(), pixel_type());
+		}
+
+		for (int i=0; i<src.rows; i++)
+		{
+			encode_row(src.ptr<DepthT>(i), tmp.ptr<PixelT>(i), src.cols);
+		}
+
+		dst = tmp;
+	}
+
+	void decode(const cv::Mat& src, cv::Mat& dst) const
+	{	// Convert from a hue-encoded Mat of PixelT to a depth Mat of DepthT
+		if (src.empty() || src.type() != pixel_type()) return;
+
+		cv::Mat tmp; // Create a temporary matrix to hold the output.
+		if (dst.data != src.data) tmp = dst; // Use dst as tmp if it's not the same as src.
+		if (tmp.size() != src.size() || tmp.type() != depth_type())
+		{	// Initialize tmp if necessary (create keeps the allocator of dst)
+			tmp.create(src.size(), depth_type());
+		}
 
-		// Precompute the encoding lookup table.
-		const int enc_count = HUE_ENCODER_MAX + 1;
-		m_enc_table.resize(enc_count);
-		for (int i=0; i<enc_count; i++)
+		for (int i=0; i<src.rows; i++)
 		{
-			cv::Vec3b bgr = hue_encode_value(i);
-			m_enc_table[i] = bgr;
+			decode_row(src.ptr<PixelT>(i), tmp.ptr<DepthT>(i), src.cols);
 		}
+
+		dst = tmp;
+	}
+
+	void decode(const cv::Mat& src, cv::Mat& dst, cv::Mat& confidence) const
+	{	// Decode to a depth Mat of DepthT and a CV_8U per-pixel confidence Mat
+		if (src.empty() || src.type() != pixel_type()) return;
+		decode(src, dst);
+		if (confidence.size() != src.size() || confidence.type() != CV_8U) confidence.create(src.size(), CV_8U);
+
+		for (int i=0; i<src.rows; i++)
+		{
+			confidence_row(src.ptr<PixelT>(i), confidence.ptr<uint8_t>(i), src.cols);
+		}
+	}
+
+	cv::Mat encode(const cv::Mat& src) const
+	{	// Overloaded convenience function to return a Mat
+		cv::Mat dst;
+		encode(src, dst);
+		return dst;
+	}
+
+	cv::Mat decode(const cv::Mat& src) const
+	{	// Overloaded convenience function to return a Mat
+		cv::Mat dst;
+		decode(src, dst);
+		return dst;
+	}
+
+	private:
+
+	static DepthT to_depth(float d)
+	{	// Round and saturate for integer depth types
+		if (std::is_integral<DepthT>::value)
+		{
+			return (DepthT)std::min(d + 0.5f, (float)std::numeric_limits<DepthT>::max());
+		}
+		return (DepthT)d;
+	}
+
+	float m_depth_min_u, m_depth_max_u, m_depth_range_u;
+	float m_depth_scale;
+};
+
+template <typename Scheme>
+class HueSchemeCodec
+{	// Runtime-configured hue codec for depth and BGR images.
+	// Each call dispatches once into the HueCodecT kernel for the colorization mode
+	// and the depth type. Scheme is the per-pixel encoding: HueCodec is the
+	// codec for the hue encoding, and hue_schemes.h has alternatives.
+	//
+	// Supported depth inputs:
+	//   CV_16U depth in units of depth_scale metres (e.g. mm)
+	//   CV_32F depth in metres
+	//   CV_16U or CV_32F disparity (see encode_disparity)
+
+	public:
+
+	HueSchemeCodec(float depth_min_m, float depth_max_m, float depth_scale=HUE_MM_SCALE, bool inverse_colorization=true)
+	: m_depth_min_m(depth_min_m)
+	, m_depth_max_m(depth_max_m)
+	, m_depth_scale(depth_scale)
+	, m_inverse_colorization(inverse_colorization)
+	, m_standard(depth_min_m, depth_max_m, depth_scale)
+	, m_inverse(depth_min_m, depth_max_m, depth_scale)
+	, m_standard_m(depth_min_m, depth_max_m, 1.0f)
+	, m_inverse_m(depth_min_m, depth_max_m, 1.0f)
+	{
 	}
 
 	float depth_max_m() const { return m_depth_max_m; }
@@ -126,43 +404,26 @@ class HueCodec
 	float depth_scale() const { return m_depth_scale; }
 
 	void encode(const cv::Mat& src, cv::Mat& dst) const
-	{	// Convert from an OpenCV Mat of unsigned 16-bit integers
+	{	// Convert from an OpenCV Mat of unsigned 16-bit integers (or 32-bit floats in metres)
 		// to a 3-channel, 8-bit (BGR) hue-encoded OpenCV Mat.
 		// This function handles scaling of the input integer values from their
 		// existing values into the 0-1530 range required for encoding.
 		// Scaling is handled using m_depth_min_m, depth_max_m, and m_depth_scale
 		// values provided on object initialization.
+		// Float input is scaled directly from metres, keeping its full precision
+		// until quantization.
 		//
 		// This function also handles inverse colorization if specified.
 
-		if (src.empty() || src.type() != CV_16U) return;
-
-		cv::Mat tmp; // Create a temporary matrix to hold the output.
-		if (dst.data != src.data) tmp = dst; // Use dst as tmp if it's not the same as src.
-		if (tmp.size() != src.size() || tmp.type() != CV_8UC3)
-		{	// Initialize tmp if necessary
-			tmp = cv::Mat(src.size(), CV_8UC3);
-		}
-
-		for (int i=0; i<src.rows; i++)
+		if (src.type() == CV_32F)
 		{
-			for (int j=0; j<src.cols; j++)
-			{
-				float v = 0;
-
-				float d = src.at<uint16_t>(i, j);
-				if (d != 0)
-				{
-					if (m_inverse_colorization) d = 1.0f / d;
-					float scaled = (d - m_depth_min_u) / (m_depth_range_u);
-					v = (int)round(HUE_ENCODER_MAX * clamp(scaled, 0.0f, 1.0f));
-				}
-
-				tmp.at<cv::Vec3b>(i, j) = m_enc_table[v];
-			}
+			if (m_inverse_colorization) m_inverse_m.encode(src, dst);
+			else                        m_standard_m.encode(src, dst);
+			return;
 		}
 
-		dst = tmp;
+		if (m_inverse_colorization) m_inverse.encode(src, dst);
+		else                        m_standard.encode(src, dst);
 	}
 
 	cv::Mat encode(const cv::Mat& src) const
@@ -185,35 +446,74 @@ class HueCodec
 		//
 		// This function also handles inverse colorization if specified.
 
-		if (src.empty() || src.type() != CV_8UC3) return;
+		if (m_inverse_colorization) m_inverse.decode(src, dst);
+		else                        m_standard.decode(src, dst);
+	}
 
-		cv::Mat tmp; // Create a temporary matrix to hold the output.
-		if (dst.data != src.data) tmp = dst; // Use dst as tmp if it's not the same as src.
-		if (tmp.size() != src.size() || tmp.type() != CV_8UC3)
-		{	// Initialize tmp if necessary
-			tmp = cv::Mat(src.size(), CV_16U);
-		}
+	void decode(const cv::Mat& src, cv::Mat& dst, int ddepth) const
+	{	// Decode to the given output depth:
+		// CV_16U for depth in units of m_depth_scale (as above) or CV_32F for depth in metres.
+		// The conversion to metres is done in the same pass as the hue decoding.
 
-		for (int i=0; i<src.rows; i++)
-		{
-			for (int j=0; j<src.cols; j++)
-			{
-				const cv::Vec3b& bgr(src.at<cv::Vec3b>(i, j));
-				uint16_t v = hue_decode_value(bgr);
+		if (ddepth != CV_32F) decode(src, dst);
+		else if (m_inverse_colorization) m_inverse_m.decode(src, dst);
+		else                             m_standard_m.decode(src, dst);
+	}
 
-				float d;
-				if (v == 0 || v > HUE_ENCODER_MAX) d = 0;
-				else
-				{
-					d = (m_depth_min_u + (m_depth_range_u * v / HUE_ENCODER_MAX));
-					if (m_inverse_colorization) d = 1.0 / d;
-				}
+	void decode(const cv::Mat& src, cv::Mat& dst, cv::Mat& confidence, int ddepth=CV_16U) const
+	{	// Decode as above, and also output a CV_8U confidence Mat that measures how far
+		// each pixel is from the hue encoding curve: 255 for an exact hue colour,
+		// lower for pixels that lossy compression pushed off the curve.
+		// Pixels can be rejected with e.g. (confidence < 224), or only the
+		// low-confidence pixels can be repaired with median_filter and a mask.
 
-				tmp.at<uint16_t>(i, j) = round(d);
-			}
+		if (ddepth == CV_32F)
+		{
+			if (m_inverse_colorization) m_inverse_m.decode(src, dst, confidence);
+			else                        m_standard_m.decode(src, dst, confidence);
+			return;
 		}
 
-		dst = tmp;
+		if (m_inverse_colorization) m_inverse.decode(src, dst, confidence);
+		else                        m_standard.decode(src, dst, confidence);
+	}
+
+	void decode_points(const cv::Mat& src, cv::Mat& dst, const HueIntrinsics& intrinsics) const
+	{	// Decode to an organised CV_32FC3 XYZ point cloud in metres in the camera frame
+		// (x right, y down, z forward), with NaN points where there is no data.
+		// Deprojection is done in the same pass as the hue decoding, and the depth
+		// is not rounded to depth_scale units first.
+
+		if (m_inverse_colorization) m_inverse_m.decode_points(src, dst, intrinsics);
+		else                        m_standard_m.decode_points(src, dst, intrinsics);
+	}
+
+	void decode_points(const cv::Mat& src, std::vector<cv::Point3f>& points, const HueIntrinsics& intrinsics) const
+	{	// Decode to a dense point cloud that only contains the valid points
+		if (m_inverse_colorization) m_inverse_m.decode_points(src, points, intrinsics);
+		else                        m_standard_m.decode_points(src, points, intrinsics);
+	}
+
+	void encode_disparity(const cv::Mat& src, cv::Mat& dst, float disparity_depth_m) const
+	{	// Hue-encode a CV_16U or CV_32F disparity map, where
+		// depth in metres = disparity_depth_m / disparity
+		// (i.e. disparity_depth_m is focal length x baseline x any subpixel factor).
+		//
+		// Disparity is proportional to inverse depth, so the result is the same
+		// hue-encoded image as encoding the equivalent depth map, without
+		// converting to depth first. It can be decoded with either decode or
+		// decode_disparity.
+
+		if (src.type() == CV_32F) encode_disparity_t<float>(src, dst, disparity_depth_m);
+		else                      encode_disparity_t<uint16_t>(src, dst, disparity_depth_m);
+	}
+
+	void decode_disparity(const cv::Mat& src, cv::Mat& dst, float disparity_depth_m, int ddepth=CV_16U) const
+	{	// Decode a hue-encoded image to a CV_16U or CV_32F disparity map
+		// (see encode_disparity).
+
+		if (ddepth == CV_32F) decode_disparity_t<float>(src, dst, disparity_depth_m);
+		else                  decode_disparity_t<uint16_t>(src, dst, disparity_depth_m);
 	}
 
 	cv::Mat decode(const cv::Mat& src) const
@@ -229,11 +529,45 @@ class HueCodec
 	bool m_inverse_colorization;
 
 	private:
-	float m_depth_min_u, m_depth_max_u, m_depth_range_u;
-	std::vector<cv::Vec3b> m_enc_table;
+
+	// Inverse colorization of depth is linear in disparity and vice versa,
+	// so the disparity kernels use the opposite colorization mode with the
+	// depth range expressed as disparities.
+	void disparity_range(float disparity_depth_m, float& disparity_min, float& disparity_max) const
+	{	// The depth range as disparities. A depth_min of 0 is clamped to 1E-9 units
+		// as in the HueCodecT constructor, so that the range stays finite.
+		float depth_min_m = m_depth_min_m == 0.0f ? 1E-9f * m_depth_scale : m_depth_min_m;
+		disparity_min = disparity_depth_m / depth_min_m;
+		disparity_max = disparity_depth_m / m_depth_max_m;
+	}
+
+	template <typename DisparityT>
+	void encode_disparity_t(const cv::Mat& src, cv::Mat& dst, float disparity_depth_m) const
+	{
+		float disparity_min, disparity_max;
+		disparity_range(disparity_depth_m, disparity_min, disparity_max);
+		if (m_inverse_colorization) HueCodecT<false, DisparityT, cv::Vec3b, Scheme>(disparity_min, disparity_max, 1.0f).encode(src, dst);
+		else                        HueCodecT<true,  DisparityT, cv::Vec3b, Scheme>(disparity_min, disparity_max, 1.0f).encode(src, dst);
+	}
+
+	template <typename DisparityT>
+	void decode_disparity_t(const cv::Mat& src, cv::Mat& dst, float disparity_depth_m) const
+	{
+		float disparity_min, disparity_max;
+		disparity_range(disparity_depth_m, disparity_min, disparity_max);
+		if (m_inverse_colorization) HueCodecT<false, DisparityT, cv::Vec3b, Scheme>(disparity_min, disparity_max, 1.0f).decode(src, dst);
+		else                        HueCodecT<true,  DisparityT, cv::Vec3b, Scheme>(disparity_min, disparity_max, 1.0f).decode(src, dst);
+	}
+
+	HueCodecT<false, uint16_t, cv::Vec3b, Scheme> m_standard;
+	HueCodecT<true,  uint16_t, cv::Vec3b, Scheme> m_inverse;
+	HueCodecT<false, float, cv::Vec3b, Scheme> m_standard_m;	// float depth in metres
+	HueCodecT<true,  float, cv::Vec3b, Scheme> m_inverse_m;
 };
 
-uint16_t calc_median(std::vector<uint16_t>& vec)
+typedef HueSchemeCodec<HueScheme> HueCodec;
+
+inline uint16_t calc_median(std::vector<uint16_t>& vec)
 {	// Efficient calculation of the median value.
 	// Note that this calculates the median as if it's an odd-sized vector.
 	// A standard median calculation is not used to improve performance.
@@ -248,7 +582,7 @@ uint16_t calc_median(std::vector<uint16_t>& vec)
 }
 
 
-bool get_above_diff_threshold(uint16_t val, uint16_t median, float diff_threshold)
+inline bool get_above_diff_threshold(uint16_t val, uint16_t median, float diff_threshold)
 {	// Check to see that the maximum value from the vector is higher than
 	// the diff_threshold (percentage difference)
 	float percent_difference = ((float)val - (float)median) / (float)median;
@@ -257,7 +591,55 @@ bool get_above_diff_threshold(uint16_t val, uint16_t median, float diff_threshol
 }
 
 
-void median_filter(cv::Mat& src, cv::Mat& dst, int kernel_size=2, float diff_threshold=0.0f)
+inline void median_filter_row(const uint16_t* const* rows, uint16_t* dst, int cols, int kernel_size, float diff_threshold,
+	const uint8_t* mask_row, std::vector<uint16_t>& target_kernel)
+{	// Median filter one row (see median_filter) from the 2*kernel_size+1 rows
+	// centred on it, where rows[kernel_size] is the row itself. The first and last
+	// kernel_size columns are set to zero (or copied where the mask is 0).
+	// target_kernel is scratch space.
+
+	int k = std::min(kernel_size, cols);
+	const uint16_t* row = rows[kernel_size];
+	for (int j=0; j<k; j++) dst[j] = mask_row && !mask_row[j] ? row[j] : 0;
+	for (int j=std::max(k, cols - k); j<cols; j++) dst[j] = mask_row && !mask_row[j] ? row[j] : 0;
+
+	for (int j=kernel_size; j<cols-kernel_size; j++)
+	{
+		const uint16_t val = rows[kernel_size][j];
+		if (mask_row && !mask_row[j])
+		{
+			dst[j] = val;
+			continue;
+		}
+
+		target_kernel.clear();
+
+		for (int y=0; y<2*kernel_size+1; y++)
+		{
+			for (int x=-kernel_size; x<kernel_size+1; x++)
+			{
+				uint16_t v = rows[y][j+x];
+				if (v != 0)
+				{
+					target_kernel.push_back(v);
+				}
+			}
+		}
+
+		uint16_t median = calc_median(target_kernel);
+
+		if (val == 0) dst[j] = median;
+		else
+		{
+			bool above_threshold = get_above_diff_threshold(val, median, diff_threshold);
+			if (above_threshold) dst[j] = median;
+			else dst[j] = val;
+		}
+	}
+}
+
+
+inline void median_filter(cv::Mat& src, cv::Mat& dst, int kernel_size=2, float diff_threshold=0.0f, const cv::Mat& mask=cv::Mat())
 {
 	// Apply a median filter to the depth image
 	// This can be done as a postprocessing step to eliminate compression artefacts
@@ -272,7 +654,18 @@ void median_filter(cv::Mat& src, cv::Mat& dst, int kernel_size=2, float diff_thr
 
 	// If possible this filter will fill in zero areas with the local median value
 
-	if (src.empty() || src.type() != CV_16U) return;
+	// The first and last kernel_size rows and columns are not filtered and are
+	// set to zero.
+
+	// If a CV_8U mask of the same size is given, only pixels where the mask is
+	// non-zero are filtered (e.g. confidence < 224 from HueCodec::decode) and
+	// all other pixels, including those in the border, are copied unchanged.
+
+	// Each row only needs the 2*kernel_size+1 rows around it, so strips of rows
+	// can also be filtered as they arrive (see HueStripDecoder in hue_strip.h).
+
+	if (src.empty() || src.type() != CV_16U || kernel_size < 0) return;
+	if (!mask.empty() && (mask.size() != src.size() || mask.type() != CV_8U)) return;
 
 	if (kernel_size == 0)
 	{
@@ -282,48 +675,40 @@ void median_filter(cv::Mat& src, cv::Mat& dst, int kernel_size=2, float diff_thr
 
 	cv::Mat tmp; // Create a temporary matrix to hold the output.
 	if (dst.data != src.data) tmp = dst; // Use dst as tmp if it's not the same as src.
-	if (tmp.size() != src.size() || tmp.type() != CV_8UC3)
-	{	// Initialize tmp if necessary
-		tmp = cv::Mat(src.size(), CV_16U, cv::Scalar(0));
+	if (tmp.size() != src.size() || tmp.type() != CV_16U)
+	{	// Initialize tmp if necessary (create keeps the allocator of dst)
+		tmp.create(src.size(), CV_16U);
 	}
 
-	std::vector<unsigned short> target_kernel;
+	// The border rows are not filtered (median_filter_row handles the border columns)
+	auto border_row = [&](int i)
+	{	// Zero, or copied where the mask is 0
+		const uint16_t* in = src.ptr<uint16_t>(i);
+		const uint8_t* mask_row = mask.empty() ? nullptr : mask.ptr<uint8_t>(i);
+		uint16_t* out = tmp.ptr<uint16_t>(i);
+		for (int j=0; j<src.cols; j++) out[j] = mask_row && !mask_row[j] ? in[j] : 0;
+	};
+	int k = std::min(kernel_size, src.rows);
+	for (int i=0; i<k; i++) border_row(i);
+	for (int i=std::max(k, src.rows - k); i<src.rows; i++) border_row(i);
+
+	// Reused between calls so that steady-state filtering does not allocate
+	static thread_local std::vector<uint16_t> target_kernel;
+	static thread_local std::vector<const uint16_t*> rows;
+	target_kernel.reserve((2*kernel_size+1) * (2*kernel_size+1));
+	rows.resize(2*kernel_size+1);
+
 	for (int i=kernel_size; i<src.rows-kernel_size; i++)
 	{
-		for (int j=kernel_size; j<src.cols-kernel_size; j++)
-		{
-			target_kernel.clear();
-			target_kernel.reserve(pow(2*kernel_size+1, 2));
-
-			for (int y=-kernel_size; y<kernel_size+1; y++)
-			{
-				for (int x=-kernel_size; x<kernel_size+1; x++)
-				{
-					uint16_t val = src.at<uint16_t>(i+y, j+x);
-					if (val != 0)
-					{
-						target_kernel.push_back(src.at<uint16_t>(i+y, j+x));
-					}
-				}
-			}
-
-			uint16_t median = calc_median(target_kernel);
-			uint16_t val = src.at<uint16_t>(i, j);
-
-			if (val == 0) tmp.at<uint16_t>(i, j) = median;
-			else
-			{
-				bool above_threshold = get_above_diff_threshold(val, median, diff_threshold);
-				if (above_threshold) tmp.at<uint16_t>(i, j) = median;
-				else tmp.at<uint16_t>(i, j) = val;
-			}
-		}
+		for (int y=0; y<2*kernel_size+1; y++) rows[y] = src.ptr<uint16_t>(i - kernel_size + y);
+		const uint8_t* mask_row = mask.empty() ? nullptr : mask.ptr<uint8_t>(i);
+		median_filter_row(rows.data(), tmp.ptr<uint16_t>(i), src.cols, kernel_size, diff_threshold, mask_row, target_kernel);
 	}
 
 	dst = tmp;
 }
 
-cv::Mat median_filter(cv::Mat& src, int kernel_size=1, float diff_threshold=0.02f)
+inline cv::Mat median_filter(cv::Mat& src, int kernel_size=1, float diff_threshold=0.02f)
 {	// Overloaded convenience function to return a Mat
 
 	cv::Mat dst;
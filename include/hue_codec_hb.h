@@ -0,0 +1,300 @@
+#pragma once
+#include <opencv2/opencv.hpp>   // Include OpenCV API
+#include <hue_codec.h>          // The header-only hue codec
+#include <algorithm>
+#include <cstdint>
+
+// High bit-depth hue encoding
+//
+// The hue encoding scheme in hue_codec.h uses 255 steps per hue segment because
+// each channel is 8 bits, giving 6 x 255 + 1 = 1531 values. With n-bit channels,
+// each of the six segments has N = 2^n - 1 steps, giving 6N + 1 values:
+//
+//   10-bit channels: 6 x 1023 + 1 =  6139 values
+//   12-bit channels: 6 x 4095 + 1 = 24571 values
+//
+//     value         || red     | green   | blue    |
+// ----------------------------------------------------
+//            0      || 0       | 0       | 0       |
+//     1 -  N        || N       | v-1     | 0       |
+//   N+1 - 2N        || 2N+1-v  | N       | 0       |
+//  2N+1 - 3N        || 0       | N       | v-2N-1  |
+//  3N+1 - 4N        || 0       | 4N+1-v  | N       |
+//  4N+1 - 5N        || v-4N-1  | 0       | N       |
+//  5N+1 - 6N        || N       | 0       | 6N+1-v  |
+//
+// With N = 255 this is identical to the 8-bit scheme.
+//
+// HueCodecHB outputs CV_16UC3 BGR images with channel values in the range 0 to N
+// (e.g. for 16-bit PNG or TIFF), and can convert them to and from P010
+// (10-bit 4:2:0 YUV, as used by HEVC Main10 and AV1 10-bit encoders).
+
+constexpr void hue_encode_value_n(uint32_t v, uint32_t n, uint16_t& r, uint16_t& g, uint16_t& b)
+{	// Conversion from a value in the range of 0 to 6n to an RGB color with channels in 0 to n
+	if      ( v==0      ) { r=0;         g=0;         b=0;         }
+	else if ( v< 1*n+1  ) { r=n;         g=v-1;       b=0;         }
+	else if ( v< 2*n+1  ) { r=2*n+1-v;   g=n;         b=0;         }
+	else if ( v< 3*n+1  ) { r=0;         g=n;         b=v-2*n-1;   }
+	else if ( v< 4*n+1  ) { r=0;         g=4*n+1-v;   b=n;         }
+	else if ( v< 5*n+1  ) { r=v-4*n-1;   g=0;         b=n;         }
+	else if ( v< 6*n+1  ) { r=n;         g=0;         b=6*n+1-v;   }
+	else                  { r=n;         g=0;         b=0;         }
+}
+
+constexpr uint32_t hue_decode_value_n(int r, int g, int b, int n)
+{	// Conversion from RGB color values with channels in 0 to n
+	// to a quantized value in the range of 0 to 6n
+	// The "no data" threshold scales the 8-bit threshold (128 of 765) to n.
+
+	if (b + g + r > (128 * n) / 255)
+	{
+		if (r >= g && r >= b)
+		{
+			if (g >= b) return g - b + 1;
+			else        return g - b + 6*n + 1;
+		}
+		else if (g >= r && g >= b) return b - r + 2*n + 1;
+		else                       return r - g + 4*n + 1;
+	}
+	return 0;
+}
+
+class HueCodecHB
+{
+	public:
+
+	HueCodecHB(float depth_min_m, float depth_max_m, float depth_scale=HUE_MM_SCALE, bool inverse_colorization=true, int bits=10)
+	: m_depth_min_m(depth_min_m)
+	, m_depth_max_m(depth_max_m)
+	, m_depth_scale(depth_scale)
+	, m_inverse_colorization(inverse_colorization)
+	, m_bits(std::max(8, std::min(bits, 16)))
+	, m_n((1 << m_bits) - 1)
+	, m_encoder_max(6 * m_n)
+	, m_units(depth_min_m, depth_max_m, depth_scale, inverse_colorization)
+	, m_metres(depth_min_m, depth_max_m, 1.0f, inverse_colorization)
+	{
+	}
+
+	float depth_max_m() const { return m_depth_max_m; }
+	float depth_min_m() const { return m_depth_min_m; }
+	float depth_scale() const { return m_depth_scale; }
+	int bits() const { return m_bits; }
+	int encoder_max() const { return m_encoder_max; }
+
+	void encode(const cv::Mat& src, cv::Mat& dst) const
+	{	// Convert from an OpenCV Mat of unsigned 16-bit integers (or 32-bit floats in metres)
+		// to a 3-channel, 16-bit (BGR) hue-encoded OpenCV Mat with channels in 0 to 2^bits-1.
+
+		if (src.empty() || (src.type() != CV_16U && src.type() != CV_32F)) return;
+
+		cv::Mat tmp; // Create a temporary matrix to hold the output.
+		if (dst.data != src.data) tmp = dst; // Use dst as tmp if it's not the same as src.
+		if (tmp.size() != src.size() || tmp.type() != CV_16UC3)
+		{	// Initialize tmp if necessary
+			tmp.create(src.size(), CV_16UC3);
+		}
+
+		for (int i=0; i<src.rows; i++)
+		{
+			cv::Vec3w* out = tmp.ptr<cv::Vec3w>(i);
+			if (src.type() == CV_32F)
+			{
+				if (m_inverse_colorization) encode_row<true> (src.ptr<float>(i), out, src.cols, m_metres);
+				else                        encode_row<false>(src.ptr<float>(i), out, src.cols, m_metres);
+			}
+			else
+			{
+				if (m_inverse_colorization) encode_row<true> (src.ptr<uint16_t>(i), out, src.cols, m_units);
+				else                        encode_row<false>(src.ptr<uint16_t>(i), out, src.cols, m_units);
+			}
+		}
+
+		dst = tmp;
+	}
+
+	cv::Mat encode(const cv::Mat& src) const
+	{	// Overloaded convenience function to return a Mat
+		cv::Mat dst;
+		encode(src, dst);
+		return dst;
+	}
+
+	void decode(const cv::Mat& src, cv::Mat& dst, int ddepth=CV_16U) const
+	{	// Convert from a 3-channel, 16-bit (BGR) hue-encoded OpenCV Mat
+		// to an OpenCV Mat of unsigned 16-bit integers (or 32-bit floats in metres if ddepth is CV_32F)
+
+		if (src.empty() || src.type() != CV_16UC3) return;
+
+		cv::Mat tmp; // Create a temporary matrix to hold the output.
+		if (dst.data != src.data) tmp = dst; // Use dst as tmp if it's not the same as src.
+		int type = (ddepth == CV_32F) ? CV_32F : CV_16U;
+		if (tmp.size() != src.size() || tmp.type() != type)
+		{	// Initialize tmp if necessary
+			tmp.create(src.size(), type);
+		}
+
+		for (int i=0; i<src.rows; i++)
+		{
+			const cv::Vec3w* in = src.ptr<cv::Vec3w>(i);
+			if (type == CV_32F)
+			{
+				if (m_inverse_colorization) decode_row<true> (in, tmp.ptr<float>(i), src.cols, m_metres);
+				else                        decode_row<false>(in, tmp.ptr<float>(i), src.cols, m_metres);
+			}
+			else
+			{
+				if (m_inverse_colorization) decode_row<true> (in, tmp.ptr<uint16_t>(i), src.cols, m_units);
+				else                        decode_row<false>(in, tmp.ptr<uint16_t>(i), src.cols, m_units);
+			}
+		}
+
+		dst = tmp;
+	}
+
+	cv::Mat decode(const cv::Mat& src) const
+	{	// Overloaded convenience function to return a Mat
+		cv::Mat dst;
+		decode(src, dst);
+		return dst;
+	}
+
+	void to_p010(const cv::Mat& src, cv::Mat& dst) const
+	{	// Convert a hue-encoded CV_16UC3 BGR image to P010:
+		// a CV_16UC1 Mat of rows*3/2 rows holding the Y plane followed by the
+		// interleaved UV plane, with 10-bit BT.709 limited-range samples in the
+		// upper bits of each 16-bit word. Chroma is averaged over 2x2 blocks.
+		// The width and height must be even.
+
+		if (src.empty() || src.type() != CV_16UC3 || src.rows % 2 || src.cols % 2) return;
+
+		const float scale = 1.0f / m_n;
+		const int h = src.rows, w = src.cols;
+		dst.create(h * 3 / 2, w, CV_16UC1);
+
+		for (int i=0; i<h; i+=2)
+		{
+			const cv::Vec3w* in[2] = { src.ptr<cv::Vec3w>(i), src.ptr<cv::Vec3w>(i+1) };
+			uint16_t* y[2] = { dst.ptr<uint16_t>(i), dst.ptr<uint16_t>(i+1) };
+			uint16_t* uv = dst.ptr<uint16_t>(h + i/2);
+
+			for (int j=0; j<w; j+=2)
+			{
+				float pb = 0.0f, pr = 0.0f;
+				for (int k=0; k<2; k++)
+				{
+					for (int l=0; l<2; l++)
+					{
+						const cv::Vec3w& p = in[k][j+l];
+						float b = p[0] * scale, g = p[1] * scale, r = p[2] * scale;
+						float luma = 0.2126f*r + 0.7152f*g + 0.0722f*b;
+						y[k][j+l] = p010_sample(64.0f + 876.0f * luma);
+						pb += (b - luma) / 1.8556f;
+						pr += (r - luma) / 1.5748f;
+					}
+				}
+				uv[j]   = p010_sample(512.0f + 896.0f * pb * 0.25f);
+				uv[j+1] = p010_sample(512.0f + 896.0f * pr * 0.25f);
+			}
+		}
+	}
+
+	void from_p010(const cv::Mat& src, cv::Mat& dst) const
+	{	// Convert P010 (see to_p010) back to a CV_16UC3 BGR image with channels in 0 to 2^bits-1.
+
+		if (src.empty() || src.type() != CV_16UC1 || src.rows % 3) return;
+
+		const int h = src.rows * 2 / 3, w = src.cols;
+		dst.create(h, w, CV_16UC3);
+
+		for (int i=0; i<h; i++)
+		{
+			const uint16_t* y  = src.ptr<uint16_t>(i);
+			const uint16_t* uv = src.ptr<uint16_t>(h + i/2);
+			cv::Vec3w* out = dst.ptr<cv::Vec3w>(i);
+
+			for (int j=0; j<w; j++)
+			{
+				float luma = ((y[j] >> 6) - 64.0f) / 876.0f;
+				float pb = ((uv[j & ~1] >> 6) - 512.0f) / 896.0f;
+				float pr = ((uv[j | 1]  >> 6) - 512.0f) / 896.0f;
+
+				float r = luma + 1.5748f * pr;
+				float g = luma - 0.1873f * pb - 0.4681f * pr;
+				float b = luma + 1.8556f * pb;
+
+				out[j][0] = channel(b);
+				out[j][1] = channel(g);
+				out[j][2] = channel(r);
+			}
+		}
+	}
+
+	public:
+	float m_depth_min_m, m_depth_max_m, m_depth_scale;
+	bool m_inverse_colorization;
+
+	private:
+
+	struct ScaledRange
+	{	// Depth range in the units of the input (depth units or metres)
+		ScaledRange(float depth_min_m, float depth_max_m, float depth_scale, bool inverse)
+		: min_u(depth_min_m / depth_scale)
+		, max_u(depth_max_m / depth_scale)
+		{
+			if (inverse)
+			{
+				if (min_u == 0.0f) min_u = 1E-9;
+				min_u = 1.0f/min_u;
+				max_u = 1.0f/max_u;
+			}
+			range_u = max_u - min_u;
+		}
+		float min_u, max_u, range_u;
+	};
+
+	template <bool Inverse, typename DepthT>
+	void encode_row(const DepthT* src, cv::Vec3w* dst, int cols, const ScaledRange& r) const
+	{
+		const uint32_t n = m_n;
+		for (int j=0; j<cols; j++)
+		{
+			float d = src[j];
+			float u = Inverse ? 1.0f / d : d;
+			float scaled = (u - r.min_u) / r.range_u;
+			uint32_t v = (uint32_t)(m_encoder_max * clamp(scaled, 0.0f, 1.0f) + 0.5f);
+			if (!(d > 0)) v = 0;
+
+			hue_encode_value_n(v, n, dst[j][2], dst[j][1], dst[j][0]);
+		}
+	}
+
+	template <bool Inverse, typename DepthT>
+	void decode_row(const cv::Vec3w* src, DepthT* dst, int cols, const ScaledRange& r) const
+	{
+		for (int j=0; j<cols; j++)
+		{
+			uint32_t v = hue_decode_value_n(src[j][2], src[j][1], src[j][0], m_n);
+
+			float u = r.min_u + (r.range_u * v / m_encoder_max);
+			float d = Inverse ? 1.0f / u : u;
+			if (v == 0) d = 0;
+
+			if (std::is_integral<DepthT>::value) dst[j] = (DepthT)std::min(d + 0.5f, 65535.0f);
+			else                                 dst[j] = (DepthT)d;
+		}
+	}
+
+	static uint16_t p010_sample(float v)
+	{	// Round and clamp a 10-bit sample and store it in the upper bits
+		return (uint16_t)((int)clamp(v + 0.5f, 0.0f, 1023.0f) << 6);
+	}
+
+	uint16_t channel(float v) const
+	{	// Scale a [0, 1] channel value to [0, n]
+		return (uint16_t)clamp(v * m_n + 0.5f, 0.0f, (float)m_n);
+	}
+
+	int m_bits, m_n, m_encoder_max;
+	ScaledRange m_units, m_metres;
+};
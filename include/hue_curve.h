@@ -0,0 +1,314 @@
+#pragma once
+#include <opencv2/opencv.hpp>   // Include OpenCV API
+#include <hue_codec.h>          // The header-only hue codec
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// Custom transfer curves for the depth to hue mapping
+//
+// HueCodec spaces its 1531 levels linearly in depth or in inverse depth. A
+// HueCurve maps depth to hue levels with any monotonic curve, and HueCurveCodec
+// encodes and decodes with it:
+//
+//     HueCurve curve = HueCurve::log(0.3f, 20.0f);        // or power, piecewise, accuracy, table
+//     HueCurveCodec codec(curve);
+//     codec.encode(depth, encoded);
+//     codec.decode(encoded, depth);
+//
+// Each curve is baked into a 65536-entry encoding table (depth units to levels)
+// and a 1531-entry decoding table (levels to depth units and metres), so the
+// per-pixel cost is two table lookups whatever the curve. A level decodes to the
+// middle of the depths that encode to it, which minimises the worst-case error.
+//
+// The curve is a fraction from 0 (the first level) to 1 (the last level) as a
+// function of depth, and must not decrease. As with HueCodec, depths that map to
+// level 0 (i.e. within half a level of the start of the curve) have no data.
+
+class HueCurve
+{
+	public:
+
+	HueCurve() {}
+
+	static HueCurve linear(float depth_min_m, float depth_max_m, float depth_scale=HUE_MM_SCALE)
+	{	// The same levels as HueCodec without inverse colorization
+		return from_function([=](double d) { return (d - depth_min_m) / (depth_max_m - depth_min_m); }, depth_scale);
+	}
+
+	static HueCurve inverse(float depth_min_m, float depth_max_m, float depth_scale=HUE_MM_SCALE)
+	{	// The same levels as HueCodec with inverse colorization
+		return from_function([=](double d) { return (1.0 / d - 1.0 / depth_min_m) / (1.0 / depth_max_m - 1.0 / depth_min_m); }, depth_scale);
+	}
+
+	static HueCurve log(float depth_min_m, float depth_max_m, float depth_scale=HUE_MM_SCALE)
+	{	// Levels spaced in proportion to depth (a constant relative error)
+		return from_function([=](double d) { return std::log(d / depth_min_m) / std::log((double)depth_max_m / depth_min_m); }, depth_scale);
+	}
+
+	static HueCurve power(float depth_min_m, float depth_max_m, float gamma, float depth_scale=HUE_MM_SCALE)
+	{	// fraction = ((depth - min) / (max - min))^gamma: gamma < 1 spends more levels near min
+		return from_function([=](double d) { return std::pow(std::max(0.0, (d - depth_min_m) / (depth_max_m - depth_min_m)), (double)gamma); }, depth_scale);
+	}
+
+	static HueCurve piecewise(const std::vector<cv::Point2f>& points, float depth_scale=HUE_MM_SCALE)
+	{	// Piecewise-linear curve through (depth in metres, fraction) control points,
+		// sorted by increasing depth. The fraction is clamped to the first and last point.
+		if (points.size() < 2) return HueCurve();
+		return from_function([&](double d) { return interpolate(points, d); }, depth_scale);
+	}
+
+	static HueCurve accuracy(const std::vector<cv::Point2f>& points, float depth_scale=HUE_MM_SCALE)
+	{	// Spends levels in inverse proportion to the sensor error, given as a
+		// piecewise-linear curve of (depth in metres, error in metres) points sorted
+		// by increasing depth. The curve covers the depths of the first and last point.
+		if (points.size() < 2) return HueCurve();
+
+		std::vector<double> fraction(65536, 0.0);
+		double total = 0.0;
+		for (int d=1; d<65536; d++)
+		{
+			double m = d * (double)depth_scale;
+			if (m > points.front().x && m <= points.back().x) total += 1.0 / std::max(interpolate(points, m), 1E-9);
+			fraction[d] = total;
+		}
+		if (total <= 0.0) return HueCurve();
+
+		std::vector<uint16_t> levels(65536);
+		for (int d=0; d<65536; d++) levels[d] = to_level(fraction[d] / total);
+		return table(levels, depth_scale);
+	}
+
+	static HueCurve table(const std::vector<uint16_t>& levels, float depth_scale=HUE_MM_SCALE)
+	{	// A user-supplied table of 65536 hue levels (0 to 1530), one for each depth
+		// in depth_scale units. The levels must not decrease. Returns an invalid
+		// (empty) curve if the table cannot be used.
+		HueCurve curve;
+		if (levels.size() != 65536) return curve;
+		for (size_t d=1; d<levels.size(); d++)
+		{
+			if (levels[d] > HUE_ENCODER_MAX || (d > 1 && levels[d] < levels[d-1])) return curve;
+		}
+
+		curve.m_depth_scale = depth_scale;
+		curve.m_encode = levels;
+		curve.m_encode[0] = 0;	// no data
+		curve.build_decode_tables();
+		return curve;
+	}
+
+	bool valid() const { return !m_encode.empty(); }
+	float depth_scale() const { return m_depth_scale; }
+
+	int level(uint16_t depth) const { return m_encode[depth]; }		// depth in depth_scale units
+	uint16_t depth(int level) const { return m_decode[level]; }		// depth_scale units
+	float depth_m(int level) const { return m_decode_m[level]; }		// metres
+
+	float depth_min_m() const { return m_decode_m[1]; }
+	float depth_max_m() const { return m_decode_m[HUE_ENCODER_MAX]; }
+
+	const uint16_t* encode_table() const { return m_encode.data(); }
+	const uint16_t* decode_table() const { return m_decode.data(); }
+	const float* decode_table_m() const { return m_decode_m.data(); }
+
+	private:
+
+	template <typename F>
+	static HueCurve from_function(F fraction, float depth_scale)
+	{
+		std::vector<uint16_t> levels(65536, 0);
+		for (int d=1; d<65536; d++) levels[d] = to_level(fraction(d * (double)depth_scale));
+		return table(levels, depth_scale);
+	}
+
+	static uint16_t to_level(double fraction)
+	{
+		if (!(fraction > 0.0)) return 0;	// also NaN
+		return (uint16_t)(HUE_ENCODER_MAX * std::min(fraction, 1.0) + 0.5);
+	}
+
+	static double interpolate(const std::vector<cv::Point2f>& points, double x)
+	{	// Piecewise-linear interpolation of y(x), clamped at both ends
+		if (x <= points.front().x) return points.front().y;
+		for (size_t k=1; k<points.size(); k++)
+		{
+			if (x <= points[k].x)
+			{
+				const cv::Point2f& a = points[k-1];
+				const cv::Point2f& b = points[k];
+				return a.y + (b.y - a.y) * (x - a.x) / std::max((double)b.x - a.x, 1E-12);
+			}
+		}
+		return points.back().y;
+	}
+
+	void build_decode_tables()
+	{	// Each level decodes to the middle of the depths that encode to it. Levels
+		// that no depth encodes to (where the curve is steeper than one level per
+		// depth unit) are interpolated from their neighbours.
+		const int n = HUE_ENCODER_MAX + 1;
+		std::vector<int> first(n, -1), last(n, -1);
+		for (int d=1; d<65536; d++)
+		{
+			int v = m_encode[d];
+			if (first[v] < 0) first[v] = d;
+			last[v] = d;
+		}
+
+		std::vector<double> centre(n, -1.0);
+		int used = 0;	// first level that a depth encodes to
+		for (int v=n-1; v>=1; v--)
+		{
+			if (first[v] < 0) continue;
+			centre[v] = 0.5 * (first[v] + last[v]);
+			used = v;
+		}
+		if (used == 0)
+		{	// no depth maps to a level above 0
+			m_encode.clear();
+			return;
+		}
+
+		int top = m_encode[65535];
+		if (top > used && first[top-1] >= 0)
+		{	// The top level also holds every depth beyond the end of the curve, so it
+			// decodes to where a level as wide as the one below it would end
+			centre[top] = first[top] + 0.5 * (last[top-1] - first[top-1]);
+		}
+
+		int previous = used;
+		for (int v=1; v<n; v++)
+		{
+			if (v < used) centre[v] = centre[used];	// lower levels only arise from compression errors
+			else if (centre[v] >= 0.0)
+			{
+				for (int k=previous+1; k<v; k++)
+				{	// fill the gap between two levels with depths
+					centre[k] = centre[previous] + (centre[v] - centre[previous]) * (k - previous) / (v - previous);
+				}
+				previous = v;
+			}
+		}
+		for (int k=previous+1; k<n; k++) centre[k] = centre[previous];
+
+		m_decode.resize(n);
+		m_decode_m.resize(n);
+		m_decode[0] = 0;
+		m_decode_m[0] = 0.0f;
+		for (int v=1; v<n; v++)
+		{
+			m_decode[v] = (uint16_t)std::min(centre[v] + 0.5, 65535.0);
+			m_decode_m[v] = (float)(centre[v] * m_depth_scale);
+		}
+	}
+
+	float m_depth_scale = HUE_MM_SCALE;
+	std::vector<uint16_t> m_encode;		// 65536 depth units to levels
+	std::vector<uint16_t> m_decode;		// 1531 levels to depth units
+	std::vector<float> m_decode_m;		// 1531 levels to metres
+};
+
+class HueCurveCodec
+{	// Hue codec with a HueCurve in place of the linear or inverse depth scaling.
+	// Supported depth inputs are CV_16U depth in units of the curve's depth_scale
+	// and CV_32F depth in metres (rounded to depth_scale units).
+
+	public:
+
+	explicit HueCurveCodec(const HueCurve& curve)
+	: m_curve(curve)
+	{
+	}
+
+	const HueCurve& curve() const { return m_curve; }
+	float depth_min_m() const { return m_curve.depth_min_m(); }
+	float depth_max_m() const { return m_curve.depth_max_m(); }
+	float depth_scale() const { return m_curve.depth_scale(); }
+
+	void encode(const cv::Mat& src, cv::Mat& dst) const
+	{	// Convert CV_16U or CV_32F depth to a CV_8UC3 hue-encoded image
+		if (src.empty() || !m_curve.valid() || (src.type() != CV_16U && src.type() != CV_32F)) return;
+
+		cv::Mat tmp;
+		if (dst.data != src.data) tmp = dst;
+		if (tmp.size() != src.size() || tmp.type() != CV_8UC3) tmp.create(src.size(), CV_8UC3);
+
+		const uint16_t* levels = m_curve.encode_table();
+		const float units_per_m = 1.0f / m_curve.depth_scale();
+		for (int i=0; i<src.rows; i++)
+		{
+			cv::Vec3b* out = tmp.ptr<cv::Vec3b>(i);
+			if (src.type() == CV_16U)
+			{
+				const uint16_t* in = src.ptr<uint16_t>(i);
+				for (int j=0; j<src.cols; j++) set(out[j], levels[in[j]]);
+			}
+			else
+			{
+				const float* in = src.ptr<float>(i);
+				for (int j=0; j<src.cols; j++)
+				{
+					float d = clamp(in[j] * units_per_m + 0.5f, 0.0f, 65535.0f);	// also maps NaN to 0
+					set(out[j], levels[d > 0.0f ? (int)d : 0]);
+				}
+			}
+		}
+
+		dst = tmp;
+	}
+
+	cv::Mat encode(const cv::Mat& src) const
+	{	// Overloaded convenience function to return a Mat
+		cv::Mat dst;
+		encode(src, dst);
+		return dst;
+	}
+
+	void decode(const cv::Mat& src, cv::Mat& dst, int ddepth=CV_16U) const
+	{	// Convert a CV_8UC3 hue-encoded image to CV_16U depth (depth_scale units)
+		// or CV_32F depth (metres)
+		if (src.empty() || !m_curve.valid() || src.type() != CV_8UC3) return;
+
+		const int type = ddepth == CV_32F ? CV_32F : CV_16U;
+		cv::Mat tmp;
+		if (dst.data != src.data) tmp = dst;
+		if (tmp.size() != src.size() || tmp.type() != type) tmp.create(src.size(), type);
+
+		for (int i=0; i<src.rows; i++)
+		{
+			const cv::Vec3b* in = src.ptr<cv::Vec3b>(i);
+			if (type == CV_32F) decode_row(in, tmp.ptr<float>(i), src.cols, m_curve.decode_table_m());
+			else                decode_row(in, tmp.ptr<uint16_t>(i), src.cols, m_curve.decode_table());
+		}
+
+		dst = tmp;
+	}
+
+	cv::Mat decode(const cv::Mat& src) const
+	{	// Overloaded convenience function to return a Mat
+		cv::Mat dst;
+		decode(src, dst);
+		return dst;
+	}
+
+	private:
+
+	static void set(cv::Vec3b& pixel, int level)
+	{
+		const uint8_t* bgr = HUE_ENCODE_TABLE.bgr[level];
+		pixel = cv::Vec3b(bgr[0], bgr[1], bgr[2]);
+	}
+
+	template <typename DepthT>
+	static void decode_row(const cv::Vec3b* src, DepthT* dst, int cols, const DepthT* table)
+	{
+		for (int j=0; j<cols; j++)
+		{
+			dst[j] = table[hue_decode_value_branchless(src[j][2], src[j][1], src[j][0])];
+		}
+	}
+
+	HueCurve m_curve;
+};
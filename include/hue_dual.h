@@ -0,0 +1,183 @@
+#pragma once
+#include <opencv2/opencv.hpp>   // Include OpenCV API
+#include <hue_codec.h>          // The header-only hue codec
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <type_traits>
+
+// Dual-layer coarse/fine encoding
+//
+// HueDualCodec splits the depth range into 1530 x fine_steps levels (24480 by
+// default, up to 64260 with fine_steps = 42) and encodes each frame as two
+// 8-bit hue images:
+//
+//   coarse  the hue encoding of the depth over the full range (an ordinary hue
+//           image, which HueCodec with the same settings decodes on its own)
+//   fine    the fine level modulo 1530 around the hue circle, which is
+//           continuous from the last hue back to the first, so the fine layer
+//           has no jumps for codecs to blur
+//
+//     HueDualCodec codec(0.5f, 60.0f, HUE_MM_SCALE, false, 32);
+//     codec.encode(depth, coarse, fine);
+//     codec.decode(coarse, fine, depth);          // or decode(coarse, cv::Mat(), depth)
+//
+// The decoder takes the level with the fine hue that is nearest to the coarse
+// estimate, so compression errors in the fine layer add errors of their own size
+// in fine levels, and the coarse layer may be off by up to MAX_COARSE_ERROR hue
+// levels.
+//
+// Fine pixels that are far from a hue colour, or whose level is further from the
+// coarse estimate than the coarse layer can be off, are treated as corrupted and
+// decoded from the coarse layer alone, as is the whole frame if the fine layer is
+// missing or has the wrong size.
+
+class HueDualCodec
+{
+	public:
+
+	HueDualCodec(float depth_min_m, float depth_max_m, float depth_scale=HUE_MM_SCALE, bool inverse_colorization=true, int fine_steps=16)
+	: m_depth_min_m(depth_min_m)
+	, m_depth_max_m(depth_max_m)
+	, m_depth_scale(depth_scale)
+	, m_inverse_colorization(inverse_colorization)
+	, m_fine_steps(std::max(1, std::min(fine_steps, 42)))
+	{
+	}
+
+	float depth_min_m() const { return m_depth_min_m; }
+	float depth_max_m() const { return m_depth_max_m; }
+	float depth_scale() const { return m_depth_scale; }
+	int fine_steps() const { return m_fine_steps; }
+	int levels() const { return HUE_ENCODER_MAX * m_fine_steps + 1; }	// including 0 (no data)
+
+	HueCodec coarse_codec() const
+	{	// A codec that decodes the coarse layer on its own
+		return HueCodec(m_depth_min_m, m_depth_max_m, m_depth_scale, m_inverse_colorization);
+	}
+
+	void encode(const cv::Mat& src, cv::Mat& coarse, cv::Mat& fine) const
+	{	// Encode CV_16U (depth_scale units) or CV_32F (metres) depth to CV_8UC3
+		// coarse and fine hue images
+		if (src.empty() || (src.type() != CV_16U && src.type() != CV_32F)) return;
+		if (coarse.size() != src.size() || coarse.type() != CV_8UC3) coarse.create(src.size(), CV_8UC3);
+		if (fine.size() != src.size() || fine.type() != CV_8UC3) fine.create(src.size(), CV_8UC3);
+
+		Range r = range(src.type() == CV_32F ? 1.0f : m_depth_scale);
+		for (int i=0; i<src.rows; i++)
+		{
+			if (src.type() == CV_32F) encode_row(src.ptr<float>(i), coarse.ptr<cv::Vec3b>(i), fine.ptr<cv::Vec3b>(i), src.cols, r);
+			else                      encode_row(src.ptr<uint16_t>(i), coarse.ptr<cv::Vec3b>(i), fine.ptr<cv::Vec3b>(i), src.cols, r);
+		}
+	}
+
+	void decode(const cv::Mat& coarse, const cv::Mat& fine, cv::Mat& dst, int ddepth=CV_16U) const
+	{	// Combine the layers into CV_16U depth (depth_scale units) or CV_32F depth
+		// (metres). fine may be empty to decode the coarse layer alone.
+		if (coarse.empty() || coarse.type() != CV_8UC3) return;
+		bool use_fine = fine.size() == coarse.size() && fine.type() == CV_8UC3;
+
+		const int type = ddepth == CV_32F ? CV_32F : CV_16U;
+		cv::Mat tmp;
+		if (dst.data != coarse.data && dst.data != fine.data) tmp = dst;
+		if (tmp.size() != coarse.size() || tmp.type() != type) tmp.create(coarse.size(), type);
+
+		Range r = range(ddepth == CV_32F ? 1.0f : m_depth_scale);
+		for (int i=0; i<coarse.rows; i++)
+		{
+			const cv::Vec3b* f = use_fine ? fine.ptr<cv::Vec3b>(i) : nullptr;
+			if (type == CV_32F) decode_row(coarse.ptr<cv::Vec3b>(i), f, tmp.ptr<float>(i), coarse.cols, r);
+			else                decode_row(coarse.ptr<cv::Vec3b>(i), f, tmp.ptr<uint16_t>(i), coarse.cols, r);
+		}
+
+		dst = tmp;
+	}
+
+	enum { MAX_COARSE_ERROR = 8 };	// hue levels
+
+	private:
+
+	enum { PERIOD = HUE_ENCODER_MAX, MAX_FINE_ERROR = 128 };	// hue_decode_error of a usable fine pixel
+
+	struct Range
+	{	// Depth range in output units, in the domain that is encoded linearly
+		float min_u, range_u;
+	};
+
+	Range range(float scale) const
+	{	// scale is depth_scale for integer depth and 1 for metres
+		float lo = m_depth_min_m / scale, hi = m_depth_max_m / scale;
+		if (m_inverse_colorization)
+		{
+			lo = 1.0f / std::max(lo, 1E-9f);
+			hi = 1.0f / hi;
+		}
+		return Range{ lo, hi - lo };
+	}
+
+	template <typename DepthT>
+	void encode_row(const DepthT* src, cv::Vec3b* coarse, cv::Vec3b* fine, int cols, const Range& r) const
+	{
+		const int n = HUE_ENCODER_MAX * m_fine_steps;
+		for (int j=0; j<cols; j++)
+		{
+			float d = src[j];
+			float u = m_inverse_colorization ? 1.0f / d : d;
+			float scaled = clamp((u - r.min_u) / r.range_u, 0.0f, 1.0f);
+			int level = (int)(n * scaled + 0.5f);
+			int v = std::max(1, (int)(HUE_ENCODER_MAX * scaled + 0.5f));	// as HueCodec, but 1 at the minimum depth
+			if (!(d > 0)) level = v = 0;	// zero, negative, and NaN values are invalid
+
+			const uint8_t* bgr = HUE_ENCODE_TABLE.bgr[v];
+			coarse[j] = cv::Vec3b(bgr[0], bgr[1], bgr[2]);
+			bgr = HUE_ENCODE_TABLE.bgr[v ? level % PERIOD + 1 : 0];
+			fine[j] = cv::Vec3b(bgr[0], bgr[1], bgr[2]);
+		}
+	}
+
+	template <typename DepthT>
+	void decode_row(const cv::Vec3b* coarse, const cv::Vec3b* fine, DepthT* dst, int cols, const Range& r) const
+	{
+		const float n = (float)(HUE_ENCODER_MAX * m_fine_steps);
+		for (int j=0; j<cols; j++)
+		{
+			int v = hue_decode_value_branchless(coarse[j][2], coarse[j][1], coarse[j][0]);
+			if (v == 0)
+			{
+				dst[j] = 0;
+				continue;
+			}
+
+			int level = v * m_fine_steps;
+			if (fine) level = refine(level, fine[j]);
+
+			float u = r.min_u + r.range_u * level / n;
+			dst[j] = to_depth<DepthT>(m_inverse_colorization ? 1.0f / u : u);
+		}
+	}
+
+	int refine(int estimate, const cv::Vec3b& fine) const
+	{	// The level with the fine hue that is nearest to the coarse estimate
+		int p = hue_decode_value_branchless(fine[2], fine[1], fine[0]);
+		if (p == 0 || hue_decode_error(fine[2], fine[1], fine[0]) > MAX_FINE_ERROR) return estimate;
+
+		int diff = ((p - 1 - estimate) % PERIOD + PERIOD + PERIOD / 2) % PERIOD - PERIOD / 2;	// -765 to 764
+		int limit = MAX_COARSE_ERROR * m_fine_steps + m_fine_steps / 2;
+		return std::abs(diff) > limit ? estimate : std::max(estimate + diff, 0);
+	}
+
+	template <typename DepthT>
+	static DepthT to_depth(float d)
+	{	// Round and saturate for integer depth types
+		if (std::is_integral<DepthT>::value)
+		{
+			return (DepthT)std::min(d + 0.5f, (float)std::numeric_limits<DepthT>::max());
+		}
+		return (DepthT)d;
+	}
+
+	float m_depth_min_m, m_depth_max_m, m_depth_scale;
+	bool m_inverse_colorization;
+	int m_fine_steps;
+};
@@ -0,0 +1,237 @@
+#pragma once
+#include <opencv2/opencv.hpp>   // Include OpenCV API
+#include <hue_codec.h>          // The header-only hue codec
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Depth quality metrics
+//
+// Compares a reference depth map against a test depth map (e.g. the output of
+// hue encoding, compression, decompression, and hue decoding) in a single pass.
+//
+// Only pixel pairs where both values are below depth_max are compared.
+// This matches the behaviour of psnr_depth in src/common.h.
+//
+// All error sums are accumulated as 64-bit integers so that the results are
+// exact regardless of frame size or frame count. Rows are split into stripes
+// that are processed in parallel and merged afterwards, so the results are
+// deterministic.
+
+struct DepthErrorStats
+{
+	uint64_t count   = 0;	// number of compared pixels
+	uint64_t sum_abs = 0;	// sum of absolute errors
+	uint64_t sum_sq  = 0;	// sum of squared errors
+	uint32_t max_abs = 0;	// maximum absolute error
+
+	double mae()  const { return count ? (double)sum_abs / count : 0.0; }
+	double mse()  const { return count ? (double)sum_sq  / count : 0.0; }
+	double rmse() const { return std::sqrt(mse()); }
+
+	void merge(const DepthErrorStats& other)
+	{
+		count   += other.count;
+		sum_abs += other.sum_abs;
+		sum_sq  += other.sum_sq;
+		max_abs  = std::max(max_abs, other.max_abs);
+	}
+};
+
+struct DepthBucketStats : DepthErrorStats
+{
+	float lower_m = 0.0f;	// inclusive lower bound of the reference depth in metres
+	float upper_m = 0.0f;	// exclusive upper bound of the reference depth in metres
+};
+
+struct DepthQuality
+{
+	DepthErrorStats error;	// error over all compared pixels
+	double psnr = 0.0;		// peak signal-to-noise ratio (dB)
+
+	uint64_t total         = 0;	// number of pixels in each frame
+	uint64_t holes_ref     = 0;	// zero-valued pixels in the reference
+	uint64_t holes_test    = 0;	// zero-valued pixels in the test frame
+	uint64_t holes_filled  = 0;	// zero in the reference, non-zero in the test frame
+	uint64_t holes_created = 0;	// non-zero in the reference, zero in the test frame
+
+	std::vector<DepthBucketStats> buckets;	// error broken down by reference depth
+
+	double hole_rate_ref()  const { return total ? (double)holes_ref  / total : 0.0; }
+	double hole_rate_test() const { return total ? (double)holes_test / total : 0.0; }
+	double hole_rate_change() const { return hole_rate_test() - hole_rate_ref(); }
+};
+
+class DepthMetrics
+{
+	public:
+
+	DepthMetrics(float depth_max_m, float depth_scale=HUE_MM_SCALE, const std::vector<float>& bucket_edges_m=std::vector<float>())
+	: m_depth_max_m(depth_max_m)
+	, m_depth_scale(depth_scale)
+	, m_max_i(depth_max_m / depth_scale)
+	, m_bucket_edges_m(bucket_edges_m)
+	{	// bucket_edges_m are ascending distances in metres.
+		// N edges define N-1 buckets of the form [edge_i, edge_i+1).
+		// Reference pixels outside of all buckets are not counted in any bucket.
+
+		if (m_bucket_edges_m.size() < 2) m_bucket_edges_m.clear();
+		if (m_bucket_edges_m.size() > NO_BUCKET) m_bucket_edges_m.resize(NO_BUCKET);
+		std::sort(m_bucket_edges_m.begin(), m_bucket_edges_m.end());
+
+		if (!m_bucket_edges_m.empty())
+		{	// Precompute the bucket for every possible reference value.
+			m_bucket_table.assign(65536, NO_BUCKET);
+			for (int v=0; v<65536; v++)
+			{
+				float d = v * depth_scale;
+				auto it = std::upper_bound(m_bucket_edges_m.begin(), m_bucket_edges_m.end(), d);
+				if (it == m_bucket_edges_m.begin() || it == m_bucket_edges_m.end()) continue;
+				m_bucket_table[v] = (uint8_t)(it - m_bucket_edges_m.begin() - 1);
+			}
+		}
+	}
+
+	float depth_max_m() const { return m_depth_max_m; }
+	float depth_scale() const { return m_depth_scale; }
+	int bucket_count() const { return m_bucket_edges_m.empty() ? 0 : m_bucket_edges_m.size() - 1; }
+
+	DepthQuality compare(const cv::Mat& ref, const cv::Mat& test) const
+	{	// Compare two unsigned 16-bit depth maps of the same size.
+		// An empty result (total == 0) is returned if the inputs are invalid.
+
+		DepthQuality result;
+		if (ref.empty() || test.empty() || ref.size() != test.size()) return result;
+		if (ref.type() != CV_16U || test.type() != CV_16U) return result;
+
+		const int nbuckets = bucket_count();
+		const int nstripes = std::max(1, std::min(ref.rows, cv::getNumThreads() * 4));
+		std::vector<Accumulator> acc(nstripes, Accumulator(nbuckets));
+
+		cv::parallel_for_(cv::Range(0, nstripes), [&](const cv::Range& range)
+		{
+			for (int s=range.start; s<range.end; s++)
+			{
+				int row_begin = (int64_t)ref.rows * s / nstripes;
+				int row_end   = (int64_t)ref.rows * (s+1) / nstripes;
+				for (int i=row_begin; i<row_end; i++)
+				{
+					accumulate_row(ref.ptr<uint16_t>(i), test.ptr<uint16_t>(i), ref.cols, acc[s]);
+				}
+			}
+		});
+
+		// Merge the per-stripe accumulators
+		Accumulator total(nbuckets);
+		for (const Accumulator& a : acc) total.merge(a);
+
+		result.error         = total.error;
+		result.total         = (uint64_t)ref.rows * ref.cols;
+		result.holes_ref     = total.holes_ref;
+		result.holes_test    = total.holes_test;
+		result.holes_filled  = total.holes_filled;
+		result.holes_created = total.holes_created;
+		result.psnr = 20.0 * std::log10((double)m_max_i) - 10.0 * std::log10(result.error.mse());
+
+		result.buckets.resize(nbuckets);
+		for (int k=0; k<nbuckets; k++)
+		{
+			static_cast<DepthErrorStats&>(result.buckets[k]) = total.buckets[k];
+			result.buckets[k].lower_m = m_bucket_edges_m[k];
+			result.buckets[k].upper_m = m_bucket_edges_m[k+1];
+		}
+
+		return result;
+	}
+
+	private:
+
+	enum { NO_BUCKET = 255 };
+
+	struct Accumulator
+	{
+		explicit Accumulator(int nbuckets) : buckets(nbuckets) {}
+
+		DepthErrorStats error;
+		uint64_t holes_ref = 0, holes_test = 0, holes_filled = 0, holes_created = 0;
+		std::vector<DepthErrorStats> buckets;
+
+		void merge(const Accumulator& other)
+		{
+			error.merge(other.error);
+			holes_ref     += other.holes_ref;
+			holes_test    += other.holes_test;
+			holes_filled  += other.holes_filled;
+			holes_created += other.holes_created;
+			for (size_t k=0; k<buckets.size(); k++) buckets[k].merge(other.buckets[k]);
+		}
+	};
+
+	void accumulate_row(const uint16_t* a, const uint16_t* b, int cols, Accumulator& acc) const
+	{	// The main loop is branch-free so that it can be auto-vectorized.
+		// Per-row sums fit comfortably in 64 bits and are merged into acc once per row.
+
+		const uint32_t max_i = m_max_i;
+		uint64_t count = 0, sum_abs = 0, sum_sq = 0;
+		uint32_t max_abs = 0;
+		uint32_t holes_ref = 0, holes_test = 0, holes_filled = 0, holes_created = 0;
+
+		for (int j=0; j<cols; j++)
+		{
+			uint32_t va = a[j];
+			uint32_t vb = b[j];
+			uint32_t mask = (va < max_i) & (vb < max_i);
+			uint32_t diff = (va > vb ? va - vb : vb - va) * mask;
+
+			count   += mask;
+			sum_abs += diff;
+			sum_sq  += (uint64_t)diff * diff;
+			max_abs  = std::max(max_abs, diff);
+
+			uint32_t za = (va == 0);
+			uint32_t zb = (vb == 0);
+			holes_ref     += za;
+			holes_test    += zb;
+			holes_filled  += za & (zb ^ 1);
+			holes_created += zb & (za ^ 1);
+		}
+
+		acc.error.count   += count;
+		acc.error.sum_abs += sum_abs;
+		acc.error.sum_sq  += sum_sq;
+		acc.error.max_abs  = std::max(acc.error.max_abs, max_abs);
+		acc.holes_ref     += holes_ref;
+		acc.holes_test    += holes_test;
+		acc.holes_filled  += holes_filled;
+		acc.holes_created += holes_created;
+
+		if (acc.buckets.empty()) return;
+
+		// Error by distance bucket (indexed by the reference value)
+		for (int j=0; j<cols; j++)
+		{
+			uint32_t va = a[j];
+			uint32_t vb = b[j];
+			uint8_t k = m_bucket_table[va];
+			if (k == NO_BUCKET || va >= max_i || vb >= max_i) continue;
+
+			uint32_t diff = va > vb ? va - vb : vb - va;
+			DepthErrorStats& s = acc.buckets[k];
+			s.count++;
+			s.sum_abs += diff;
+			s.sum_sq  += (uint64_t)diff * diff;
+			s.max_abs  = std::max(s.max_abs, diff);
+		}
+	}
+
+	float m_depth_max_m, m_depth_scale;
+	int m_max_i;
+	std::vector<float> m_bucket_edges_m;
+	std::vector<uint8_t> m_bucket_table;
+};
+
+inline DepthQuality depth_quality(const cv::Mat& ref, const cv::Mat& test, float depth_max_m, float depth_scale=HUE_MM_SCALE)
+{	// Convenience function for one-off comparisons without distance buckets.
+	return DepthMetrics(depth_max_m, depth_scale).compare(ref, test);
+}
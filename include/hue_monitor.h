@@ -0,0 +1,386 @@
+#pragma once
+#include <opencv2/opencv.hpp>   // Include OpenCV API
+#include <hue_codec.h>          // The header-only hue codec
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Online quality monitoring
+//
+// HueQualityMonitor estimates the depth quality of live streams without decoding
+// every frame. For each sampled frame it copies a few tiles and, on a background
+// thread, round-trips them through hue encoding, compression, decompression, and
+// hue decoding, then compares them with the original depth. Tiles rotate over
+// the frame so that every part of the image is covered within a few frames.
+//
+//     HueQualityMonitor monitor(0.02);                    // at most 2% of one core
+//     int id = monitor.add_stream(codec, options);        // same format and params as the stream
+//     ...
+//     monitor.sample(id, depth);                          // per frame, returns quickly
+//     HueQualityEstimate q = monitor.estimate(id);        // PSNR and error percentiles
+//
+// Estimates cover the most recent window_tiles tiles, so a collapse in quality
+// (e.g. on a scene change) shows up within a few frames. Confidence bounds treat
+// each tile as one observation, since compression errors are correlated within
+// a tile.
+//
+// The CPU budget is a fraction of one core. Frames are skipped while the worker
+// has used up its budget, so the cost stays fixed regardless of the frame rate.
+//
+// Tiles are aligned to multiples of 16 pixels so that they share the block grid
+// of the full-frame image codecs, but they are compressed on their own. For video
+// codecs or other compressors, set round_trip to compress and decompress a tile.
+//
+// The metrics match DepthMetrics: CV_16U depth, and only pixels where both the
+// original and the decoded depth are below the codec's maximum depth are compared.
+
+struct HueMonitorOptions
+{
+	std::string format = ".webp";	// image format for cv::imencode
+	std::vector<int> params { cv::IMWRITE_WEBP_QUALITY, 90 };	// cv::imencode parameters
+	std::function<cv::Mat(const cv::Mat&)> round_trip;	// compress and decompress a BGR tile (replaces format)
+	int tile_size = 64;				// tile width and height (a multiple of 16)
+	int tiles_per_frame = 4;		// tiles taken from each sampled frame
+	int window_tiles = 256;			// tiles in each estimate
+	std::vector<double> percentiles { 0.5, 0.95, 0.99 };
+	double z = 1.96;				// width of the confidence bounds in standard errors (1.96: 95%)
+};
+
+struct HueErrorPercentile
+{
+	double p = 0.0;			// e.g. 0.99
+	double error = 0.0;		// absolute error in depth units
+	double low = 0.0;		// confidence bounds
+	double high = 0.0;
+};
+
+struct HueQualityEstimate
+{
+	uint64_t frames = 0;			// frames passed to sample()
+	uint64_t frames_sampled = 0;	// frames that tiles were taken from
+	uint64_t tiles = 0;				// tiles in the estimate
+	uint64_t pixels = 0;			// compared pixels in the estimate
+
+	double psnr = 0.0;				// peak signal-to-noise ratio (dB), see DepthMetrics
+	double psnr_low = 0.0;			// confidence bounds
+	double psnr_high = 0.0;
+	double mae = 0.0;				// mean absolute error in depth units
+	std::vector<HueErrorPercentile> percentiles;
+
+	bool valid() const { return tiles >= 2 && pixels > 0; }
+};
+
+namespace hue_monitor_detail
+{
+	// Absolute errors are counted in bins: exact values up to 31, then 8 bins per octave
+	const int EXACT_BINS = 32;
+	const int BINS = EXACT_BINS + 11 * 8;
+
+	inline int error_bin(uint32_t e)
+	{
+		if (e < EXACT_BINS) return e;
+		int octave = 5;
+		while (octave < 15 && (e >> (octave + 1)) != 0) octave++;
+		return EXACT_BINS + (octave - 5) * 8 + ((e >> (octave - 3)) & 7);
+	}
+
+	inline double bin_value(int bin)
+	{	// Representative (middle) error of a bin
+		if (bin < EXACT_BINS) return bin;
+		int octave = (bin - EXACT_BINS) / 8 + 5;
+		int step = 1 << (octave - 3);
+		double lower = (double)(8 + (bin - EXACT_BINS) % 8) * step;
+		return lower + (step - 1) / 2.0;
+	}
+
+	struct TileResult
+	{
+		uint64_t count = 0, sum_abs = 0, sum_sq = 0;
+		std::vector<uint32_t> histogram;
+	};
+
+	struct Stream
+	{
+		HueCodec codec;
+		HueMonitorOptions options;
+		uint64_t frames = 0, frames_sampled = 0;
+		uint64_t next_tile = 0;
+
+		std::deque<TileResult> window;
+		uint64_t count = 0, sum_abs = 0;
+		std::vector<uint64_t> histogram;
+
+		Stream(const HueCodec& c, const HueMonitorOptions& o) : codec(c), options(o), histogram(BINS, 0) {}
+	};
+
+	struct Job
+	{
+		int stream;
+		std::vector<cv::Mat> tiles;
+	};
+}
+
+class HueQualityMonitor
+{
+	public:
+
+	explicit HueQualityMonitor(double cpu_budget=0.02)
+	: m_budget(cpu_budget)
+	, m_start_us(now_us())
+	, m_last_us(m_start_us)
+	, m_credit_us(MAX_CREDIT_US)
+	{
+		m_thread = std::thread(&HueQualityMonitor::run, this);
+	}
+
+	~HueQualityMonitor()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stopping = true;
+		}
+		m_cv.notify_all();
+		m_thread.join();
+	}
+
+	HueQualityMonitor(const HueQualityMonitor&) = delete;
+	HueQualityMonitor& operator=(const HueQualityMonitor&) = delete;
+
+	int add_stream(const HueCodec& codec, const HueMonitorOptions& options=HueMonitorOptions())
+	{	// Returns the id of the new stream
+		std::lock_guard<std::mutex> lock(m_mutex);
+		HueMonitorOptions o = options;
+		o.tile_size = std::max(16, o.tile_size / 16 * 16);
+		o.tiles_per_frame = std::max(1, o.tiles_per_frame);
+		o.window_tiles = std::max(2, o.window_tiles);
+		m_streams.emplace_back(new hue_monitor_detail::Stream(codec, o));
+		return (int)m_streams.size() - 1;
+	}
+
+	bool sample(int stream, const cv::Mat& depth)
+	{	// Offer a CV_16U depth frame. Copies a few tiles for the worker if the
+		// CPU budget allows, and returns whether it did.
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (stream < 0 || stream >= (int)m_streams.size()) return false;
+		hue_monitor_detail::Stream& s = *m_streams[stream];
+		s.frames++;
+		if (depth.empty() || depth.type() != CV_16U) return false;
+
+		int64_t now = now_us();
+		m_credit_us = std::min((double)MAX_CREDIT_US, m_credit_us + (now - m_last_us) * m_budget);
+		m_last_us = now;
+		if (m_credit_us <= 0.0 || m_jobs.size() >= MAX_JOBS) return false;
+
+		// Rotate over the tile grid with a stride that is coprime to the number of
+		// tiles, so consecutive tiles are spread out and every tile is visited.
+		int tile = std::min(s.options.tile_size, std::min(depth.cols, depth.rows));
+		int grid_cols = depth.cols / tile, grid_rows = depth.rows / tile;
+		uint64_t n = (uint64_t)grid_cols * grid_rows;
+		uint64_t stride = std::max<uint64_t>(1, (uint64_t)(n * 0.618));
+		while (gcd(stride, n) != 1) stride++;
+
+		hue_monitor_detail::Job job;
+		job.stream = stream;
+		for (int k=0; k<s.options.tiles_per_frame && k<(int)n; k++)
+		{
+			uint64_t index = (s.next_tile++ * stride) % n;
+			cv::Rect r((int)(index % grid_cols) * tile, (int)(index / grid_cols) * tile, tile, tile);
+			job.tiles.push_back(depth(r).clone());
+		}
+
+		s.frames_sampled++;
+		m_jobs.push_back(std::move(job));
+		m_cv.notify_all();
+		return true;
+	}
+
+	void flush()
+	{	// Wait until all sampled tiles have been evaluated
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_cv.wait(lock, [&] { return m_jobs.empty() && !m_busy; });
+	}
+
+	HueQualityEstimate estimate(int stream) const
+	{
+		using namespace hue_monitor_detail;
+		std::lock_guard<std::mutex> lock(m_mutex);
+		HueQualityEstimate q;
+		if (stream < 0 || stream >= (int)m_streams.size()) return q;
+		const Stream& s = *m_streams[stream];
+
+		q.frames = s.frames;
+		q.frames_sampled = s.frames_sampled;
+		q.tiles = s.window.size();
+		q.pixels = s.count;
+		if (!q.valid()) return q;
+
+		// MSE as a ratio estimate over tiles, with the standard error from the
+		// spread of the per-tile squared errors
+		double sum_sq = 0.0;
+		for (const TileResult& t : s.window) sum_sq += t.sum_sq;
+		double mse = sum_sq / s.count;
+		double var = 0.0;
+		for (const TileResult& t : s.window)
+		{
+			double r = t.sum_sq - mse * t.count;
+			var += r * r;
+		}
+		double k = (double)q.tiles;
+		double se = std::sqrt(var * k / (k - 1.0)) / s.count;
+
+		int max_i = s.codec.depth_max_m() / s.codec.depth_scale();	// as in DepthMetrics
+		auto psnr = [&](double m) { return m > 0.0 ? 20.0 * std::log10((double)max_i) - 10.0 * std::log10(m) : std::numeric_limits<double>::infinity(); };
+		q.psnr = psnr(mse);
+		q.psnr_low = psnr(mse + s.options.z * se);
+		q.psnr_high = psnr(mse - s.options.z * se);
+		q.mae = (double)s.sum_abs / s.count;
+
+		for (double p : s.options.percentiles)
+		{	// Bounds from the binomial spread of the rank with the tiles as the sample size
+			double delta = s.options.z * std::sqrt(p * (1.0 - p) / k);
+			HueErrorPercentile e;
+			e.p = p;
+			e.error = quantile(s, p);
+			e.low = quantile(s, std::max(0.0, p - delta));
+			e.high = quantile(s, std::min(1.0, p + delta));
+			q.percentiles.push_back(e);
+		}
+		return q;
+	}
+
+	double cpu_fraction() const
+	{	// Measured worker load as a fraction of one core
+		std::lock_guard<std::mutex> lock(m_mutex);
+		int64_t elapsed = now_us() - m_start_us;
+		return elapsed > 0 ? (double)m_busy_us / elapsed : 0.0;
+	}
+
+	private:
+
+	static const int64_t MAX_CREDIT_US = 20000;		// largest burst of work
+	static const size_t MAX_JOBS = 2;
+
+	static int64_t now_us()
+	{
+		using namespace std::chrono;
+		return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+	}
+
+	static uint64_t gcd(uint64_t a, uint64_t b)
+	{
+		while (b) { uint64_t t = a % b; a = b; b = t; }
+		return a;
+	}
+
+	static double quantile(const hue_monitor_detail::Stream& s, double p)
+	{	// Error at fraction p of the pooled histogram
+		uint64_t rank = std::min(s.count - 1, (uint64_t)(p * s.count));
+		uint64_t seen = 0;
+		for (int b=0; b<hue_monitor_detail::BINS; b++)
+		{
+			seen += s.histogram[b];
+			if (seen > rank) return hue_monitor_detail::bin_value(b);
+		}
+		return hue_monitor_detail::bin_value(hue_monitor_detail::BINS - 1);
+	}
+
+	static hue_monitor_detail::TileResult evaluate(const hue_monitor_detail::Stream& s, const cv::Mat& depth)
+	{	// Round-trip one tile and accumulate its errors
+		hue_monitor_detail::TileResult result;
+		result.histogram.assign(hue_monitor_detail::BINS, 0);
+
+		cv::Mat encoded, decompressed, decoded;
+		s.codec.encode(depth, encoded);
+		if (s.options.round_trip) decompressed = s.options.round_trip(encoded);
+		else
+		{
+			std::vector<uchar> buffer;
+			if (cv::imencode(s.options.format, encoded, buffer, s.options.params)) decompressed = cv::imdecode(buffer, cv::IMREAD_COLOR);
+		}
+		if (decompressed.size() != depth.size() || decompressed.type() != CV_8UC3) return result;
+		s.codec.decode(decompressed, decoded);
+
+		const int max_i = s.codec.depth_max_m() / s.codec.depth_scale();
+		for (int i=0; i<depth.rows; i++)
+		{
+			const uint16_t* a = depth.ptr<uint16_t>(i);
+			const uint16_t* b = decoded.ptr<uint16_t>(i);
+			for (int j=0; j<depth.cols; j++)
+			{
+				if (a[j] >= max_i || b[j] >= max_i) continue;
+				uint32_t diff = a[j] > b[j] ? a[j] - b[j] : b[j] - a[j];
+				result.count++;
+				result.sum_abs += diff;
+				result.sum_sq += (uint64_t)diff * diff;
+				result.histogram[hue_monitor_detail::error_bin(diff)]++;
+			}
+		}
+		return result;
+	}
+
+	void run()
+	{
+		using namespace hue_monitor_detail;
+		std::unique_lock<std::mutex> lock(m_mutex);
+		for (;;)
+		{
+			m_cv.wait(lock, [&] { return m_stopping || !m_jobs.empty(); });
+			if (m_stopping) return;
+
+			Job job = std::move(m_jobs.front());
+			m_jobs.pop_front();
+			Stream& s = *m_streams[job.stream];	// streams are never removed
+			m_busy = true;
+			lock.unlock();
+
+			int64_t start = now_us();
+			std::vector<TileResult> results;
+			for (const cv::Mat& tile : job.tiles) results.push_back(evaluate(s, tile));
+			int64_t elapsed = now_us() - start;
+
+			lock.lock();
+			for (TileResult& t : results)
+			{	// Slide the estimate window
+				s.count += t.count;
+				s.sum_abs += t.sum_abs;
+				for (int b=0; b<BINS; b++) s.histogram[b] += t.histogram[b];
+				s.window.push_back(std::move(t));
+				if ((int)s.window.size() > s.options.window_tiles)
+				{
+					const TileResult& old = s.window.front();
+					s.count -= old.count;
+					s.sum_abs -= old.sum_abs;
+					for (int b=0; b<BINS; b++) s.histogram[b] -= old.histogram[b];
+					s.window.pop_front();
+				}
+			}
+			m_credit_us -= elapsed;
+			m_busy_us += elapsed;
+			m_busy = false;
+			m_cv.notify_all();
+		}
+	}
+
+	double m_budget;
+	int64_t m_start_us, m_last_us;
+	double m_credit_us;
+	int64_t m_busy_us = 0;
+
+	mutable std::mutex m_mutex;
+	std::condition_variable m_cv;
+	std::deque<hue_monitor_detail::Job> m_jobs;
+	std::vector<std::unique_ptr<hue_monitor_detail::Stream>> m_streams;
+	bool m_busy = false;
+	bool m_stopping = false;
+	std::thread m_thread;
+};
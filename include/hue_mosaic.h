@@ -0,0 +1,227 @@
+#pragma once
+#include <opencv2/opencv.hpp>   // Include OpenCV API
+#include <hue_codec.h>          // The header-only hue codec
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Multi-stream mosaic packing
+//
+// Hue-encodes several depth streams (and optionally 8-bit infrared streams as
+// grayscale) into the tiles of a single BGR mosaic frame, so that a multi-camera
+// rig needs only one video encoder session, one file, and one decoder session.
+//
+// Tiles are aligned to HUE_MOSAIC_ALIGN pixels so that tile borders fall on
+// codec block boundaries, which limits bleeding of compression artefacts between
+// neighbouring tiles. Unused mosaic pixels are black (no data).
+//
+// The layout descriptor can be serialized to a short text string and stored
+// alongside the video (e.g. as a sidecar file or container metadata), so that
+// the receiver can unpack the mosaic without knowing the rig configuration.
+
+const int HUE_MOSAIC_ALIGN = 16;
+
+struct MosaicTile
+{
+	enum Kind { DEPTH = 0, INFRARED = 1 };
+
+	Kind kind;
+	cv::Rect rect;	// position and size of the tile within the mosaic
+};
+
+struct MosaicLayout
+{
+	cv::Size size;
+	std::vector<MosaicTile> tiles;
+
+	int count(MosaicTile::Kind kind) const
+	{
+		return std::count_if(tiles.begin(), tiles.end(), [kind](const MosaicTile& t) { return t.kind == kind; });
+	}
+
+	static MosaicLayout grid(const std::vector<cv::Size>& depth_sizes, const std::vector<cv::Size>& ir_sizes=std::vector<cv::Size>(), int columns=0)
+	{	// Lay out depth tiles followed by infrared tiles on a regular grid.
+		// Every cell has the size of the largest tile rounded up to HUE_MOSAIC_ALIGN.
+		// If columns is 0, the grid is made as square as possible.
+
+		MosaicLayout layout;
+		std::vector<std::pair<MosaicTile::Kind, cv::Size>> entries;
+		for (const cv::Size& s : depth_sizes) entries.emplace_back(MosaicTile::DEPTH, s);
+		for (const cv::Size& s : ir_sizes)    entries.emplace_back(MosaicTile::INFRARED, s);
+		if (entries.empty()) return layout;
+
+		int cell_w = 0, cell_h = 0;
+		for (const auto& e : entries)
+		{
+			cell_w = std::max(cell_w, align(e.second.width));
+			cell_h = std::max(cell_h, align(e.second.height));
+		}
+
+		const int n = entries.size();
+		if (columns <= 0) columns = (int)std::ceil(std::sqrt((double)n));
+		columns = std::min(columns, n);
+		const int rows = (n + columns - 1) / columns;
+
+		layout.size = cv::Size(columns * cell_w, rows * cell_h);
+		for (int k=0; k<n; k++)
+		{
+			cv::Rect rect((k % columns) * cell_w, (k / columns) * cell_h, entries[k].second.width, entries[k].second.height);
+			layout.tiles.push_back(MosaicTile{ entries[k].first, rect });
+		}
+		return layout;
+	}
+
+	std::string to_string() const
+	{	// Serialize as "hue-mosaic 1 <width> <height> <count>" followed by
+		// "<kind> <x> <y> <width> <height>" for each tile.
+		std::ostringstream ss;
+		ss << "hue-mosaic 1 " << size.width << " " << size.height << " " << tiles.size();
+		for (const MosaicTile& t : tiles)
+		{
+			ss << "\n" << (t.kind == MosaicTile::DEPTH ? "depth" : "ir") << " "
+			   << t.rect.x << " " << t.rect.y << " " << t.rect.width << " " << t.rect.height;
+		}
+		return ss.str();
+	}
+
+	static bool from_string(const std::string& str, MosaicLayout& layout)
+	{	// Parse a layout serialized with to_string. Returns false if it is invalid.
+		std::istringstream ss(str);
+		std::string magic, kind;
+		int version = 0;
+		size_t count = 0;
+		MosaicLayout result;
+
+		ss >> magic >> version >> result.size.width >> result.size.height >> count;
+		if (!ss || magic != "hue-mosaic" || version != 1) return false;
+
+		cv::Rect bounds(0, 0, result.size.width, result.size.height);
+		for (size_t k=0; k<count; k++)
+		{
+			MosaicTile t;
+			ss >> kind >> t.rect.x >> t.rect.y >> t.rect.width >> t.rect.height;
+			if (!ss || (kind != "depth" && kind != "ir")) return false;
+			if (t.rect.x < 0 || t.rect.y < 0 || t.rect.width <= 0 || t.rect.height <= 0 ||
+				t.rect.x + t.rect.width > bounds.width || t.rect.y + t.rect.height > bounds.height) return false;
+			t.kind = (kind == "depth") ? MosaicTile::DEPTH : MosaicTile::INFRARED;
+			result.tiles.push_back(t);
+		}
+
+		layout = result;
+		return true;
+	}
+
+	private:
+
+	static int align(int v) { return (v + HUE_MOSAIC_ALIGN - 1) / HUE_MOSAIC_ALIGN * HUE_MOSAIC_ALIGN; }
+};
+
+class HueMosaic
+{	// Packs and unpacks a mosaic of hue-encoded depth tiles and grayscale infrared tiles.
+	// Each depth stream has its own HueCodec so that depth ranges can differ per camera.
+	// Tiles are encoded and decoded in parallel, directly into and out of the mosaic.
+
+	public:
+
+	HueMosaic(const MosaicLayout& layout, const std::vector<HueCodec>& codecs)
+	: m_layout(layout)
+	, m_codecs(codecs)
+	{
+		for (size_t k=0; k<m_layout.tiles.size(); k++)
+		{
+			if (m_layout.tiles[k].kind == MosaicTile::DEPTH) m_depth_tiles.push_back(k);
+			else                                             m_ir_tiles.push_back(k);
+		}
+	}
+
+	const MosaicLayout& layout() const { return m_layout; }
+
+	void pack(const std::vector<cv::Mat>& depth, const std::vector<cv::Mat>& ir, cv::Mat& mosaic) const
+	{	// Hue-encode the depth frames and copy the infrared frames (as grayscale)
+		// straight into their tiles. depth[k] uses codecs[k]. Missing or mismatched
+		// frames leave their tile unchanged.
+
+		if (mosaic.size() != m_layout.size || mosaic.type() != CV_8UC3)
+		{	// Unused areas stay black between frames, so they cost nothing to compress
+			mosaic = cv::Mat(m_layout.size, CV_8UC3, cv::Scalar(0, 0, 0));
+		}
+
+		const int ndepth = m_depth_tiles.size();
+		cv::parallel_for_(cv::Range(0, m_layout.tiles.size()), [&](const cv::Range& range)
+		{
+			for (int k=range.start; k<range.end; k++)
+			{
+				bool is_depth = k < ndepth;
+				const MosaicTile& tile = m_layout.tiles[is_depth ? m_depth_tiles[k] : m_ir_tiles[k - ndepth]];
+				cv::Mat roi = mosaic(tile.rect);
+
+				if (is_depth)
+				{
+					if (k >= (int)depth.size() || k >= (int)m_codecs.size() || depth[k].size() != tile.rect.size()) continue;
+					m_codecs[k].encode(depth[k], roi);	// writes into the mosaic as roi has the right size and type
+				}
+				else
+				{
+					int m = k - ndepth;
+					if (m >= (int)ir.size() || ir[m].type() != CV_8U || ir[m].size() != tile.rect.size()) continue;
+					pack_ir(ir[m], roi);
+				}
+			}
+		});
+	}
+
+	void unpack(const cv::Mat& mosaic, std::vector<cv::Mat>& depth, std::vector<cv::Mat>& ir) const
+	{	// Decode each depth tile directly into its own depth buffer and extract each
+		// infrared tile. Existing buffers of the right size and type are reused.
+
+		if (mosaic.size() != m_layout.size || mosaic.type() != CV_8UC3) return;
+
+		const int ndepth = m_depth_tiles.size();
+		depth.resize(ndepth);
+		ir.resize(m_ir_tiles.size());
+
+		cv::parallel_for_(cv::Range(0, m_layout.tiles.size()), [&](const cv::Range& range)
+		{
+			for (int k=range.start; k<range.end; k++)
+			{
+				bool is_depth = k < ndepth;
+				const MosaicTile& tile = m_layout.tiles[is_depth ? m_depth_tiles[k] : m_ir_tiles[k - ndepth]];
+				const cv::Mat roi = mosaic(tile.rect);
+
+				if (is_depth)
+				{
+					if (k < (int)m_codecs.size()) m_codecs[k].decode(roi, depth[k]);
+				}
+				else unpack_ir(roi, ir[k - ndepth]);
+			}
+		});
+	}
+
+	private:
+
+	static void pack_ir(const cv::Mat& src, cv::Mat& roi)
+	{	// Equal B, G, and R values give full-resolution luma and neutral chroma
+		for (int i=0; i<src.rows; i++)
+		{
+			const uint8_t* in = src.ptr<uint8_t>(i);
+			cv::Vec3b* out = roi.ptr<cv::Vec3b>(i);
+			for (int j=0; j<src.cols; j++) out[j] = cv::Vec3b(in[j], in[j], in[j]);
+		}
+	}
+
+	static void unpack_ir(const cv::Mat& roi, cv::Mat& dst)
+	{	// Average the channels to reduce chroma compression noise
+		if (dst.size() != roi.size() || dst.type() != CV_8U) dst.create(roi.size(), CV_8U);
+		for (int i=0; i<roi.rows; i++)
+		{
+			const cv::Vec3b* in = roi.ptr<cv::Vec3b>(i);
+			uint8_t* out = dst.ptr<uint8_t>(i);
+			for (int j=0; j<roi.cols; j++) out[j] = (in[j][0] + in[j][1] + in[j][2] + 1) / 3;
+		}
+	}
+
+	MosaicLayout m_layout;
+	std::vector<HueCodec> m_codecs;
+	std::vector<int> m_depth_tiles, m_ir_tiles;	// indices into m_layout.tiles
+};
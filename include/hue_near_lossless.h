@@ -0,0 +1,195 @@
+#pragma once
+#include <opencv2/opencv.hpp>   // Include OpenCV API
+#include <hue_codec.h>          // The header-only hue codec
+#include <hue_rvl.h>            // RVL coding of the residual
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Near-lossless encoding with a bounded error
+//
+// HueNearLosslessCodec stores a depth frame as an ordinary compressed hue image
+// plus a residual that corrects every pixel to within max_error depth units of
+// the original (e.g. +/-2 mm), for recordings that need a guaranteed accuracy
+// in much less space than lossless storage:
+//
+//     HueNearLosslessOptions options;
+//     options.max_error = 2;                      // depth units (mm with HUE_MM_SCALE)
+//     HueNearLosslessCodec near_lossless(codec, options);
+//     near_lossless.encode(depth, hue, residual);
+//     near_lossless.decode(hue, residual, depth); // decode(hue, {}, depth) for the hue layer only
+//
+// The encoder compresses the hue image, decodes it again as the decoder will,
+// and quantises the difference from the original with a step of
+// 2 * max_error + 1, so each corrected pixel is within max_error of the original.
+// The quantised residual is mostly zeros and is stored as a PNG (or with RVL,
+// which is faster and larger). max_error = 0 is lossless.
+//
+// No-data pixels (0) decode as 0. With max_error > 0, depths of at most max_error
+// units may also decode as 0.
+//
+// The bound assumes the decoder decompresses the hue image exactly as the
+// encoder did. Lossy image decoders are deterministic for a given build, but
+// builds with different IDCT implementations can differ slightly, so decode
+// with the same OpenCV build (or a lossless hue format such as PNG) when the
+// bound must hold.
+//
+// Residual layout: magic "HNL1", max_error (2 bytes, little-endian), coding
+// (0: PNG, 1: RVL), a reserved byte, then the zig-zag quantised residual as a
+// CV_8U or CV_16U image (PNG) or an RVL stream.
+
+struct HueNearLosslessOptions
+{
+	std::string format = ".webp";	// hue image format for cv::imencode
+	std::vector<int> params { cv::IMWRITE_WEBP_QUALITY, 90 };	// cv::imencode parameters
+	int max_error = 2;				// in depth units, 0 for lossless
+	bool rvl_residual = false;		// code the residual with RVL instead of PNG
+	int png_compression = 3;		// PNG level of the residual
+};
+
+class HueNearLosslessCodec
+{
+	public:
+
+	explicit HueNearLosslessCodec(const HueCodec& codec, const HueNearLosslessOptions& options=HueNearLosslessOptions())
+	: m_codec(codec)
+	, m_options(options)
+	{
+		m_options.max_error = std::max(0, std::min(m_options.max_error, 65535));
+	}
+
+	const HueCodec& codec() const { return m_codec; }
+	int max_error() const { return m_options.max_error; }
+
+	bool encode(const cv::Mat& depth, std::vector<uchar>& hue, std::vector<uchar>& residual) const
+	{	// Compress CV_16U depth to a hue image and a residual
+		if (depth.empty() || depth.type() != CV_16U) return false;
+
+		cv::Mat encoded, decoded;
+		m_codec.encode(depth, encoded);
+		if (!cv::imencode(m_options.format, encoded, hue, m_options.params)) return false;
+		m_codec.decode(cv::imdecode(hue, cv::IMREAD_COLOR), decoded);
+		if (decoded.size() != depth.size()) return false;
+
+		// Zig-zag quantised residual, 8-bit if it fits
+		const int e = m_options.max_error, step = 2*e + 1;
+		cv::Mat q(depth.size(), CV_16U);
+		uint16_t largest = 0;
+		for (int i=0; i<depth.rows; i++)
+		{
+			const uint16_t* v = depth.ptr<uint16_t>(i);
+			const uint16_t* d = decoded.ptr<uint16_t>(i);
+			uint16_t* out = q.ptr<uint16_t>(i);
+			for (int j=0; j<depth.cols; j++)
+			{
+				out[j] = zigzag(quantise(v[j], d[j], e, step));
+				largest = std::max(largest, out[j]);
+			}
+		}
+
+		residual.assign(HEADER_SIZE, 0);
+		std::memcpy(residual.data(), "HNL1", 4);
+		residual[4] = (uchar)(e & 0xFF);
+		residual[5] = (uchar)(e >> 8);
+		residual[6] = m_options.rvl_residual ? RVL : PNG;
+
+		std::vector<uchar> coded;
+		if (m_options.rvl_residual) HueRVLCodec().encode(q, coded);
+		else
+		{
+			if (largest < 256) q = narrow(q);
+			if (!cv::imencode(".png", q, coded, { cv::IMWRITE_PNG_COMPRESSION, m_options.png_compression })) return false;
+		}
+		residual.insert(residual.end(), coded.begin(), coded.end());
+		return true;
+	}
+
+	bool decode(const std::vector<uchar>& hue, const std::vector<uchar>& residual, cv::Mat& dst, int ddepth=CV_16U) const
+	{	// Decode to CV_16U depth or CV_32F depth in metres. An empty residual gives
+		// the hue layer alone. Returns false if either part cannot be decoded.
+		cv::Mat decoded;
+		m_codec.decode(cv::imdecode(hue, cv::IMREAD_COLOR), decoded);
+		if (decoded.empty()) return false;
+
+		if (!residual.empty())
+		{
+			if (residual.size() < HEADER_SIZE || std::memcmp(residual.data(), "HNL1", 4) != 0) return false;
+			const int e = residual[4] | (residual[5] << 8), step = 2*e + 1;
+
+			cv::Mat q;
+			const uchar* coded = residual.data() + HEADER_SIZE;
+			const size_t coded_size = residual.size() - HEADER_SIZE;
+			if (residual[6] == RVL)
+			{
+				if (!HueRVLCodec().decode(coded, coded_size, q)) return false;
+			}
+			else q = cv::imdecode(cv::Mat(1, (int)coded_size, CV_8U, (void*)coded), cv::IMREAD_UNCHANGED);
+			if (q.size() != decoded.size() || (q.type() != CV_8U && q.type() != CV_16U)) return false;
+
+			for (int i=0; i<decoded.rows; i++)
+			{
+				uint16_t* d = decoded.ptr<uint16_t>(i);
+				if (q.type() == CV_8U) correct_row(d, q.ptr<uint8_t>(i), decoded.cols, e, step);
+				else                   correct_row(d, q.ptr<uint16_t>(i), decoded.cols, e, step);
+			}
+		}
+
+		if (ddepth == CV_32F)
+		{
+			dst.create(decoded.size(), CV_32F);
+			for (int i=0; i<decoded.rows; i++)
+			{
+				const uint16_t* d = decoded.ptr<uint16_t>(i);
+				float* out = dst.ptr<float>(i);
+				for (int j=0; j<decoded.cols; j++) out[j] = d[j] * m_codec.depth_scale();
+			}
+		}
+		else dst = decoded;
+		return true;
+	}
+
+	private:
+
+	enum { HEADER_SIZE = 8, PNG = 0, RVL = 1 };
+
+	static int quantise(int v, int d, int e, int step)
+	{	// The residual step count that brings d to within e of v
+		if (e == 0) return (int16_t)(uint16_t)(v - d);	// exact modulo 2^16
+		if (v == 0) return -((d + step - 1) / step);	// at or below 0, which clamps to 0
+		int r = v - d;
+		return r >= 0 ? (r + e) / step : -((e - r) / step);
+	}
+
+	static uint16_t zigzag(int q)
+	{	// Small magnitudes to small codes (steps fit 16 bits for e > 0, and e = 0 wraps)
+		return (uint16_t)(((uint32_t)q << 1) ^ (uint32_t)(q >> 31));
+	}
+
+	static cv::Mat narrow(const cv::Mat& q)
+	{	// CV_16U to CV_8U for values below 256
+		cv::Mat q8(q.size(), CV_8U);
+		for (int i=0; i<q.rows; i++)
+		{
+			const uint16_t* in = q.ptr<uint16_t>(i);
+			uint8_t* out = q8.ptr<uint8_t>(i);
+			for (int j=0; j<q.cols; j++) out[j] = (uint8_t)in[j];
+		}
+		return q8;
+	}
+
+	template <typename T>
+	static void correct_row(uint16_t* d, const T* z, int cols, int e, int step)
+	{
+		for (int j=0; j<cols; j++)
+		{
+			int q = (int)(z[j] >> 1) ^ -(int)(z[j] & 1);
+			if (e == 0) d[j] = (uint16_t)(d[j] + q);
+			else d[j] = (uint16_t)std::max(0, std::min(d[j] + q * step, 65535));
+		}
+	}
+
+	HueCodec m_codec;
+	HueNearLosslessOptions m_options;
+};
@@ -0,0 +1,152 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Hardware performance counters
+//
+// HuePerfCounters counts CPU events in the calling thread with Linux
+// perf_event_open, to tell whether a stage (e.g. HueCodec::encode, decode, or
+// median_filter) is limited by computation, branch mispredictions, or memory:
+//
+//     HuePerfCounters counters;
+//     counters.start();
+//     codec.encode(depth, encoded);
+//     HuePerfSample sample = counters.stop();
+//     double cycles_per_pixel = sample.per_pixel(HuePerfSample::CYCLES, depth.total());
+//
+// Events the CPU, hypervisor, or kernel settings do not provide (see
+// /proc/sys/kernel/perf_event_paranoid) read as -1, as do all events on other
+// operating systems. Counts are scaled up if the kernel had to multiplex the
+// counters. Work done on other threads (e.g. cv::parallel_for_) is not counted.
+//
+// There is no portable counter for DRAM traffic, so bandwidth_gbs() estimates
+// it from last-level cache read misses of 64-byte lines. It leaves out
+// writebacks and hardware prefetches.
+
+struct HuePerfSample
+{
+	enum Counter { CYCLES, INSTRUCTIONS, BRANCH_MISSES, L1D_MISSES, LLC_MISSES, COUNT };
+
+	double value[COUNT];	// event counts, or -1 if not counted
+	double seconds;			// wall time
+
+	HuePerfSample() : seconds(0.0) { std::fill(value, value + COUNT, -1.0); }
+
+	bool has(Counter c) const { return value[c] >= 0.0; }
+
+	double per_pixel(Counter c, double pixels) const { return has(c) && pixels > 0 ? value[c] / pixels : -1.0; }
+
+	double ipc() const
+	{	// Instructions per cycle
+		return has(CYCLES) && has(INSTRUCTIONS) && value[CYCLES] > 0 ? value[INSTRUCTIONS] / value[CYCLES] : -1.0;
+	}
+
+	double bandwidth_gbs() const
+	{	// Estimated memory read bandwidth in GB/s
+		return has(LLC_MISSES) && seconds > 0 ? value[LLC_MISSES] * 64.0 / seconds / 1E9 : -1.0;
+	}
+
+	HuePerfSample& operator+=(const HuePerfSample& other)
+	{	// Combine consecutive samples (a counter missing from either is missing)
+		for (int c=0; c<COUNT; c++) value[c] = has((Counter)c) && other.has((Counter)c) ? value[c] + other.value[c] : -1.0;
+		seconds += other.seconds;
+		return *this;
+	}
+};
+
+class HuePerfCounters
+{
+	public:
+
+	explicit HuePerfCounters(bool enable=true)
+	{	// enable=false gives counters that read as -1 without any system calls
+		std::fill(m_fd, m_fd + HuePerfSample::COUNT, -1);
+#ifdef __linux__
+		if (!enable) return;
+		const uint64_t cache_read_miss = (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+		m_fd[HuePerfSample::CYCLES]        = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+		m_fd[HuePerfSample::INSTRUCTIONS]  = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+		m_fd[HuePerfSample::BRANCH_MISSES] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+		m_fd[HuePerfSample::L1D_MISSES]    = open_counter(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | cache_read_miss);
+		m_fd[HuePerfSample::LLC_MISSES]    = open_counter(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | cache_read_miss);
+#else
+		(void)enable;
+#endif
+	}
+
+	~HuePerfCounters()
+	{
+#ifdef __linux__
+		for (int fd : m_fd) if (fd >= 0) ::close(fd);
+#endif
+	}
+
+	HuePerfCounters(const HuePerfCounters&) = delete;
+	HuePerfCounters& operator=(const HuePerfCounters&) = delete;
+
+	bool available() const
+	{	// Whether any event is counted
+		return std::any_of(m_fd, m_fd + HuePerfSample::COUNT, [](int fd) { return fd >= 0; });
+	}
+
+	void start()
+	{
+#ifdef __linux__
+		for (int fd : m_fd)
+		{
+			if (fd < 0) continue;
+			ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+			ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+		}
+#endif
+		m_start = std::chrono::steady_clock::now();
+	}
+
+	HuePerfSample stop()
+	{	// The events since start()
+		HuePerfSample sample;
+		sample.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+#ifdef __linux__
+		for (int c=0; c<HuePerfSample::COUNT; c++)
+		{
+			if (m_fd[c] < 0) continue;
+			ioctl(m_fd[c], PERF_EVENT_IOC_DISABLE, 0);
+
+			uint64_t data[3];	// value, time enabled, time running
+			if (::read(m_fd[c], data, sizeof(data)) != (ssize_t)sizeof(data) || data[2] == 0) continue;
+			sample.value[c] = (double)data[0] * ((double)data[1] / data[2]);
+		}
+#endif
+		return sample;
+	}
+
+	private:
+
+#ifdef __linux__
+	static int open_counter(uint32_t type, uint64_t config)
+	{	// A disabled counter of user-space events in the calling thread on any CPU
+		perf_event_attr attr;
+		std::memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = type;
+		attr.config = config;
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+	}
+#endif
+
+	int m_fd[HuePerfSample::COUNT];
+	std::chrono::steady_clock::time_point m_start;
+};
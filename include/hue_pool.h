@@ -0,0 +1,186 @@
+#pragma once
+#include <opencv2/opencv.hpp>   // Include OpenCV API
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+// Frame buffer pool
+//
+// A cv::MatAllocator that recycles frame buffers instead of returning them to
+// the heap. Once a pipeline has warmed up (i.e. every buffer size it needs has
+// been allocated once), creating and releasing cv::Mat buffers of those sizes
+// does not touch the heap at all, which removes allocation churn from
+// fixed-rate capture, encode, and decode loops.
+//
+// Use it for individual buffers by setting the allocator before the first
+// create (HueCodec and median_filter create their outputs with the allocator
+// of dst):
+//
+//     HueFramePool pool;
+//     cv::Mat encoded;
+//     encoded.allocator = &pool;
+//     codec.encode(depth, encoded);
+//
+// or for every cv::Mat in the process with cv::Mat::setDefaultAllocator(&pool).
+//
+// Buffers are 64-byte aligned (the OpenCV default). With huge_pages enabled,
+// buffers of at least 2 MB are backed by huge pages on Linux: explicit huge
+// pages (MAP_HUGETLB) if the system has any reserved, and transparent huge
+// pages otherwise. Other platforms ignore the flag.
+//
+// The pool must outlive every cv::Mat that was allocated from it.
+
+class HueFramePool : public cv::MatAllocator
+{
+	public:
+
+	explicit HueFramePool(bool huge_pages=false, size_t max_free_buffers=64)
+	: m_huge_pages(huge_pages)
+	, m_max_free(max_free_buffers)
+	{	// Reserve the free list up front so that returning a buffer never allocates
+		m_free.reserve(m_max_free);
+	}
+
+	~HueFramePool()
+	{
+		trim();
+	}
+
+	HueFramePool(const HueFramePool&) = delete;
+	HueFramePool& operator=(const HueFramePool&) = delete;
+
+	cv::UMatData* allocate(int dims, const int* sizes, int type, void* data0, size_t* step,
+	                       cv::AccessFlag flags, cv::UMatUsageFlags usage) const CV_OVERRIDE
+	{	// Same layout as the standard OpenCV allocator (continuous, no row padding)
+		if (data0) return cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data0, step, flags, usage);
+
+		size_t total = CV_ELEM_SIZE(type);
+		for (int i=dims-1; i>=0; i--)
+		{
+			if (step) step[i] = total;
+			total *= sizes[i];
+		}
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (size_t k=0; k<m_free.size(); k++)
+		{	// Reuse a free buffer of exactly the same size
+			cv::UMatData* u = m_free[k];
+			if (u->size != total) continue;
+			m_free[k] = m_free.back();
+			m_free.pop_back();
+
+			int huge = u->allocatorFlags_;
+			uchar* buffer = u->origdata;
+			u->~UMatData();
+			new (u) cv::UMatData(this);
+			u->data = u->origdata = buffer;
+			u->size = total;
+			u->allocatorFlags_ = huge;
+			m_reused++;
+			return u;
+		}
+
+		bool huge = false;
+		uchar* buffer = allocate_buffer(total, huge);
+		cv::UMatData* u = new cv::UMatData(this);
+		u->data = u->origdata = buffer;
+		u->size = total;
+		u->allocatorFlags_ = huge;
+		m_allocations++;
+		m_bytes += total;
+		return u;
+	}
+
+	bool allocate(cv::UMatData* u, cv::AccessFlag, cv::UMatUsageFlags) const CV_OVERRIDE
+	{
+		return u != nullptr;
+	}
+
+	void deallocate(cv::UMatData* u) const CV_OVERRIDE
+	{	// Keep the buffer for reuse unless the free list is full
+		if (!u) return;
+		if (u->flags & cv::UMatData::USER_ALLOCATED)
+		{
+			delete u;
+			return;
+		}
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_free.size() < m_max_free)
+		{
+			m_free.push_back(u);
+			return;
+		}
+		release(u);
+	}
+
+	void trim()
+	{	// Free all buffers that are not currently in use
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (cv::UMatData* u : m_free) release(u);
+		m_free.clear();
+	}
+
+	size_t allocations() const { std::lock_guard<std::mutex> lock(m_mutex); return m_allocations; }	// buffers taken from the system
+	size_t reused() const      { std::lock_guard<std::mutex> lock(m_mutex); return m_reused; }		// buffers served from the free list
+	size_t bytes() const       { std::lock_guard<std::mutex> lock(m_mutex); return m_bytes; }		// bytes currently owned by the pool
+	size_t free_buffers() const { std::lock_guard<std::mutex> lock(m_mutex); return m_free.size(); }
+
+	private:
+
+	static const size_t HUGE_PAGE_SIZE = 2 << 20;
+
+	uchar* allocate_buffer(size_t size, bool& huge) const
+	{
+		huge = false;
+#if defined(__linux__)
+		if (m_huge_pages && size >= HUGE_PAGE_SIZE)
+		{
+			size_t length = huge_length(size);
+			void* p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+			if (p == MAP_FAILED)
+			{	// No reserved huge pages, so ask for transparent huge pages instead
+				p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#ifdef MADV_HUGEPAGE
+				if (p != MAP_FAILED) madvise(p, length, MADV_HUGEPAGE);
+#endif
+			}
+			if (p != MAP_FAILED)
+			{
+				huge = true;
+				return (uchar*)p;
+			}
+		}
+#endif
+		return (uchar*)cv::fastMalloc(size);
+	}
+
+	void release(cv::UMatData* u) const
+	{
+		m_bytes -= u->size;
+#if defined(__linux__)
+		if (u->allocatorFlags_) munmap(u->origdata, huge_length(u->size));
+		else
+#endif
+		cv::fastFree(u->origdata);
+		u->origdata = u->data = nullptr;
+		delete u;
+	}
+
+	static size_t huge_length(size_t size)
+	{
+		return (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+	}
+
+	bool m_huge_pages;
+	size_t m_max_free;
+
+	mutable std::mutex m_mutex;
+	mutable std::vector<cv::UMatData*> m_free;
+	mutable size_t m_allocations = 0, m_reused = 0, m_bytes = 0;
+};
@@ -0,0 +1,173 @@
+#pragma once
+#include <opencv2/opencv.hpp>   // Include OpenCV API
+#include <hue_codec.h>          // The header-only hue codec
+#include <algorithm>
+#include <vector>
+
+// Multi-resolution pyramid encoding with progressive decoding
+//
+// HuePyramid splits a depth frame into a low-resolution base layer and one or
+// more enhancement layers, each hue-encoded as a separate image:
+//
+//     HuePyramid pyramid(codec, 3);               // base layer at 1/4 width and height
+//     std::vector<cv::Mat> layers;
+//     pyramid.encode(depth, layers);              // layers[0] is the base, then 1/2, then full
+//
+//     pyramid.decode(layers, preview, 1);         // decode only the base layer
+//     pyramid.decode(layers, depth, 2);           // base + first enhancement: 1/2 resolution
+//     pyramid.refine(depth, layers[2], depth);    // refine to full resolution
+//
+// Each level is a 2:1 polyphase split of the next: the base layer holds the
+// pixels at even rows and columns, and an enhancement layer holds the other
+// three phases in the quadrants of an image the size of its level (the top-left
+// quadrant is black, i.e. no data, and costs almost nothing to compress):
+//
+//     +---------+---------+
+//     |  (empty)| odd col |
+//     +---------+---------+
+//     | odd row | odd row |
+//     |         | odd col |
+//     +---------+---------+
+//
+// No pixel is encoded twice and no values are averaged, so every layer holds
+// real depth samples without flying pixels at edges, compression errors in one
+// layer do not propagate to the others, and the full-resolution decode is
+// identical to decoding the whole frame with HueCodec. A preview-only client
+// receives and decodes 1/4^(levels-1) of the pixels.
+
+class HuePyramid
+{
+	public:
+
+	HuePyramid(const HueCodec& codec, int levels=3)
+	: m_codec(codec)
+	, m_levels(std::max(1, levels))
+	{
+	}
+
+	int levels() const { return m_levels; }	// number of layers, including the base layer
+	const HueCodec& codec() const { return m_codec; }
+
+	static cv::Size level_size(cv::Size size, int level, int levels)
+	{	// Size of a level (0 is the base layer, levels-1 is the full size)
+		for (int l=levels-1; l>level; l--) size = half(size);
+		return size;
+	}
+
+	void encode(const cv::Mat& depth, std::vector<cv::Mat>& layers) const
+	{	// Split CV_16U (depth_scale units) or CV_32F (metres) depth into hue-encoded
+		// layers. Existing layer buffers of the right size are reused.
+		layers.resize(m_levels);
+		cv::Mat level = depth;
+		for (int l=m_levels-1; l>0; l--)
+		{
+			encode_enhancement(level, layers[l]);
+			level = even(level);
+		}
+		m_codec.encode(level, layers[0]);
+	}
+
+	void decode(const std::vector<cv::Mat>& layers, cv::Mat& depth, int layer_count=-1, int ddepth=CV_16U) const
+	{	// Decode the base layer and refine it with the next layer_count-1 layers
+		// (all layers if negative). The result has the size of the last layer used.
+		int n = layer_count < 0 ? (int)layers.size() : std::min(layer_count, (int)layers.size());
+		if (n <= 0) return;
+
+		m_codec.decode(layers[0], depth, ddepth);
+		for (int l=1; l<n; l++) refine(depth, layers[l], depth);
+	}
+
+	void refine(const cv::Mat& depth, const cv::Mat& layer, cv::Mat& dst) const
+	{	// Refine a decoded level (CV_16U or CV_32F) to the next level with its
+		// enhancement layer. dst may be depth. A layer of the wrong size leaves dst unchanged.
+		if (layer.type() != CV_8UC3 || half(layer.size()) != depth.size()) return;
+		if (depth.type() == CV_32F) refine_t<float>(depth, layer, dst);
+		else                        refine_t<uint16_t>(depth, layer, dst);
+	}
+
+	private:
+
+	static cv::Size half(cv::Size s) { return cv::Size((s.width + 1) / 2, (s.height + 1) / 2); }
+
+	struct Quadrants
+	{	// The three enhancement phases of a level and their places in the layer image
+		cv::Rect rect[3];	// odd columns, odd rows, odd rows and columns
+		int row[3], col[3];	// phase offsets within the level
+
+		explicit Quadrants(cv::Size s)
+		{
+			int w0 = (s.width + 1) / 2, h0 = (s.height + 1) / 2;
+			int w1 = s.width / 2, h1 = s.height / 2;
+			rect[0] = cv::Rect(w0, 0, w1, h0);	row[0] = 0; col[0] = 1;
+			rect[1] = cv::Rect(0, h0, w0, h1);	row[1] = 1; col[1] = 0;
+			rect[2] = cv::Rect(w0, h0, w1, h1);	row[2] = 1; col[2] = 1;
+		}
+	};
+
+	static cv::Mat even(const cv::Mat& level)
+	{	// The even rows and columns of a level (the next level down)
+		return phase(level, 0, 0, half(level.size()));
+	}
+
+	static cv::Mat phase(const cv::Mat& level, int row, int col, cv::Size size)
+	{	// Every second pixel from (row, col)
+		cv::Mat dst(size, level.type());
+		const size_t elem = level.elemSize();
+		for (int i=0; i<size.height; i++)
+		{
+			const uchar* in = level.ptr(2*i + row) + col * elem;
+			uchar* out = dst.ptr(i);
+			if (elem == 2) for (int j=0; j<size.width; j++) ((uint16_t*)out)[j] = ((const uint16_t*)in)[2*j];
+			else           for (int j=0; j<size.width; j++) ((float*)out)[j] = ((const float*)in)[2*j];
+		}
+		return dst;
+	}
+
+	void encode_enhancement(const cv::Mat& level, cv::Mat& layer) const
+	{
+		if (layer.size() != level.size() || layer.type() != CV_8UC3) layer.create(level.size(), CV_8UC3);
+
+		Quadrants q(level.size());
+		layer(cv::Rect(0, 0, q.rect[1].width, q.rect[0].height)).setTo(cv::Scalar(0, 0, 0));
+		for (int k=0; k<3; k++)
+		{
+			if (q.rect[k].empty()) continue;
+			cv::Mat roi = layer(q.rect[k]);
+			m_codec.encode(phase(level, q.row[k], q.col[k], q.rect[k].size()), roi);	// writes into the layer
+		}
+	}
+
+	template <typename T>
+	void refine_t(const cv::Mat& depth, const cv::Mat& layer, cv::Mat& dst) const
+	{
+		Quadrants q(layer.size());
+		cv::Mat decoded[3];
+		for (int k=0; k<3; k++)
+		{
+			if (!q.rect[k].empty()) m_codec.decode(layer(q.rect[k]), decoded[k], depth.type());
+		}
+
+		cv::Mat src = depth;	// keeps the input alive if dst is depth
+		dst.create(layer.size(), depth.type());
+
+		for (int i=0; i<dst.rows; i++)
+		{
+			T* out = dst.ptr<T>(i);
+			if (i % 2 == 0)
+			{
+				const T* even_row = src.ptr<T>(i / 2);
+				const T* odd_col = q.rect[0].width ? decoded[0].ptr<T>(i / 2) : nullptr;
+				for (int j=0; j<dst.cols; j++) out[j] = (j % 2 == 0) ? even_row[j / 2] : odd_col[j / 2];
+			}
+			else
+			{
+				const T* odd_row = decoded[1].ptr<T>(i / 2);
+				const T* odd_both = q.rect[2].width ? decoded[2].ptr<T>(i / 2) : nullptr;
+				for (int j=0; j<dst.cols; j++) out[j] = (j % 2 == 0) ? odd_row[j / 2] : odd_both[j / 2];
+			}
+		}
+	}
+
+	HueCodec m_codec;
+	int m_levels;
+};
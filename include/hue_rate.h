@@ -0,0 +1,208 @@
+#pragma once
+#include <opencv2/opencv.hpp>   // Include OpenCV API
+#include <hue_codec.h>          // The header-only hue codec
+#include <hue_metrics.h>        // Depth quality metrics
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Closed-loop rate control for image-format compression
+//
+// HueRateController hue-encodes and compresses each frame with cv::imencode at a
+// quality chosen per frame to hit either a target size in bytes per frame (for a
+// fixed uplink bitrate) or a target depth PSNR. Each frame is compressed once:
+// the quality comes from a model fitted to the recent frames, not from trial
+// encodes.
+//
+//     HueRateOptions options;
+//     options.format = ".webp";
+//     options.target_bytes = 20000;                   // e.g. 4.8 Mbps at 30 fps
+//     HueRateController rate(codec, options);
+//     rate.encode(depth, buffer);                     // buffer holds the compressed frame
+//
+// The model is y = a + b * quality, where y is the log of the frame size (or the
+// PSNR) normalized by the complexity of the hue-encoded frame (the mean gradient
+// of a subsample of its rows). The complexity is measured before compression, so
+// a scene change moves the quality on the same frame. a tracks the most recent
+// frame and b is learned from frames with different qualities.
+//
+// In size mode, bytes over or under the target are paid back over the next
+// buffer_frames frames, so the mean size stays on target. Unused budget is
+// limited to one frame, so easy frames do not build up a large burst.
+//
+// In PSNR mode, each compressed frame is also decompressed and decoded to measure
+// its PSNR (see DepthMetrics), which costs about as much as a receiver's decode.
+//
+// Exactly one target picks the mode: target_bytes for size mode, or target_psnr
+// (with target_bytes 0) for PSNR mode. Options with neither target set do not
+// pick a mode, so encode returns false for every frame.
+
+struct HueRateOptions
+{
+	std::string format = ".jpg";	// ".jpg" or ".webp"
+	size_t target_bytes = 0;		// target compressed bytes per frame (size mode)
+	double target_psnr = 0.0;		// target PSNR (dB) if target_bytes is 0 (PSNR mode); encode fails if neither is set
+	int min_quality = 5;
+	int max_quality = 100;
+	int initial_quality = 80;
+	int max_step = 15;				// largest quality change from one frame to the next
+	double buffer_frames = 10.0;	// frames over which missed targets are paid back
+};
+
+struct HueRateFrame
+{
+	int quality = 0;			// quality used for the frame
+	size_t bytes = 0;			// compressed size
+	double psnr = 0.0;			// measured PSNR (PSNR mode only)
+	double complexity = 0.0;	// mean gradient of the hue-encoded frame
+	double target = 0.0;		// bytes or PSNR that the quality was chosen for
+};
+
+class HueRateController
+{
+	public:
+
+	HueRateController(const HueCodec& codec, const HueRateOptions& options)
+	: m_codec(codec)
+	, m_options(options)
+	{
+		m_options.min_quality = std::max(1, m_options.min_quality);
+		m_options.max_quality = std::min(100, std::max(m_options.min_quality, m_options.max_quality));
+		m_options.max_step = std::max(1, m_options.max_step);
+		m_options.buffer_frames = std::max(1.0, m_options.buffer_frames);
+		reset();
+	}
+
+	void reset()
+	{	// Forget the model (e.g. after a stream restart)
+		m_frames = 0;
+		m_quality = clamp_quality(m_options.initial_quality);
+		m_slope = psnr_mode() ? 0.1 : 0.03;	// typical dB or log bytes per quality step
+		m_intercept = 0.0;
+		m_buffer = 0.0;
+		m_last = HueRateFrame();
+	}
+
+	bool encode(const cv::Mat& depth, std::vector<uchar>& buffer)
+	{	// Hue-encode and compress a frame at the quality picked by the model.
+		// Returns false if no target is set, or if the frame cannot be encoded (or
+		// decoded again to measure its PSNR).
+		if (!has_target()) return false;
+		m_codec.encode(depth, m_encoded);
+		if (m_encoded.empty()) return false;
+
+		HueRateFrame frame;
+		frame.complexity = complexity(m_encoded);
+		frame.target = target();
+		frame.quality = choose_quality(frame.complexity, frame.target);
+
+		std::vector<int> params { quality_flag(), frame.quality };
+		if (!cv::imencode(m_options.format, m_encoded, buffer, params)) return false;
+		frame.bytes = buffer.size();
+
+		if (psnr_mode())
+		{	// m_decoded holds the previous frame if the buffer does not decode
+			cv::Mat bgr = cv::imdecode(buffer, cv::IMREAD_COLOR);
+			if (bgr.size() != m_encoded.size() || bgr.type() != CV_8UC3) return false;
+			m_codec.decode(bgr, m_decoded);
+			double psnr = depth_quality(depth, m_decoded, m_codec.depth_max_m(), m_codec.depth_scale()).psnr;
+			frame.psnr = std::isfinite(psnr) ? psnr : 100.0;	// lossless
+		}
+
+		update(frame);
+		return true;
+	}
+
+	const HueRateFrame& last() const { return m_last; }
+	int quality() const { return m_quality; }			// quality of the last frame
+	double buffer_bytes() const { return m_buffer; }	// bytes over (positive) or under budget
+	const cv::Mat& encoded() const { return m_encoded; }	// hue-encoded last frame
+	bool psnr_mode() const { return m_options.target_bytes == 0; }
+	bool has_target() const { return m_options.target_bytes > 0 || m_options.target_psnr > 0.0; }
+
+	private:
+
+	int quality_flag() const
+	{
+		return m_options.format == ".webp" ? cv::IMWRITE_WEBP_QUALITY : cv::IMWRITE_JPEG_QUALITY;
+	}
+
+	int clamp_quality(int q) const
+	{
+		return std::max(m_options.min_quality, std::min(q, m_options.max_quality));
+	}
+
+	double target() const
+	{	// Size target including the pay-back of the buffer, or the PSNR target
+		if (psnr_mode()) return m_options.target_psnr;
+		double t = (double)m_options.target_bytes;
+		return std::max(0.25 * t, t - m_buffer / m_options.buffer_frames);
+	}
+
+	double normalize(double value, double c) const
+	{	// Remove the effect of frame complexity from a size or PSNR
+		return psnr_mode() ? value + 10.0 * std::log10(c) : std::log(value) - std::log(c);
+	}
+
+	int choose_quality(double c, double t) const
+	{
+		if (m_frames == 0) return m_quality;
+		double q = (normalize(t, c) - m_intercept) / m_slope;
+		int lower = m_quality - m_options.max_step, upper = m_quality + m_options.max_step;
+		int rounded = (int)std::lround(std::max((double)lower, std::min(q, (double)upper)));
+		return clamp_quality(rounded);
+	}
+
+	void update(HueRateFrame& frame)
+	{
+		double y = normalize(psnr_mode() ? frame.psnr : std::max<double>(1.0, frame.bytes), frame.complexity);
+		if (m_frames > 0 && std::abs(frame.quality - m_last.quality) >= 2)
+		{	// Learn the slope from the change between consecutive frames
+			double slope = (y - m_last_y) / (frame.quality - m_last.quality);
+			double lo = psnr_mode() ? 0.01 : 0.002, hi = psnr_mode() ? 2.0 : 0.3;
+			if (std::isfinite(slope)) m_slope = std::max(lo, std::min(0.7 * m_slope + 0.3 * slope, hi));
+		}
+		m_intercept = y - m_slope * frame.quality;
+
+		if (!psnr_mode())
+		{
+			double t = (double)m_options.target_bytes;
+			m_buffer = std::max(-t, m_buffer + frame.bytes - t);
+		}
+
+		m_quality = frame.quality;
+		m_last_y = y;
+		m_last = frame;
+		m_frames++;
+	}
+
+	static double complexity(const cv::Mat& bgr)
+	{	// Mean absolute horizontal and vertical gradient over every 4th row
+		uint64_t sum = 0, count = 0;
+		for (int i=4; i<bgr.rows; i+=4)
+		{
+			const uchar* p = bgr.ptr<uchar>(i);
+			const uchar* up = bgr.ptr<uchar>(i-1);
+			int n = bgr.cols * bgr.channels();
+			for (int j=3; j<n; j++)
+			{
+				sum += std::abs(p[j] - p[j-3]) + std::abs(p[j] - up[j]);
+			}
+			count += n - 3;
+		}
+		return 1.0 + (count ? (double)sum / count : 0.0);
+	}
+
+	HueCodec m_codec;
+	HueRateOptions m_options;
+	cv::Mat m_encoded, m_decoded;
+
+	uint64_t m_frames = 0;
+	int m_quality = 0;
+	double m_slope = 0.0, m_intercept = 0.0;
+	double m_last_y = 0.0;
+	double m_buffer = 0.0;
+	HueRateFrame m_last;
+};
@@ -0,0 +1,252 @@
+#pragma once
+#include <opencv2/opencv.hpp>   // Include OpenCV API
+#include <hue_codec.h>          // The header-only hue codec
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+// Fast lossless depth compression (RVL)
+//
+// HueRVLCodec compresses CV_16U depth exactly, for recordings that need the
+// original values, with the run-length and variable-length coding of Wilson,
+// "Fast Lossless Depth Image Compression" (2017). Depth images are mostly runs
+// of valid pixels with small differences between neighbours, and runs of zeros
+// (no data), so each frame is coded as alternating counts of zero and non-zero
+// pixels, with the zig-zag delta of each non-zero pixel from the previous
+// non-zero pixel. Every number is coded in 3-bit groups with a continuation bit
+// (one nibble each), and eight nibbles are packed per 32-bit word.
+//
+//     HueRVLCodec rvl;
+//     std::vector<uchar> compressed;
+//     rvl.encode(depth, compressed);
+//     rvl.decode(compressed, depth);
+//
+// It is a single pass without entropy coding, so it runs at memory speeds
+// (unlike PNG) at compression ratios similar to 16-bit PNG for camera depth.
+//
+// Stream layout: magic "HRV1", width, and height (4 bytes each, little-endian),
+// then the words in host byte order.
+
+class HueRVLCodec
+{
+	public:
+
+	explicit HueRVLCodec(float depth_scale=HUE_MM_SCALE)
+	: m_depth_scale(depth_scale)
+	{
+	}
+
+	float depth_scale() const { return m_depth_scale; }
+
+	void encode(const cv::Mat& src, std::vector<uchar>& dst) const
+	{	// Compress CV_16U depth. dst keeps its capacity, so reusing it avoids allocations.
+		if (src.empty() || src.type() != CV_16U) return;
+		cv::Mat depth = src.isContinuous() ? src : src.clone();
+		const size_t n = depth.total();
+
+		// At most 8 nibbles per pixel (alternating runs of one pixel with 17-bit deltas)
+		dst.resize(HEADER_SIZE + 4 * n + 16);
+		write_header(dst.data(), depth.cols, depth.rows);
+
+		Writer w { dst.data() + HEADER_SIZE, 0, 0 };
+		const uint16_t* p = depth.ptr<uint16_t>(0);
+		const uint16_t* end = p + n;
+		int previous = 0;
+		while (p != end)
+		{
+			const uint16_t* start = p;
+			while (p != end && *p == 0) p++;
+			w.put((uint32_t)(p - start));
+
+			start = p;
+			while (p != end && *p != 0) p++;
+			w.put((uint32_t)(p - start));
+
+			for (const uint16_t* q=start; q!=p; q++)
+			{
+				int delta = *q - previous;
+				w.put(((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31));	// zig-zag: small magnitudes stay small
+				previous = *q;
+			}
+		}
+		w.flush();
+		dst.resize(w.out - dst.data());
+	}
+
+	std::vector<uchar> encode(const cv::Mat& src) const
+	{	// Overloaded convenience function to return the compressed stream
+		std::vector<uchar> dst;
+		encode(src, dst);
+		return dst;
+	}
+
+	bool decode(const uchar* src, size_t size, cv::Mat& dst, int ddepth=CV_16U) const
+	{	// Decompress to CV_16U depth, or CV_32F depth in metres (converted in the
+		// same pass). Returns false if the stream is truncated or corrupt (dst may
+		// then hold part of a frame).
+		int width, height;
+		if (!read_header(src, size, width, height)) return false;
+
+		const int type = ddepth == CV_32F ? CV_32F : CV_16U;
+		cv::Mat tmp;
+		if (dst.isContinuous()) tmp = dst;
+		if (tmp.size() != cv::Size(width, height) || tmp.type() != type) tmp.create(height, width, type);
+
+		bool ok = type == CV_32F ? decode_words(src + HEADER_SIZE, src + size, tmp.ptr<float>(0), tmp.total(), m_depth_scale)
+		                         : decode_words(src + HEADER_SIZE, src + size, tmp.ptr<uint16_t>(0), tmp.total(), 1.0f);
+		dst = tmp;
+		return ok;
+	}
+
+	bool decode(const std::vector<uchar>& src, cv::Mat& dst, int ddepth=CV_16U) const
+	{
+		return decode(src.data(), src.size(), dst, ddepth);
+	}
+
+	cv::Mat decode(const std::vector<uchar>& src, int ddepth=CV_16U) const
+	{	// Overloaded convenience function to return a Mat (empty if the stream is corrupt)
+		cv::Mat dst;
+		decode(src, dst, ddepth);
+		return dst;
+	}
+
+	private:
+
+	enum { HEADER_SIZE = 12 };
+
+	struct Writer
+	{	// Packs nibbles into words, most significant nibble first
+		uchar* out;
+		uint64_t bits;	// the last 'nibbles' nibbles are not yet written
+		int nibbles;
+
+		void put(uint32_t value)
+		{
+			if (value < 8)
+			{	// the common case: small deltas and short runs
+				append(value, 1);
+				return;
+			}
+
+			uint64_t code = 0;
+			int n = 0;
+			do
+			{
+				uint32_t nibble = value & 7;
+				value >>= 3;
+				if (value) nibble |= 8;
+				code = (code << 4) | nibble;
+				n++;
+			} while (value);
+
+			if (n > 8)
+			{	// keep at most 15 pending nibbles in the 64-bit buffer
+				append(code >> 32, n - 8);
+				n = 8;
+			}
+			append(code & 0xFFFFFFFF, n);
+		}
+
+		void append(uint64_t code, int n)
+		{
+			bits = (bits << (4 * n)) | code;
+			nibbles += n;
+			if (nibbles >= 8)
+			{
+				nibbles -= 8;
+				uint32_t word = (uint32_t)(bits >> (4 * nibbles));
+				std::memcpy(out, &word, 4);
+				out += 4;
+			}
+		}
+
+		void flush()
+		{
+			if (nibbles > 0) append(0, 8 - nibbles);
+		}
+	};
+
+	struct Reader
+	{
+		const uchar* in;
+		const uchar* end;
+		uint32_t word;	// the next 'nibbles' nibbles, most significant first
+		int nibbles;
+
+		bool get(uint32_t& value)
+		{
+			if (nibbles > 0 && word < 0x80000000u)
+			{	// the common case: a single nibble
+				value = word >> 28;
+				word <<= 4;
+				nibbles--;
+				return true;
+			}
+
+			value = 0;
+			for (int bits=0; bits<33; bits+=3)	// 11 nibbles hold any 32-bit value
+			{
+				if (nibbles == 0)
+				{
+					if (end - in < 4) return false;
+					std::memcpy(&word, in, 4);
+					in += 4;
+					nibbles = 8;
+				}
+				uint32_t nibble = word >> 28;
+				word <<= 4;
+				nibbles--;
+
+				value |= (nibble & 7) << bits;
+				if (!(nibble & 8)) return true;
+			}
+			return false;
+		}
+	};
+
+	template <typename T>
+	static bool decode_words(const uchar* in, const uchar* end_in, T* p, size_t n, float scale)
+	{	// Undo the runs and deltas of encode (scale converts to metres for float output)
+		Reader r { in, end_in, 0, 0 };
+		T* end = p + n;
+		int previous = 0;
+		while (p != end)
+		{
+			uint32_t zeros, values;
+			if (!r.get(zeros) || zeros > (uint32_t)(end - p)) return false;
+			std::fill(p, p + zeros, (T)0);
+			p += zeros;
+
+			if (!r.get(values) || values > (uint32_t)(end - p)) return false;
+			for (uint32_t k=0; k<values; k++)
+			{
+				uint32_t v;
+				if (!r.get(v)) return false;
+				previous = (uint16_t)(previous + ((int)(v >> 1) ^ -(int)(v & 1)));
+				*p++ = std::is_integral<T>::value ? (T)previous : (T)(previous * scale);
+			}
+		}
+		return true;
+	}
+
+	static void write_header(uchar* h, int width, int height)
+	{
+		const uint32_t fields[2] = { (uint32_t)width, (uint32_t)height };
+		std::memcpy(h, "HRV1", 4);
+		for (int f=0; f<2; f++) for (int k=0; k<4; k++) h[4 + 4*f + k] = (uchar)(fields[f] >> (8*k));
+	}
+
+	static bool read_header(const uchar* h, size_t size, int& width, int& height)
+	{
+		if (size < HEADER_SIZE || std::memcmp(h, "HRV1", 4) != 0) return false;
+		uint32_t fields[2] = { 0, 0 };
+		for (int f=0; f<2; f++) for (int k=0; k<4; k++) fields[f] |= (uint32_t)h[4 + 4*f + k] << (8*k);
+		width = (int)fields[0];
+		height = (int)fields[1];
+		return width > 0 && height > 0 && (uint64_t)width * height < (1ull << 31);
+	}
+
+	float m_depth_scale;
+};
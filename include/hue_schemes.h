@@ -0,0 +1,89 @@
+#pragma once
+#include <opencv2/opencv.hpp>   // Include OpenCV API
+#include <hue_codec.h>          // The header-only hue codec
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+// Alternative per-pixel encoding schemes
+//
+// HueCodecT and HueSchemeCodec take the per-pixel scheme as a template
+// parameter, so another depth-to-RGB mapping only needs a struct with:
+//
+//     static constexpr int MAX = ...;              // values 1 to MAX are depth, 0 is no data
+//     static const uint8_t* encode(int v);         // BGR colour of a value
+//     static int decode(int r, int g, int b);      // value of a (possibly noisy) colour
+//     static int error(int r, int g, int b);       // distance from the scheme's colours (0-255)
+//
+// and is used as e.g. HueSchemeCodec<TriangleScheme>, with the same interface
+// as HueCodec. HueScheme (in hue_codec.h) is the default hue encoding.
+
+// Triangle-wave ("packed depth") encoding
+//
+// After Pece, Kautz, and Weyrich, "Adapting Standard Video Codecs for Depth
+// Streaming" (2011). Red is a coarse linear ramp of the value, and green and
+// blue are triangle waves of period 508 that are a quarter period apart:
+//
+//     red   = round(255 * v / MAX)
+//     green = triangle(v)             0 at v = 0, 254 at v = 254, 0 at v = 508, ...
+//     blue  = triangle(v - 127)
+//
+// The ramp selects the quarter period, and whichever wave is in its linear part
+// there gives the exact value, so 4096 levels are carried by 8-bit channels
+// (1531 for the hue encoding). Errors in green and blue change the value by as
+// much, and the ramp tolerates red errors of up to 3 levels before the quarter
+// is misread. Black is no data.
+
+struct TriangleEncodeTable
+{	// Lookup table of BGR values for every triangle-encoded value, generated at compile time
+	static constexpr int MAX = 4095, PERIOD = 508, HALF = 254, QUARTER = 127;
+	uint8_t bgr[MAX + 1][3];
+
+	static constexpr int triangle(int x)
+	{
+		int t = (x % PERIOD + PERIOD) % PERIOD;
+		return t <= HALF ? t : PERIOD - t;
+	}
+
+	constexpr TriangleEncodeTable() : bgr{}
+	{
+		for (int v=1; v<=MAX; v++)
+		{
+			bgr[v][0] = triangle(v - QUARTER);
+			bgr[v][1] = triangle(v);
+			bgr[v][2] = (v * 255 + MAX / 2) / MAX;
+		}
+	}
+};
+
+constexpr TriangleEncodeTable TRIANGLE_ENCODE_TABLE{};
+
+struct TriangleScheme
+{
+	static constexpr int MAX = TriangleEncodeTable::MAX;
+
+	static const uint8_t* encode(int v) { return TRIANGLE_ENCODE_TABLE.bgr[v]; }
+
+	static int decode(int r, int g, int b)
+	{
+		typedef TriangleEncodeTable T;
+		if (std::max(g, b) < T::QUARTER / 4) return 0;	// valid colours have a wave at 64 or above
+
+		// Quarter period of the value, offset by an eighth so that the selected wave
+		// is at least an eighth of a period from its peaks
+		int q = (int)std::floor(r * ((float)MAX / 255.0f / T::QUARTER) - 0.5f);
+		int m = q & 3;
+		int delta = m == 0 ? g : m == 1 ? b : m == 2 ? T::HALF - g : T::HALF - b;
+		return std::max(0, std::min(T::QUARTER * q + delta, (int)MAX));
+	}
+
+	static int error(int r, int g, int b)
+	{	// Largest channel difference from the colour of the decoded value
+		int v = decode(r, g, b);
+		if (v == 0) return std::max(r, std::max(g, b));
+		const uint8_t* bgr = encode(v);
+		return std::max(std::abs(b - bgr[0]), std::max(std::abs(g - bgr[1]), std::abs(r - bgr[2])));
+	}
+};
+
+typedef HueSchemeCodec<TriangleScheme> TriangleCodec;
@@ -0,0 +1,314 @@
+#pragma once
+#include <opencv2/opencv.hpp>   // Include OpenCV API
+#include <hue_codec.h>          // The header-only hue codec
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Raw depth sequence files
+//
+// A simple uncompressed container for depth sequences (e.g. regression and
+// benchmark data) that loads instantly: HueSequenceReader memory-maps the file
+// and returns each frame as a cv::Mat view of the mapping, so no frame is read
+// or decoded until it is used, and the operating system caches the pages
+// between runs.
+//
+//     HueSequenceWriter writer;
+//     writer.open("sequence.hds", depth.size(), CV_16U, HUE_MM_SCALE);
+//     writer.write(depth);
+//     writer.close();
+//
+//     HueSequenceReader reader("sequence.hds");
+//     cv::Mat depth = reader.frame(0);
+//
+// The mapping is copy-on-write: frames can be modified in place, which copies
+// the touched pages and never changes the file. The reader must outlive the
+// frames it returns.
+//
+// File layout (header fields little-endian, frames in host byte order):
+//
+//   offset size
+//        0    4  magic "HDS1"
+//        4    4  width
+//        8    4  height
+//       12    4  OpenCV type of a frame (e.g. CV_16U or CV_32F)
+//       16    8  frame count (0: count the frames that fit in the file)
+//       24    8  frame stride in bytes (frame size rounded up to 64 bytes)
+//       32    8  offset of the first frame (4096)
+//       40    4  depth scale in metres per unit (float)
+//       44   20  reserved
+//
+// convert_sequence (test/convert_sequence.cpp) converts directories of PNGs.
+
+namespace hue_sequence_detail
+{
+	const char MAGIC[4] = { 'H', 'D', 'S', '1' };
+	const size_t HEADER_SIZE = 64;
+	const size_t DATA_OFFSET = 4096;	// page-aligned frames
+	const size_t FRAME_ALIGNMENT = 64;
+
+	inline void put_u32(uint8_t* p, uint32_t v) { for (int i=0; i<4; i++) p[i] = (uint8_t)(v >> (8*i)); }
+	inline void put_u64(uint8_t* p, uint64_t v) { for (int i=0; i<8; i++) p[i] = (uint8_t)(v >> (8*i)); }
+	inline uint32_t get_u32(const uint8_t* p) { uint32_t v = 0; for (int i=0; i<4; i++) v |= (uint32_t)p[i] << (8*i); return v; }
+	inline uint64_t get_u64(const uint8_t* p) { uint64_t v = 0; for (int i=0; i<8; i++) v |= (uint64_t)p[i] << (8*i); return v; }
+
+	inline bool valid_type(int type)
+	{	// A single-channel OpenCV type (CV_8U to CV_64F, or CV_16F)
+		return type >= 0 && type < CV_DEPTH_MAX;
+	}
+
+	inline size_t frame_stride(cv::Size size, int type)
+	{
+		size_t bytes = (size_t)size.width * size.height * CV_ELEM_SIZE(type);
+		return (bytes + FRAME_ALIGNMENT - 1) / FRAME_ALIGNMENT * FRAME_ALIGNMENT;
+	}
+}
+
+class HueSequenceWriter
+{
+	public:
+
+	HueSequenceWriter() {}
+	~HueSequenceWriter() { close(); }
+
+	HueSequenceWriter(const HueSequenceWriter&) = delete;
+	HueSequenceWriter& operator=(const HueSequenceWriter&) = delete;
+
+	bool open(const std::string& path, cv::Size size, int type, float depth_scale=HUE_MM_SCALE)
+	{	// Create (or overwrite) a sequence file for frames of the given size and type
+		close();
+		if (size.empty() || !hue_sequence_detail::valid_type(type)) return false;
+
+		m_file = std::fopen(path.c_str(), "wb");
+		if (!m_file) return false;
+
+		m_size = size;
+		m_type = type;
+		m_depth_scale = depth_scale;
+		m_stride = hue_sequence_detail::frame_stride(size, type);
+		m_count = 0;
+
+		std::vector<uint8_t> header(hue_sequence_detail::DATA_OFFSET, 0);
+		write_header(header.data());
+		if (std::fwrite(header.data(), 1, header.size(), m_file) != header.size())
+		{
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	bool write(const cv::Mat& frame)
+	{	// Append a frame (any row stride) of the size and type given to open
+		if (!m_file || frame.size() != m_size || frame.type() != m_type) return false;
+
+		size_t row_bytes = (size_t)m_size.width * frame.elemSize();
+		for (int i=0; i<frame.rows; i++)
+		{
+			if (std::fwrite(frame.ptr(i), 1, row_bytes, m_file) != row_bytes) return false;
+		}
+
+		static const uint8_t padding[hue_sequence_detail::FRAME_ALIGNMENT] = {};
+		size_t pad = m_stride - row_bytes * m_size.height;
+		if (pad && std::fwrite(padding, 1, pad, m_file) != pad) return false;
+
+		m_count++;
+		return true;
+	}
+
+	bool close()
+	{	// Write the frame count into the header and close the file
+		if (!m_file) return true;
+
+		uint8_t header[hue_sequence_detail::HEADER_SIZE] = {};
+		write_header(header);
+		bool ok = std::fseek(m_file, 0, SEEK_SET) == 0 && std::fwrite(header, 1, sizeof(header), m_file) == sizeof(header);
+		ok = std::fclose(m_file) == 0 && ok;
+		m_file = nullptr;
+		return ok;
+	}
+
+	bool is_open() const { return m_file != nullptr; }
+	uint64_t size() const { return m_count; }	// frames written
+
+	private:
+
+	void write_header(uint8_t* h) const
+	{
+		using namespace hue_sequence_detail;
+		std::memcpy(h, MAGIC, 4);
+		put_u32(h + 4, m_size.width);
+		put_u32(h + 8, m_size.height);
+		put_u32(h + 12, (uint32_t)m_type);
+		put_u64(h + 16, m_count);
+		put_u64(h + 24, m_stride);
+		put_u64(h + 32, DATA_OFFSET);
+		uint32_t scale;
+		std::memcpy(&scale, &m_depth_scale, 4);
+		put_u32(h + 40, scale);
+	}
+
+	std::FILE* m_file = nullptr;
+	cv::Size m_size;
+	int m_type = 0;
+	float m_depth_scale = 0.0f;
+	size_t m_stride = 0;
+	uint64_t m_count = 0;
+};
+
+class HueSequenceReader
+{
+	public:
+
+	HueSequenceReader() {}
+	explicit HueSequenceReader(const std::string& path) { open(path); }
+	~HueSequenceReader() { close(); }
+
+	HueSequenceReader(const HueSequenceReader&) = delete;
+	HueSequenceReader& operator=(const HueSequenceReader&) = delete;
+
+	bool open(const std::string& path)
+	{	// Map a sequence file. Fails if the header is invalid or the file cannot hold
+		// one whole frame. Frames that do not fit in the file are ignored.
+		using namespace hue_sequence_detail;
+		close();
+		if (!map(path)) return false;
+
+		const uint8_t* h = m_data;
+		if (m_length < DATA_OFFSET || std::memcmp(h, MAGIC, 4) != 0)
+		{
+			close();
+			return false;
+		}
+
+		uint32_t width = get_u32(h + 4), height = get_u32(h + 8), type = get_u32(h + 12);
+		uint64_t count = get_u64(h + 16);
+		uint64_t stride = get_u64(h + 24);
+		m_offset = get_u64(h + 32);
+		uint32_t scale = get_u32(h + 40);
+		std::memcpy(&m_depth_scale, &scale, 4);
+
+		// Check the header before any size arithmetic, so that a corrupt header
+		// cannot overflow the frame size and give views past the end of the mapping
+		bool ok = width > 0 && height > 0 && width <= INT32_MAX && height <= INT32_MAX
+		       && valid_type((int)type) && m_offset >= HEADER_SIZE && m_offset <= m_length;
+		if (ok)
+		{	// One frame must fit in the file (width * height < 2^62, so this cannot overflow)
+			uint64_t elem = CV_ELEM_SIZE((int)type);
+			uint64_t pixels = (uint64_t)width * height;
+			ok = pixels <= (m_length - m_offset) / elem && stride >= pixels * elem;
+		}
+		if (!ok)
+		{
+			close();
+			return false;
+		}
+
+		m_size = cv::Size((int)width, (int)height);
+		m_type = (int)type;
+		m_stride = (size_t)stride;
+
+		uint64_t available = (m_length - m_offset) / stride;
+		m_count = (count == 0 || count > available) ? available : count;	// 0 if the writer was not closed
+		return true;
+	}
+
+	void close()
+	{
+		if (!m_data) return;
+#ifdef _WIN32
+		UnmapViewOfFile(m_data);
+#else
+		munmap(m_data, m_length);
+#endif
+		m_data = nullptr;
+		m_length = 0;
+		m_count = 0;
+	}
+
+	bool is_open() const { return m_data != nullptr; }
+	size_t size() const { return m_count; }		// number of frames
+	cv::Size frame_size() const { return m_size; }
+	int type() const { return m_type; }
+	float depth_scale() const { return m_depth_scale; }
+
+	cv::Mat frame(size_t index) const
+	{	// Zero-copy view of a frame (empty if index is out of range)
+		if (index >= m_count) return cv::Mat();
+		return cv::Mat(m_size, m_type, m_data + m_offset + index * m_stride);
+	}
+
+	void frames(std::vector<cv::Mat>& sequence, int frame_count=-1) const
+	{	// Views of the first frame_count frames (all frames if negative)
+		size_t n = frame_count < 0 ? m_count : std::min(m_count, (size_t)frame_count);
+		sequence.resize(n);
+		for (size_t i=0; i<n; i++) sequence[i] = frame(i);
+	}
+
+	void prefetch() const
+	{	// Ask the operating system to read the whole file ahead of use
+#ifdef MADV_WILLNEED
+		if (m_data) madvise(m_data, m_length, MADV_WILLNEED);
+#endif
+	}
+
+	private:
+
+	bool map(const std::string& path)
+	{	// Private (copy-on-write) mapping of the whole file
+#ifdef _WIN32
+		HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE) return false;
+		LARGE_INTEGER length;
+		HANDLE mapping = nullptr;
+		if (GetFileSizeEx(file, &length) && length.QuadPart > 0)
+		{
+			mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+		}
+		CloseHandle(file);
+		if (!mapping) return false;
+		m_data = (uint8_t*)MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+		CloseHandle(mapping);
+		m_length = m_data ? (size_t)length.QuadPart : 0;
+#else
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0) return false;
+		struct stat st;
+		if (fstat(fd, &st) == 0 && st.st_size > 0)
+		{
+			void* p = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+			if (p != MAP_FAILED)
+			{
+				m_data = (uint8_t*)p;
+				m_length = st.st_size;
+			}
+		}
+		::close(fd);
+#endif
+		return m_data != nullptr;
+	}
+
+	uint8_t* m_data = nullptr;
+	size_t m_length = 0;
+	size_t m_count = 0;
+	size_t m_stride = 0;
+	size_t m_offset = 0;
+	cv::Size m_size;
+	int m_type = 0;
+	float m_depth_scale = 0.0f;
+};
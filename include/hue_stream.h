@@ -0,0 +1,645 @@
+#pragma once
+#include <opencv2/opencv.hpp>   // Include OpenCV API
+#include <hue_codec.h>          // The header-only hue codec
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+// Hue depth streaming over TCP or UDP
+//
+// HueStreamSender hue-encodes and compresses depth frames with an image format
+// (or sends the raw hue-encoded frame) and sends them to a HueStreamReceiver,
+// which decompresses and decodes them. Each frame carries the codec parameters,
+// so the receiver needs no configuration, and its capture and send times, so
+// the receiver can measure end-to-end latency.
+//
+// Sending is pipelined: send() encodes and compresses on the calling thread and
+// queues the packet for a network thread, so frame n+1 is encoded while frame n
+// is on the wire. The queue is short and drops the oldest frame when full, so a
+// slow link increases the frame drop rate rather than the latency.
+//
+// TCP delivers every queued frame in order (Nagle's algorithm is disabled).
+// UDP splits each frame into datagrams. A frame that is incomplete when a newer
+// frame starts arriving is dropped, which bounds latency on a lossy network, and
+// duplicated or late datagrams of older frames are ignored. Packets over 64 MB
+// are rejected with either transport.
+//
+// Timestamps are microseconds of the system clock, so latency across machines
+// is only meaningful if their clocks are synchronized (e.g. with PTP).
+//
+// Packet layout (little-endian):
+//
+//   offset size
+//        0    4  magic "HUE1"
+//        4    4  frame id
+//        8    8  capture time (us)
+//       16    8  send time (us)
+//       24    4  depth_min_m (float)
+//       28    4  depth_max_m (float)
+//       32    4  depth_scale (float)
+//       36    4  inverse colorization flag, then 3 reserved bytes
+//       40    8  image format extension, e.g. ".webp" (empty: raw BGR)
+//       48    2  width
+//       50    2  height
+//       52    4  payload size in bytes
+//       56       payload
+//
+// UDP datagrams start with a 16-byte fragment header: magic "HUEF", frame id,
+// fragment index (2 bytes), fragment count (2 bytes), and offset in the packet.
+
+inline int64_t hue_stream_now_us()
+{
+	using namespace std::chrono;
+	return duration_cast<microseconds>(system_clock::now().time_since_epoch()).count();
+}
+
+enum class HueTransport { TCP, UDP };
+
+struct HueStreamOptions
+{
+	HueTransport transport = HueTransport::TCP;
+	std::string format = ".webp";	// image format for cv::imencode (empty: raw hue-encoded BGR)
+	std::vector<int> params { cv::IMWRITE_WEBP_QUALITY, 90 };	// cv::imencode parameters
+	int queue_depth = 2;			// frames waiting for the network thread
+	int udp_payload = 1400;			// maximum UDP datagram payload (fits a 1500-byte MTU)
+};
+
+struct HueFrameInfo
+{
+	uint32_t frame_id = 0;
+	int64_t capture_us = 0;		// capture time given to send()
+	int64_t send_us = 0;		// time the sender started sending the frame
+	int64_t receive_us = 0;		// time the receiver had the whole frame
+	int64_t decode_us = 0;		// time the receiver had the decoded depth frame
+	size_t bytes = 0;			// packet size
+
+	double latency_ms() const { return (decode_us - capture_us) / 1000.0; }		// capture to decoded depth
+	double network_ms() const { return (receive_us - send_us) / 1000.0; }		// time on the wire
+};
+
+struct HueStreamStats
+{
+	uint64_t frames = 0;		// frames sent or received
+	uint64_t bytes = 0;
+	uint64_t dropped = 0;		// frames dropped by the send queue or incomplete UDP frames
+	double latency_sum_ms = 0.0;
+	double latency_max_ms = 0.0;
+	int64_t first_us = 0, last_us = 0;
+
+	void add(size_t frame_bytes, int64_t now_us, double latency_ms=0.0)
+	{
+		if (frames == 0) first_us = now_us;
+		last_us = now_us;
+		frames++;
+		bytes += frame_bytes;
+		latency_sum_ms += latency_ms;
+		latency_max_ms = std::max(latency_max_ms, latency_ms);
+	}
+
+	double mean_latency_ms() const { return frames ? latency_sum_ms / frames : 0.0; }
+	double seconds() const { return (last_us - first_us) / 1e6; }
+	double fps() const { return frames > 1 && last_us > first_us ? (frames - 1) / seconds() : 0.0; }
+	double mbps() const { return frames > 1 && last_us > first_us ? bytes * 8.0 / frames * fps() / 1e6 : 0.0; }
+};
+
+namespace hue_stream_detail
+{
+#ifdef _WIN32
+	typedef SOCKET socket_t;
+	const socket_t INVALID = INVALID_SOCKET;
+	inline void close_socket(socket_t s) { closesocket(s); }
+	inline void shutdown_socket(socket_t s) { shutdown(s, SD_BOTH); }
+	inline int poll_socket(socket_t s, int timeout_ms) { WSAPOLLFD p { s, POLLRDNORM, 0 }; return WSAPoll(&p, 1, timeout_ms); }
+	inline bool startup() { static WSADATA data; static bool ok = WSAStartup(MAKEWORD(2, 2), &data) == 0; return ok; }
+	const int SEND_FLAGS = 0;
+#else
+	typedef int socket_t;
+	const socket_t INVALID = -1;
+	inline void close_socket(socket_t s) { ::close(s); }
+	inline void shutdown_socket(socket_t s) { ::shutdown(s, SHUT_RDWR); }
+	inline int poll_socket(socket_t s, int timeout_ms) { pollfd p { s, POLLIN, 0 }; return ::poll(&p, 1, timeout_ms); }
+	inline bool startup() { return true; }
+#ifdef MSG_NOSIGNAL
+	const int SEND_FLAGS = MSG_NOSIGNAL;	// report a closed connection as an error instead of SIGPIPE
+#else
+	const int SEND_FLAGS = 0;
+#endif
+#endif
+
+	const size_t HEADER_SIZE = 56;
+	const size_t FRAGMENT_HEADER_SIZE = 16;
+	const size_t MAX_PACKET_SIZE = 64 << 20;	// larger packets are rejected as corrupt
+	const int32_t STALE_FRAMES = 256;			// UDP fragments up to this many frames old are duplicates or late
+
+	template <typename T>
+	void put(uint8_t* p, T v)
+	{	// Little-endian store of an integer or float
+		uint64_t u = 0;
+		std::memcpy(&u, &v, sizeof(T));
+		for (size_t k=0; k<sizeof(T); k++) p[k] = (uint8_t)(u >> (8*k));
+	}
+
+	template <typename T>
+	T get(const uint8_t* p)
+	{
+		uint64_t u = 0;
+		for (size_t k=0; k<sizeof(T); k++) u |= (uint64_t)p[k] << (8*k);
+		T v;
+		std::memcpy(&v, &u, sizeof(T));
+		return v;
+	}
+
+	inline bool send_all(socket_t s, const uint8_t* data, size_t size)
+	{
+		while (size > 0)
+		{
+			int n = ::send(s, (const char*)data, (int)std::min<size_t>(size, 1 << 30), SEND_FLAGS);
+			if (n <= 0) return false;
+			data += n;
+			size -= n;
+		}
+		return true;
+	}
+
+	inline bool recv_all(socket_t s, uint8_t* data, size_t size, int timeout_ms)
+	{
+		while (size > 0)
+		{
+			if (poll_socket(s, timeout_ms) <= 0) return false;
+			int n = ::recv(s, (char*)data, (int)std::min<size_t>(size, 1 << 30), 0);
+			if (n <= 0) return false;
+			data += n;
+			size -= n;
+		}
+		return true;
+	}
+
+	inline bool resolve(const std::string& host, int port, int socktype, sockaddr_storage& addr, socklen_t& len)
+	{
+		addrinfo hints;
+		std::memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = socktype;
+		addrinfo* result = nullptr;
+		if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &result) != 0 || !result) return false;
+		std::memcpy(&addr, result->ai_addr, result->ai_addrlen);
+		len = (socklen_t)result->ai_addrlen;
+		freeaddrinfo(result);
+		return true;
+	}
+}
+
+class HueStreamSender
+{
+	public:
+
+	explicit HueStreamSender(const HueCodec& codec, const HueStreamOptions& options=HueStreamOptions())
+	: m_codec(codec)
+	, m_options(options)
+	{
+	}
+
+	~HueStreamSender() { close(); }
+
+	HueStreamSender(const HueStreamSender&) = delete;
+	HueStreamSender& operator=(const HueStreamSender&) = delete;
+
+	bool connect(const std::string& host, int port)
+	{	// Connect to a receiver (TCP) or set the destination address (UDP)
+		using namespace hue_stream_detail;
+		close();
+		if (!startup()) return false;
+
+		bool udp = m_options.transport == HueTransport::UDP;
+		sockaddr_storage addr;
+		socklen_t len;
+		if (!resolve(host, port, udp ? SOCK_DGRAM : SOCK_STREAM, addr, len)) return false;
+
+		m_socket = socket(addr.ss_family, udp ? SOCK_DGRAM : SOCK_STREAM, 0);
+		if (m_socket == INVALID) return false;
+		if (::connect(m_socket, (const sockaddr*)&addr, len) != 0)
+		{
+			close_socket(m_socket);
+			m_socket = INVALID;
+			return false;
+		}
+
+		int one = 1;
+		int sndbuf = 4 << 20;
+		if (!udp) setsockopt(m_socket, IPPROTO_TCP, TCP_NODELAY, (const char*)&one, sizeof(one));
+		setsockopt(m_socket, SOL_SOCKET, SO_SNDBUF, (const char*)&sndbuf, sizeof(sndbuf));
+
+		m_running = true;
+		m_error = false;
+		m_thread = std::thread(&HueStreamSender::run, this);
+		return true;
+	}
+
+	bool send(const cv::Mat& depth, int64_t capture_us=hue_stream_now_us())
+	{	// Hue-encode and compress a CV_16U or CV_32F depth frame and queue it for sending.
+		// Returns false if the sender is not connected, the connection failed, or
+		// the frame is empty, of another type, or over 65535 pixels wide or high.
+		using namespace hue_stream_detail;
+		if (!m_running || m_error) return false;
+		if (depth.empty() || (depth.type() != CV_16U && depth.type() != CV_32F)) return false;
+		if (depth.cols > 65535 || depth.rows > 65535) return false;
+
+		m_codec.encode(depth, m_encoded);
+		if (!m_options.format.empty())
+		{
+			if (!cv::imencode(m_options.format, m_encoded, m_compressed, m_options.params)) return false;
+		}
+		else
+		{	// Raw hue-encoded BGR rows
+			m_compressed.resize(m_encoded.total() * m_encoded.elemSize());
+			for (int i=0; i<m_encoded.rows; i++)
+			{
+				std::memcpy(&m_compressed[i * m_encoded.cols * 3], m_encoded.ptr(i), m_encoded.cols * 3);
+			}
+		}
+
+		// Reuse a packet buffer returned by the network thread
+		std::vector<uint8_t> packet;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (!m_spare.empty())
+			{
+				packet.swap(m_spare.back());
+				m_spare.pop_back();
+			}
+		}
+
+		packet.resize(HEADER_SIZE + m_compressed.size());
+		uint8_t* h = packet.data();
+		std::memcpy(h, "HUE1", 4);
+		put<uint32_t>(h + 4, m_frame_id++);
+		put<int64_t>(h + 8, capture_us);
+		put<int64_t>(h + 16, 0);
+		put<float>(h + 24, m_codec.depth_min_m());
+		put<float>(h + 28, m_codec.depth_max_m());
+		put<float>(h + 32, m_codec.depth_scale());
+		put<uint32_t>(h + 36, m_codec.m_inverse_colorization ? 1 : 0);
+		std::memset(h + 40, 0, 8);
+		std::memcpy(h + 40, m_options.format.data(), std::min<size_t>(m_options.format.size(), 7));
+		put<uint16_t>(h + 48, depth.cols);
+		put<uint16_t>(h + 50, depth.rows);
+		put<uint32_t>(h + 52, m_compressed.size());
+		std::memcpy(h + HEADER_SIZE, m_compressed.data(), m_compressed.size());
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			while ((int)m_queue.size() >= std::max(1, m_options.queue_depth))
+			{	// Drop the oldest frame rather than fall behind
+				m_spare.push_back(std::move(m_queue.front()));
+				m_queue.pop_front();
+				m_stats.dropped++;
+			}
+			m_queue.push_back(std::move(packet));
+		}
+		m_cv.notify_one();
+		return true;
+	}
+
+	HueStreamStats stats() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_stats;
+	}
+
+	void flush()
+	{	// Wait until every queued frame has been sent
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_cv.wait(lock, [this] { return (m_queue.empty() && !m_sending) || !m_running || m_error; });
+	}
+
+	void close()
+	{	// Stop sending and disconnect. Queued frames are dropped (call flush() first
+		// to send them), and a frame being sent to a stalled receiver is cut short.
+		using namespace hue_stream_detail;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_running = false;
+			m_queue.clear();
+		}
+		m_cv.notify_all();
+		if (m_socket != INVALID) shutdown_socket(m_socket);	// unblocks send_all in the network thread
+		if (m_thread.joinable()) m_thread.join();
+		if (m_socket != INVALID) close_socket(m_socket);
+		m_socket = INVALID;
+	}
+
+	private:
+
+	void run()
+	{	// Network thread
+		using namespace hue_stream_detail;
+		std::vector<uint8_t> packet;
+		std::vector<uint8_t> datagram;
+
+		for (;;)
+		{
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				if (!packet.empty()) m_spare.push_back(std::move(packet));
+				m_sending = false;
+				m_cv.notify_all();
+				m_cv.wait(lock, [this] { return !m_queue.empty() || !m_running; });
+				if (m_queue.empty()) return;	// closed with nothing left to send
+				packet = std::move(m_queue.front());
+				m_queue.pop_front();
+				m_sending = true;
+			}
+
+			put<int64_t>(packet.data() + 16, hue_stream_now_us());
+
+			bool ok = true;
+			if (m_options.transport == HueTransport::TCP) ok = send_all(m_socket, packet.data(), packet.size());
+			else
+			{
+				const size_t chunk = std::max(64, m_options.udp_payload) - FRAGMENT_HEADER_SIZE;
+				const size_t count = (packet.size() + chunk - 1) / chunk;
+				if (count > 65535) ok = false;
+				datagram.resize(FRAGMENT_HEADER_SIZE + chunk);
+				for (size_t k=0; ok && k<count; k++)
+				{
+					size_t n = std::min(chunk, packet.size() - k * chunk);
+					std::memcpy(datagram.data(), "HUEF", 4);
+					std::memcpy(datagram.data() + 4, packet.data() + 4, 4);	// frame id
+					put<uint16_t>(datagram.data() + 8, k);
+					put<uint16_t>(datagram.data() + 10, count);
+					put<uint32_t>(datagram.data() + 12, k * chunk);
+					std::memcpy(datagram.data() + FRAGMENT_HEADER_SIZE, packet.data() + k * chunk, n);
+					// A full socket buffer on a local link is not an error
+					::send(m_socket, (const char*)datagram.data(), (int)(FRAGMENT_HEADER_SIZE + n), SEND_FLAGS);
+				}
+			}
+
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (!ok) m_error = true;
+			else m_stats.add(packet.size(), hue_stream_now_us());
+		}
+	}
+
+	HueCodec m_codec;
+	HueStreamOptions m_options;
+	cv::Mat m_encoded;
+	std::vector<uchar> m_compressed;
+	uint32_t m_frame_id = 0;
+
+	hue_stream_detail::socket_t m_socket = hue_stream_detail::INVALID;
+	std::thread m_thread;
+	mutable std::mutex m_mutex;
+	std::condition_variable m_cv;
+	std::deque<std::vector<uint8_t>> m_queue;
+	std::vector<std::vector<uint8_t>> m_spare;	// packet buffers for reuse
+	HueStreamStats m_stats;
+	bool m_running = false, m_sending = false, m_error = false;
+};
+
+class HueStreamReceiver
+{
+	public:
+
+	explicit HueStreamReceiver(HueTransport transport=HueTransport::TCP)
+	: m_transport(transport)
+	, m_codec(0.0f, 1.0f)
+	{
+	}
+
+	~HueStreamReceiver() { close(); }
+
+	HueStreamReceiver(const HueStreamReceiver&) = delete;
+	HueStreamReceiver& operator=(const HueStreamReceiver&) = delete;
+
+	bool listen(int port, const std::string& address="0.0.0.0")
+	{	// Bind to a port (0 picks a free port, see port()).
+		// With TCP, a sender is accepted by receive().
+		using namespace hue_stream_detail;
+		close();
+		if (!startup()) return false;
+		m_assembling = m_completed = false;
+
+		bool udp = m_transport == HueTransport::UDP;
+		sockaddr_storage addr;
+		socklen_t len;
+		if (!resolve(address, port, udp ? SOCK_DGRAM : SOCK_STREAM, addr, len)) return false;
+
+		m_listen = socket(addr.ss_family, udp ? SOCK_DGRAM : SOCK_STREAM, 0);
+		if (m_listen == INVALID) return false;
+
+		int one = 1;
+		int rcvbuf = 8 << 20;
+		setsockopt(m_listen, SOL_SOCKET, SO_REUSEADDR, (const char*)&one, sizeof(one));
+		setsockopt(m_listen, SOL_SOCKET, SO_RCVBUF, (const char*)&rcvbuf, sizeof(rcvbuf));
+		if (bind(m_listen, (const sockaddr*)&addr, len) != 0 || (!udp && ::listen(m_listen, 1) != 0))
+		{
+			close();
+			return false;
+		}
+
+		sockaddr_storage bound;
+		socklen_t bound_len = sizeof(bound);
+		getsockname(m_listen, (sockaddr*)&bound, &bound_len);
+		m_port = ntohs(bound.ss_family == AF_INET6 ? ((sockaddr_in6*)&bound)->sin6_port : ((sockaddr_in*)&bound)->sin_port);
+		return true;
+	}
+
+	int port() const { return m_port; }
+	const HueStreamStats& stats() const { return m_stats; }
+
+	bool receive(cv::Mat& depth, HueFrameInfo& info, int timeout_ms=1000)
+	{	// Receive, decompress, and decode the next frame.
+		// Returns false if no frame arrived within the timeout.
+		bool ok = (m_transport == HueTransport::TCP) ? receive_tcp(timeout_ms) : receive_udp(timeout_ms);
+		if (!ok) return false;
+		info.receive_us = hue_stream_now_us();
+		return decode(depth, info);
+	}
+
+	void close()
+	{
+		using namespace hue_stream_detail;
+		if (m_peer != INVALID) close_socket(m_peer);
+		if (m_listen != INVALID) close_socket(m_listen);
+		m_peer = m_listen = INVALID;
+	}
+
+	private:
+
+	bool receive_tcp(int timeout_ms)
+	{
+		using namespace hue_stream_detail;
+		if (m_listen == INVALID) return false;
+		if (m_peer == INVALID)
+		{	// Wait for a sender
+			if (poll_socket(m_listen, timeout_ms) <= 0) return false;
+			m_peer = accept(m_listen, nullptr, nullptr);
+			if (m_peer == INVALID) return false;
+			int one = 1;
+			setsockopt(m_peer, IPPROTO_TCP, TCP_NODELAY, (const char*)&one, sizeof(one));
+		}
+
+		m_packet.resize(HEADER_SIZE);
+		if (!recv_all(m_peer, m_packet.data(), HEADER_SIZE, timeout_ms) || std::memcmp(m_packet.data(), "HUE1", 4) != 0)
+		{	// Disconnected (or out of sync), so accept the next sender
+			close_socket(m_peer);
+			m_peer = INVALID;
+			return false;
+		}
+
+		size_t payload = get<uint32_t>(m_packet.data() + 52);
+		if (payload > MAX_PACKET_SIZE - HEADER_SIZE)
+		{	// Corrupt (or hostile) header, so do not allocate for it
+			close_socket(m_peer);
+			m_peer = INVALID;
+			return false;
+		}
+		m_packet.resize(HEADER_SIZE + payload);
+		if (!recv_all(m_peer, m_packet.data() + HEADER_SIZE, payload, std::max(timeout_ms, 1000)))
+		{
+			close_socket(m_peer);
+			m_peer = INVALID;
+			return false;
+		}
+		return true;
+	}
+
+	bool receive_udp(int timeout_ms)
+	{	// Reassemble the fragments of the newest frame
+		using namespace hue_stream_detail;
+		if (m_listen == INVALID) return false;
+		m_datagram.resize(65536);
+
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+		for (;;)
+		{
+			int remaining = (int)std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+			if (remaining < 0 || poll_socket(m_listen, remaining) <= 0) return false;
+
+			int n = ::recv(m_listen, (char*)m_datagram.data(), (int)m_datagram.size(), 0);
+			if (n < (int)FRAGMENT_HEADER_SIZE || std::memcmp(m_datagram.data(), "HUEF", 4) != 0) continue;
+
+			uint32_t id = get<uint32_t>(m_datagram.data() + 4);
+			size_t index = get<uint16_t>(m_datagram.data() + 8);
+			size_t count = get<uint16_t>(m_datagram.data() + 10);
+			size_t offset = get<uint32_t>(m_datagram.data() + 12);
+			size_t chunk = n - FRAGMENT_HEADER_SIZE;
+			if (index >= count || offset + chunk > MAX_PACKET_SIZE) continue;
+
+			// Drop duplicated and late fragments of frames that were already delivered or
+			// passed over. Much older ids are accepted again, as from a restarted sender.
+			int32_t age = (int32_t)(m_completed_id - id);
+			if (m_completed && age >= 0 && age < STALE_FRAMES) continue;
+
+			int32_t ahead = (int32_t)(id - m_udp_id);
+			if (!m_assembling || ahead > 0 || ahead <= -STALE_FRAMES)
+			{	// A newer frame (or one from a restarted sender), so drop the incomplete one
+				if (m_assembling) m_stats.dropped++;
+				m_assembling = true;
+				m_udp_id = id;
+				m_received.assign(count, false);
+				m_fragments = 0;
+				m_udp_size = 0;
+			}
+			if (id != m_udp_id || count != m_received.size() || m_received[index]) continue;
+
+			if (m_packet.size() < offset + chunk) m_packet.resize(offset + chunk);
+			std::memcpy(m_packet.data() + offset, m_datagram.data() + FRAGMENT_HEADER_SIZE, chunk);
+			if (index + 1 == count) m_udp_size = offset + chunk;
+
+			m_received[index] = true;
+			if (++m_fragments == count)
+			{
+				m_assembling = false;
+				m_completed = true;
+				m_completed_id = id;
+				m_packet.resize(m_udp_size);
+				if (m_packet.size() >= HEADER_SIZE && std::memcmp(m_packet.data(), "HUE1", 4) == 0) return true;
+			}
+		}
+	}
+
+	bool decode(cv::Mat& depth, HueFrameInfo& info)
+	{
+		using namespace hue_stream_detail;
+		const uint8_t* h = m_packet.data();
+		size_t payload = get<uint32_t>(h + 52);
+		if (m_packet.size() < HEADER_SIZE + payload) return false;
+
+		info.frame_id   = get<uint32_t>(h + 4);
+		info.capture_us = get<int64_t>(h + 8);
+		info.send_us    = get<int64_t>(h + 16);
+		info.bytes      = m_packet.size();
+
+		float depth_min_m = get<float>(h + 24);
+		float depth_max_m = get<float>(h + 28);
+		float depth_scale = get<float>(h + 32);
+		bool inverse = get<uint32_t>(h + 36) & 1;
+		if (depth_min_m != m_codec.depth_min_m() || depth_max_m != m_codec.depth_max_m() ||
+			depth_scale != m_codec.depth_scale() || inverse != m_codec.m_inverse_colorization)
+		{	// The sender changed its settings
+			m_codec = HueCodec(depth_min_m, depth_max_m, depth_scale, inverse);
+		}
+
+		char format[8] = { 0 };
+		std::memcpy(format, h + 40, 7);
+		int width = get<uint16_t>(h + 48);
+		int height = get<uint16_t>(h + 50);
+
+		if (format[0] == 0)
+		{	// Raw hue-encoded BGR
+			if (payload != (size_t)width * height * 3) return false;
+			m_encoded = cv::Mat(height, width, CV_8UC3, m_packet.data() + HEADER_SIZE);
+		}
+		else
+		{
+			cv::Mat buffer(1, (int)payload, CV_8U, m_packet.data() + HEADER_SIZE);
+			m_encoded = cv::imdecode(buffer, cv::IMREAD_COLOR);
+			if (m_encoded.empty()) return false;
+		}
+
+		m_codec.decode(m_encoded, depth);
+		info.decode_us = hue_stream_now_us();
+		m_stats.add(info.bytes, info.decode_us, info.latency_ms());
+		return true;
+	}
+
+	HueTransport m_transport;
+	HueCodec m_codec;
+	cv::Mat m_encoded;
+	std::vector<uint8_t> m_packet, m_datagram;
+	HueStreamStats m_stats;
+	int m_port = 0;
+
+	hue_stream_detail::socket_t m_listen = hue_stream_detail::INVALID;
+	hue_stream_detail::socket_t m_peer = hue_stream_detail::INVALID;
+
+	// UDP reassembly state
+	bool m_assembling = false, m_completed = false;
+	uint32_t m_udp_id = 0, m_completed_id = 0;
+	std::vector<bool> m_received;
+	size_t m_fragments = 0, m_udp_size = 0;
+};
@@ -0,0 +1,173 @@
+#pragma once
+#include <opencv2/opencv.hpp>   // Include OpenCV API
+#include <hue_codec.h>          // The header-only hue codec
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Row-strip streaming encoding and decoding
+//
+// HueStripEncoder and HueStripDecoder take a frame a few rows at a time (e.g. as
+// strips arrive from a sensor's DMA) and pass the encoded or decoded rows to a
+// callback, so neither side has to hold a whole frame:
+//
+//     HueStripEncoder encoder(codec, frame_size, [&](int row, const cv::Mat& rows)
+//     {	// rows is CV_8UC3 and starts at frame row 'row'
+//     });
+//     encoder.push(depth_strip);                  // any number of rows at a time
+//
+//     HueStripDecoder decoder(codec, frame_size, [&](int row, const cv::Mat& rows)
+//     {	// rows is CV_16U depth
+//     }, 1, 0.02f);                               // optional median filter
+//     decoder.push(hue_strip);
+//
+// The rows passed to the callback are only valid during the call. Strips may have
+// any height but must not cross the end of a frame, and the next frame starts
+// after the last row of a frame has been pushed.
+//
+// The decoder's median filter gives the same result as median_filter on the
+// whole frame. It keeps the last 2*kernel_size+1 decoded rows, so rows are
+// passed on kernel_size rows after they are pushed (the last rows of a frame with
+// the last strip). Memory use is those rows plus one output strip.
+
+class HueStripEncoder
+{
+	public:
+
+	typedef std::function<void(int row, const cv::Mat& rows)> Output;
+
+	HueStripEncoder(const HueCodec& codec, cv::Size frame_size, Output output)
+	: m_codec(codec)
+	, m_frame_size(frame_size)
+	, m_output(output)
+	, m_row(0)
+	{
+	}
+
+	int row() const { return m_row; }	// the frame row of the next strip
+	void reset() { m_row = 0; }			// drop the rest of the current frame
+
+	bool push(const cv::Mat& strip)
+	{	// Encode a strip of CV_16U (depth_scale units) or CV_32F (metres) depth.
+		// Returns false, and ignores the strip, if it has the wrong width or type or
+		// would cross the end of the frame.
+		if (strip.type() != CV_16U && strip.type() != CV_32F) return false;
+		if (strip.cols != m_frame_size.width || m_row + strip.rows > m_frame_size.height) return false;
+		if (strip.rows == 0) return true;
+
+		m_codec.encode(strip, m_encoded);	// reuses the buffer of the previous strip
+		m_output(m_row, m_encoded);
+
+		m_row += strip.rows;
+		if (m_row == m_frame_size.height) m_row = 0;
+		return true;
+	}
+
+	private:
+
+	HueCodec m_codec;
+	cv::Size m_frame_size;
+	Output m_output;
+	cv::Mat m_encoded;
+	int m_row;
+};
+
+
+class HueStripDecoder
+{
+	public:
+
+	typedef std::function<void(int row, const cv::Mat& rows)> Output;
+
+	HueStripDecoder(const HueCodec& codec, cv::Size frame_size, Output output, int kernel_size=0, float diff_threshold=0.0f)
+	: m_codec(codec)
+	, m_frame_size(frame_size)
+	, m_output(output)
+	, m_kernel_size(std::max(0, kernel_size))
+	, m_diff_threshold(diff_threshold)
+	, m_row(0)
+	, m_next(0)
+	{
+		if (m_kernel_size > 0)
+		{
+			m_ring.create(2*m_kernel_size + 1, frame_size.width, CV_16U);
+			m_rows.resize(2*m_kernel_size + 1);
+		}
+	}
+
+	int row() const { return m_row; }	// the frame row of the next strip
+	void reset() { m_row = m_next = 0; }	// drop the rest of the current frame
+
+	bool push(const cv::Mat& strip)
+	{	// Decode a strip of hue-encoded CV_8UC3 rows to CV_16U depth. Returns false,
+		// and ignores the strip, if it has the wrong width or type or would cross
+		// the end of the frame.
+		if (strip.type() != CV_8UC3) return false;
+		if (strip.cols != m_frame_size.width || m_row + strip.rows > m_frame_size.height) return false;
+		if (strip.rows == 0) return true;
+
+		if (m_kernel_size == 0)
+		{
+			m_codec.decode(strip, m_out);
+			m_output(m_row, m_out);
+			m_row += strip.rows;
+			if (m_row == m_frame_size.height) reset();
+			return true;
+		}
+
+		// Up to kernel_size rows held back from earlier strips come out with this one
+		if (m_out.rows < strip.rows + m_kernel_size || m_out.cols != strip.cols || m_out.type() != CV_16U)
+		{
+			m_out.create(strip.rows + m_kernel_size, strip.cols, CV_16U);
+		}
+
+		const int first = m_next;
+		int n = 0;
+		for (int i=0; i<strip.rows; i++)
+		{
+			cv::Mat slot = m_ring.row(m_row % m_ring.rows);
+			m_codec.decode(strip.row(i), slot);	// writes into the ring
+			n += filter_rows(m_row++, n);
+		}
+
+		if (n > 0) m_output(first, m_out.rowRange(0, n));
+		if (m_row == m_frame_size.height) reset();
+		return true;
+	}
+
+	private:
+
+	int filter_rows(int last, int n)
+	{	// Filter the rows that are complete once row 'last' is decoded into m_out
+		// from row n on, and return how many there were. Rows within kernel_size of
+		// the top or bottom of the frame are zero, as with median_filter.
+		const int k = m_kernel_size, height = m_frame_size.height;
+		const int start = n;
+		for (; m_next < height && (m_next + k <= last || last == height - 1); m_next++, n++)
+		{
+			uint16_t* out = m_out.ptr<uint16_t>(n);
+			if (m_next < k || m_next >= height - k)
+			{
+				std::fill(out, out + m_out.cols, 0);
+				continue;
+			}
+
+			for (int y=0; y<2*k+1; y++) m_rows[y] = m_ring.ptr<uint16_t>((m_next - k + y) % m_ring.rows);
+			median_filter_row(m_rows.data(), out, m_out.cols, k, m_diff_threshold, nullptr, m_kernel);
+		}
+		return n - start;
+	}
+
+	HueCodec m_codec;
+	cv::Size m_frame_size;
+	Output m_output;
+	int m_kernel_size;
+	float m_diff_threshold;
+
+	cv::Mat m_ring;	// the last 2*kernel_size+1 decoded rows, row r at r % (2*kernel_size+1)
+	cv::Mat m_out;
+	std::vector<const uint16_t*> m_rows;
+	std::vector<uint16_t> m_kernel;
+	int m_row, m_next;	// next row to decode and to pass on
+};
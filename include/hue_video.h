@@ -0,0 +1,531 @@
+#pragma once
+#include <opencv2/opencv.hpp>   // Include OpenCV API
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <string>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/opt.h>
+#include <libavutil/pixdesc.h>
+#include <libswscale/swscale.h>
+}
+
+// Native hue video writer and reader (requires the FFmpeg libraries)
+//
+// cv::VideoWriter and cv::VideoCapture hide the encoder settings and always
+// convert frames to and from BGR. HueVideoWriter and HueVideoReader talk to
+// libavformat/libavcodec directly, so that hue-encoded streams can use:
+//
+//   - any encoder option (preset, tune, CRF, GOP, B-frames, thread count),
+//   - low-latency settings (tune=zerolatency, slice threads, no B-frames),
+//   - lossless RGB encoders (libx264rgb with QP 0, FFV1, x265 lossless),
+//   - 10, 12, and 16-bit frames from HueCodecHB.
+//
+// Frames are passed to the encoder without colour conversion whenever the
+// encoder accepts RGB input (e.g. bgr24 for libx264rgb, gbrp10 for FFV1 and x265).
+// Otherwise they are converted with libswscale: losslessly to another RGB format
+// of the same bit depth if the encoder has one (e.g. bgr0 for 8-bit FFV1), or
+// else to the encoder's default format (e.g. yuv420p for libx264), which
+// averages the chroma of neighbouring pixels and so loses hue precision.
+//
+// CV_8UC3 frames are 8-bit BGR. CV_16UC3 frames are BGR with channel values
+// in 0 to 2^bits-1, as produced by HueCodecHB.
+
+struct HueVideoOptions
+{
+	std::string codec = "libx264";	// encoder name, e.g. libx264, libx264rgb, libx265, ffv1, libvpx-vp9
+	std::string preset;				// encoder preset, e.g. ultrafast ... veryslow (x264/x265)
+	std::string tune;				// encoder tune, e.g. zerolatency (x264/x265)
+	std::string pixel_format;		// force an encoder pixel format, e.g. yuv444p (empty: choose automatically)
+	int crf = -1;					// constant rate factor (-1: encoder default)
+	int gop = 0;					// keyframe interval in frames (0: encoder default)
+	int max_b_frames = -1;			// maximum consecutive B-frames (-1: encoder default)
+	int threads = 0;				// encoder threads (0: automatic)
+	bool slice_threads = false;		// slice threading only (lower latency than frame threading)
+	bool lossless = false;			// lossless mode for x264, x265, and VP9 (FFV1 is always lossless)
+	int bits = 8;					// bits per channel of CV_16UC3 frames (10, 12, or 16)
+	double fps = 30.0;
+	std::map<std::string, std::string> extra;	// further encoder private options
+
+	static HueVideoOptions low_latency(const std::string& codec="libx264", int crf=23)
+	{	// No frame reordering or lookahead, and each frame is split into slices
+		HueVideoOptions o;
+		o.codec = codec;
+		o.preset = "veryfast";
+		o.tune = "zerolatency";
+		o.crf = crf;
+		o.max_b_frames = 0;
+		o.slice_threads = true;
+		return o;
+	}
+
+	static HueVideoOptions lossless_rgb(const std::string& codec="libx264rgb")
+	{	// Lossless without colour conversion (libx264rgb, ffv1, or libx265)
+		HueVideoOptions o;
+		o.codec = codec;
+		o.preset = "ultrafast";
+		o.lossless = true;
+		return o;
+	}
+};
+
+namespace hue_video_detail
+{
+	inline bool is_planar_rgb(AVPixelFormat f)
+	{
+		return f == AV_PIX_FMT_GBRP || f == AV_PIX_FMT_GBRP10 || f == AV_PIX_FMT_GBRP12 || f == AV_PIX_FMT_GBRP16;
+	}
+
+	inline int pixel_bits(AVPixelFormat f)
+	{
+		const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(f);
+		return desc ? desc->comp[0].depth : 0;
+	}
+
+	inline bool is_full_rgb(AVPixelFormat f, int bits)
+	{	// Integer RGB without subsampling and with the given bits per channel
+		const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(f);
+		return desc && (desc->flags & AV_PIX_FMT_FLAG_RGB) && !(desc->flags & AV_PIX_FMT_FLAG_FLOAT)
+		    && desc->nb_components >= 3 && desc->log2_chroma_w == 0 && desc->log2_chroma_h == 0 && desc->comp[0].depth == bits;
+	}
+
+	inline AVPixelFormat rgb_format(int bits, bool planar)
+	{	// The RGB format that stores CV_8UC3 or CV_16UC3 frames with the given bits without conversion
+		if (bits <= 8)  return planar ? AV_PIX_FMT_GBRP   : AV_PIX_FMT_BGR24;
+		if (bits <= 10) return AV_PIX_FMT_GBRP10;
+		if (bits <= 12) return AV_PIX_FMT_GBRP12;
+		return planar ? AV_PIX_FMT_GBRP16 : AV_PIX_FMT_BGR48;
+	}
+
+	template <typename T>
+	void to_planes(const cv::Mat& src, AVFrame* frame)
+	{	// Interleaved BGR to planar G, B, R
+		for (int i=0; i<src.rows; i++)
+		{
+			const T* in = src.ptr<T>(i);
+			T* g = (T*)(frame->data[0] + i * frame->linesize[0]);
+			T* b = (T*)(frame->data[1] + i * frame->linesize[1]);
+			T* r = (T*)(frame->data[2] + i * frame->linesize[2]);
+			for (int j=0; j<src.cols; j++)
+			{
+				b[j] = in[3*j+0];
+				g[j] = in[3*j+1];
+				r[j] = in[3*j+2];
+			}
+		}
+	}
+
+	template <typename T>
+	void from_planes(const AVFrame* frame, cv::Mat& dst)
+	{	// Planar G, B, R to interleaved BGR
+		for (int i=0; i<dst.rows; i++)
+		{
+			const T* g = (const T*)(frame->data[0] + i * frame->linesize[0]);
+			const T* b = (const T*)(frame->data[1] + i * frame->linesize[1]);
+			const T* r = (const T*)(frame->data[2] + i * frame->linesize[2]);
+			T* out = dst.ptr<T>(i);
+			for (int j=0; j<dst.cols; j++)
+			{
+				out[3*j+0] = b[j];
+				out[3*j+1] = g[j];
+				out[3*j+2] = r[j];
+			}
+		}
+	}
+
+	inline void copy_packed(const cv::Mat& src, uint8_t* data, int linesize)
+	{
+		for (int i=0; i<src.rows; i++) std::memcpy(data + i * linesize, src.ptr(i), src.cols * src.elemSize());
+	}
+
+	inline void copy_packed(const uint8_t* data, int linesize, cv::Mat& dst)
+	{
+		for (int i=0; i<dst.rows; i++) std::memcpy(dst.ptr(i), data + i * linesize, dst.cols * dst.elemSize());
+	}
+
+	inline const AVPixelFormat* supported_formats(const AVCodecContext* ctx, const AVCodec* codec)
+	{
+#if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(61, 13, 100)
+		const void* formats = nullptr;
+		if (avcodec_get_supported_config(ctx, codec, AV_CODEC_CONFIG_PIX_FORMAT, 0, &formats, nullptr) < 0) return nullptr;
+		return (const AVPixelFormat*)formats;
+#else
+		(void)ctx;
+		return codec->pix_fmts;
+#endif
+	}
+}
+
+class HueVideoWriter
+{
+	public:
+
+	HueVideoWriter() {}
+	~HueVideoWriter() { close(); }
+
+	HueVideoWriter(const HueVideoWriter&) = delete;
+	HueVideoWriter& operator=(const HueVideoWriter&) = delete;
+
+	bool open(const std::string& path, cv::Size size, int type=CV_8UC3, const HueVideoOptions& options=HueVideoOptions())
+	{	// Open a video file for writing. The container is chosen from the file extension.
+		// Returns false if the container, encoder, or options are not supported.
+		using namespace hue_video_detail;
+		close();
+		if (type != CV_8UC3 && type != CV_16UC3) return false;
+
+		m_size = size;
+		m_type = type;
+		const int bits = (type == CV_8UC3) ? 8 : options.bits;
+
+		const AVCodec* codec = avcodec_find_encoder_by_name(options.codec.c_str());
+		if (!codec) return false;
+		if (avformat_alloc_output_context2(&m_format, nullptr, nullptr, path.c_str()) < 0 || !m_format) return fail();
+
+		m_stream = avformat_new_stream(m_format, nullptr);
+		m_codec = avcodec_alloc_context3(codec);
+		if (!m_stream || !m_codec) return fail();
+
+		AVRational fps = av_d2q(options.fps, 100000);
+		m_codec->width = size.width;
+		m_codec->height = size.height;
+		m_codec->time_base = av_inv_q(fps);
+		m_codec->framerate = fps;
+		m_codec->thread_count = options.threads;
+		m_codec->thread_type = options.slice_threads ? FF_THREAD_SLICE : (FF_THREAD_FRAME | FF_THREAD_SLICE);
+		if (options.gop > 0) m_codec->gop_size = options.gop;
+		if (options.max_b_frames >= 0) m_codec->max_b_frames = options.max_b_frames;
+		if (m_format->oformat->flags & AVFMT_GLOBALHEADER) m_codec->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+
+		// Pass frames through unchanged if the encoder accepts RGB, otherwise use its first format
+		m_src_format = rgb_format(bits, false);
+		m_codec->pix_fmt = choose_format(codec, options.pixel_format, bits);
+		if (m_codec->pix_fmt == AV_PIX_FMT_NONE) return fail();
+		if (m_codec->pix_fmt == rgb_format(bits, true)) m_src_format = m_codec->pix_fmt;
+
+		AVDictionary* opts = nullptr;
+		if (!options.preset.empty()) av_dict_set(&opts, "preset", options.preset.c_str(), 0);
+		if (!options.tune.empty())   av_dict_set(&opts, "tune", options.tune.c_str(), 0);
+		if (options.lossless)
+		{
+			if      (options.codec == "libx265")   av_dict_set(&opts, "x265-params", "lossless=1", 0);
+			else if (options.codec == "libvpx-vp9") av_dict_set(&opts, "lossless", "1", 0);
+			else if (options.codec != "ffv1")      av_dict_set(&opts, "qp", "0", 0);
+		}
+		else if (options.crf >= 0) av_dict_set_int(&opts, "crf", options.crf, 0);
+		for (const auto& kv : options.extra) av_dict_set(&opts, kv.first.c_str(), kv.second.c_str(), 0);
+
+		int ret = avcodec_open2(m_codec, codec, &opts);
+		av_dict_free(&opts);
+		if (ret < 0) return fail();
+
+		if (avcodec_parameters_from_context(m_stream->codecpar, m_codec) < 0) return fail();
+		m_stream->time_base = m_codec->time_base;
+
+		if (!(m_format->oformat->flags & AVFMT_NOFILE) && avio_open(&m_format->pb, path.c_str(), AVIO_FLAG_WRITE) < 0) return fail();
+		if (avformat_write_header(m_format, nullptr) < 0) return fail();
+		m_header_written = true;
+
+		m_frame = av_frame_alloc();
+		m_packet = av_packet_alloc();
+		if (!m_frame || !m_packet) return fail();
+		m_frame->format = m_codec->pix_fmt;
+		m_frame->width = size.width;
+		m_frame->height = size.height;
+		if (av_frame_get_buffer(m_frame, 0) < 0) return fail();
+
+		if (m_src_format != m_codec->pix_fmt)
+		{	// Area averaging for chroma subsampling
+			m_sws = sws_getContext(size.width, size.height, m_src_format, size.width, size.height, m_codec->pix_fmt,
+			                       SWS_AREA | SWS_ACCURATE_RND, nullptr, nullptr, nullptr);
+			if (!m_sws) return fail();
+		}
+
+		m_pts = 0;
+		return true;
+	}
+
+	bool is_open() const { return m_header_written; }
+	bool native() const { return m_codec && !m_sws; }	// true if frames are encoded without colour conversion
+	std::string pixel_format() const { return m_codec ? av_get_pix_fmt_name(m_codec->pix_fmt) : ""; }
+
+	bool write(const cv::Mat& frame)
+	{	// Encode and write one hue-encoded frame of the size and type given to open
+		using namespace hue_video_detail;
+		if (!is_open() || frame.size() != m_size || frame.type() != m_type) return false;
+		if (av_frame_make_writable(m_frame) < 0) return false;
+
+		if (m_sws)
+		{
+			if (is_planar_rgb(m_src_format))
+			{	// libswscale does not read interleaved 10 and 12-bit RGB
+				if (!m_planar) m_planar = alloc_frame(m_src_format);
+				if (!m_planar || av_frame_make_writable(m_planar) < 0) return false;
+				to_planes<uint16_t>(frame, m_planar);
+				sws_scale(m_sws, m_planar->data, m_planar->linesize, 0, m_size.height, m_frame->data, m_frame->linesize);
+			}
+			else
+			{
+				const uint8_t* src[4] = { frame.data, nullptr, nullptr, nullptr };
+				int stride[4] = { (int)frame.step[0], 0, 0, 0 };
+				sws_scale(m_sws, src, stride, 0, m_size.height, m_frame->data, m_frame->linesize);
+			}
+		}
+		else if (is_planar_rgb(m_src_format))
+		{
+			if (m_type == CV_8UC3) to_planes<uint8_t>(frame, m_frame);
+			else                   to_planes<uint16_t>(frame, m_frame);
+		}
+		else copy_packed(frame, m_frame->data[0], m_frame->linesize[0]);
+
+		m_frame->pts = m_pts++;
+		return encode(m_frame);
+	}
+
+	void close()
+	{	// Flush the encoder and finish the file
+		if (m_header_written)
+		{
+			encode(nullptr);
+			av_write_trailer(m_format);
+		}
+		if (m_format && !(m_format->oformat->flags & AVFMT_NOFILE)) avio_closep(&m_format->pb);
+
+		sws_freeContext(m_sws);
+		av_frame_free(&m_planar);
+		av_frame_free(&m_frame);
+		av_packet_free(&m_packet);
+		avcodec_free_context(&m_codec);
+		avformat_free_context(m_format);
+
+		m_sws = nullptr;
+		m_format = nullptr;
+		m_stream = nullptr;
+		m_header_written = false;
+	}
+
+	private:
+
+	AVPixelFormat choose_format(const AVCodec* codec, const std::string& name, int bits) const
+	{
+		using namespace hue_video_detail;
+		if (!name.empty()) return av_get_pix_fmt(name.c_str());
+
+		const AVPixelFormat* formats = supported_formats(m_codec, codec);
+		if (!formats) return rgb_format(bits, false);	// the encoder accepts anything
+
+		for (AVPixelFormat wanted : { rgb_format(bits, false), rgb_format(bits, true) })
+		{
+			for (const AVPixelFormat* f = formats; *f != AV_PIX_FMT_NONE; f++)
+			{
+				if (*f == wanted) return wanted;
+			}
+		}
+		for (const AVPixelFormat* f = formats; *f != AV_PIX_FMT_NONE; f++)
+		{	// Another RGB layout, which libswscale converts to without loss
+			if (is_full_rgb(*f, bits)) return *f;
+		}
+		return formats[0];
+	}
+
+	AVFrame* alloc_frame(AVPixelFormat format) const
+	{
+		AVFrame* f = av_frame_alloc();
+		if (!f) return nullptr;
+		f->format = format;
+		f->width = m_size.width;
+		f->height = m_size.height;
+		if (av_frame_get_buffer(f, 0) < 0) av_frame_free(&f);
+		return f;
+	}
+
+	bool encode(AVFrame* frame)
+	{	// Send a frame (or nullptr to flush) and write all packets that are ready
+		if (avcodec_send_frame(m_codec, frame) < 0) return false;
+		for (;;)
+		{
+			int ret = avcodec_receive_packet(m_codec, m_packet);
+			if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) return true;
+			if (ret < 0) return false;
+
+			av_packet_rescale_ts(m_packet, m_codec->time_base, m_stream->time_base);
+			m_packet->stream_index = m_stream->index;
+			if (av_interleaved_write_frame(m_format, m_packet) < 0) return false;
+		}
+	}
+
+	bool fail()
+	{
+		close();
+		return false;
+	}
+
+	cv::Size m_size;
+	int m_type = CV_8UC3;
+	AVPixelFormat m_src_format = AV_PIX_FMT_BGR24;
+	int64_t m_pts = 0;
+	bool m_header_written = false;
+
+	AVFormatContext* m_format = nullptr;
+	AVStream* m_stream = nullptr;
+	AVCodecContext* m_codec = nullptr;
+	AVFrame* m_frame = nullptr;
+	AVFrame* m_planar = nullptr;
+	AVPacket* m_packet = nullptr;
+	SwsContext* m_sws = nullptr;
+};
+
+class HueVideoReader
+{
+	public:
+
+	HueVideoReader() {}
+	~HueVideoReader() { close(); }
+
+	HueVideoReader(const HueVideoReader&) = delete;
+	HueVideoReader& operator=(const HueVideoReader&) = delete;
+
+	bool open(const std::string& path, int threads=0, bool slice_threads=false)
+	{	// Open the first video stream of a file for reading
+		close();
+		if (avformat_open_input(&m_format, path.c_str(), nullptr, nullptr) < 0) return fail();
+		if (avformat_find_stream_info(m_format, nullptr) < 0) return fail();
+
+		m_stream = av_find_best_stream(m_format, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+		if (m_stream < 0) return fail();
+
+		const AVCodecParameters* par = m_format->streams[m_stream]->codecpar;
+		const AVCodec* codec = avcodec_find_decoder(par->codec_id);
+		m_codec = codec ? avcodec_alloc_context3(codec) : nullptr;
+		if (!m_codec || avcodec_parameters_to_context(m_codec, par) < 0) return fail();
+
+		m_codec->thread_count = threads;
+		m_codec->thread_type = slice_threads ? FF_THREAD_SLICE : (FF_THREAD_FRAME | FF_THREAD_SLICE);
+		if (avcodec_open2(m_codec, codec, nullptr) < 0) return fail();
+
+		m_frame = av_frame_alloc();
+		m_packet = av_packet_alloc();
+		if (!m_frame || !m_packet) return fail();
+
+		m_flushing = false;
+		return true;
+	}
+
+	bool is_open() const { return m_codec != nullptr; }
+	cv::Size size() const { return m_codec ? cv::Size(m_codec->width, m_codec->height) : cv::Size(); }
+	double fps() const { return m_format ? av_q2d(m_format->streams[m_stream]->avg_frame_rate) : 0.0; }
+	std::string codec_name() const { return m_codec ? m_codec->codec->name : ""; }
+	std::string pixel_format() const { return m_codec ? av_get_pix_fmt_name(m_codec->pix_fmt) : ""; }
+
+	bool read(cv::Mat& frame)
+	{	// Read and decode the next frame. Streams with more than 8 bits per channel are
+		// returned as CV_16UC3 with their original range (e.g. 0 to 1023 for 10 bits),
+		// and all others as CV_8UC3. Returns false at the end of the stream.
+		if (!is_open()) return false;
+		for (;;)
+		{
+			int ret = avcodec_receive_frame(m_codec, m_frame);
+			if (ret == 0)
+			{
+				bool ok = convert(frame);
+				av_frame_unref(m_frame);
+				return ok;
+			}
+			if (ret != AVERROR(EAGAIN)) return false;	// end of stream or error
+
+			if (av_read_frame(m_format, m_packet) < 0)
+			{	// End of file, so drain the decoder
+				if (m_flushing) return false;
+				avcodec_send_packet(m_codec, nullptr);
+				m_flushing = true;
+				continue;
+			}
+			if (m_packet->stream_index == m_stream) avcodec_send_packet(m_codec, m_packet);
+			av_packet_unref(m_packet);
+		}
+	}
+
+	void close()
+	{
+		sws_freeContext(m_sws);
+		av_frame_free(&m_planar);
+		av_frame_free(&m_frame);
+		av_packet_free(&m_packet);
+		avcodec_free_context(&m_codec);
+		avformat_close_input(&m_format);
+		m_sws = nullptr;
+		m_stream = -1;
+	}
+
+	private:
+
+	bool convert(cv::Mat& dst)
+	{
+		using namespace hue_video_detail;
+		AVPixelFormat format = (AVPixelFormat)m_frame->format;
+		const int bits = pixel_bits(format);
+		const int w = m_frame->width, h = m_frame->height;
+
+		dst.create(h, w, bits > 8 ? CV_16UC3 : CV_8UC3);
+		AVPixelFormat packed = rgb_format(bits, false);
+		AVPixelFormat planar = rgb_format(bits, true);
+
+		if (format == packed && !is_planar_rgb(packed))
+		{
+			copy_packed(m_frame->data[0], m_frame->linesize[0], dst);
+			return true;
+		}
+		if (format == planar)
+		{
+			if (bits > 8) from_planes<uint16_t>(m_frame, dst);
+			else          from_planes<uint8_t>(m_frame, dst);
+			return true;
+		}
+
+		// Convert anything else (e.g. YUV) to RGB of the same bit depth
+		AVPixelFormat target = (bits > 8 && bits <= 12) ? planar : packed;
+		m_sws = sws_getCachedContext(m_sws, w, h, format, w, h, target, SWS_BILINEAR | SWS_ACCURATE_RND, nullptr, nullptr, nullptr);
+		if (!m_sws) return false;
+
+		if (is_planar_rgb(target))
+		{
+			if (!m_planar || m_planar->width != w || m_planar->height != h)
+			{
+				av_frame_free(&m_planar);
+				m_planar = av_frame_alloc();
+				if (!m_planar) return false;
+				m_planar->format = target;
+				m_planar->width = w;
+				m_planar->height = h;
+				if (av_frame_get_buffer(m_planar, 0) < 0) return false;
+			}
+			sws_scale(m_sws, m_frame->data, m_frame->linesize, 0, h, m_planar->data, m_planar->linesize);
+			from_planes<uint16_t>(m_planar, dst);
+		}
+		else
+		{
+			uint8_t* out[4] = { dst.data, nullptr, nullptr, nullptr };
+			int stride[4] = { (int)dst.step[0], 0, 0, 0 };
+			sws_scale(m_sws, m_frame->data, m_frame->linesize, 0, h, out, stride);
+		}
+		return true;
+	}
+
+	bool fail()
+	{
+		close();
+		return false;
+	}
+
+	AVFormatContext* m_format = nullptr;
+	AVCodecContext* m_codec = nullptr;
+	AVFrame* m_frame = nullptr;
+	AVFrame* m_planar = nullptr;
+	AVPacket* m_packet = nullptr;
+	SwsContext* m_sws = nullptr;
+	int m_stream = -1;
+	bool m_flushing = false;
+};
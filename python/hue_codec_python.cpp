@@ -0,0 +1,218 @@
+#include <hue_codec.h>	      	// The header-only hue codec
+#include <pybind11/pybind11.h>	// Python bindings
+#include <pybind11/numpy.h>		// NumPy arrays through the buffer protocol
+#include <vector>
+
+// Python bindings for HueCodec and median_filter
+//
+//     import numpy as np
+//     import hue_codec
+//
+//     codec = hue_codec.HueCodec(0.3, 6.0)
+//     encoded = codec.encode(depth)                        # (H, W) uint16 -> (H, W, 3) uint8 BGR
+//     decoded = codec.decode(encoded)                      # (H, W, 3) uint8 -> (H, W) uint16
+//     metres  = codec.decode(encoded, dtype=np.float32)    # depth in metres
+//     cleaned = hue_codec.median_filter(decoded, kernel_size=1, diff_threshold=0.02)
+//
+// Arrays are used in place: C-contiguous inputs are not copied, and the outputs
+// are written directly into new NumPy arrays (or into out= arrays, to reuse
+// buffers between calls). The GIL is released while frames are processed, so
+// calls from several Python threads run in parallel.
+//
+// Stacked frames, i.e. (N, H, W) depth or (N, H, W, 3) encoded arrays, are
+// processed in one call, with the frames spread over OpenCV's worker threads.
+// A depth array shaped (A, B, 3) is refused as a likely BGR image passed as
+// depth, so stacks of depth frames 3 pixels wide must be passed frame by frame.
+
+namespace py = pybind11;
+
+namespace
+{
+	struct Frames
+	{	// A single frame (H, W[, C]) or a stack of frames (N, H, W[, C])
+		py::ssize_t count = 1, rows = 0, cols = 0;
+		bool stacked = false;
+
+		std::vector<py::ssize_t> shape(int channels) const
+		{
+			std::vector<py::ssize_t> s;
+			if (stacked) s.push_back(count);
+			s.push_back(rows);
+			s.push_back(cols);
+			if (channels > 1) s.push_back(channels);
+			return s;
+		}
+
+		cv::Mat mat(uchar* base, py::ssize_t k, int type) const
+		{	// Mat header for frame k of a C-contiguous array (no copy)
+			return cv::Mat((int)rows, (int)cols, type, base + k * rows * cols * CV_ELEM_SIZE(type));
+		}
+	};
+
+	Frames frames_of(const py::array& a, int channels)
+	{
+		int frame_dims = channels > 1 ? 3 : 2;
+		if (a.ndim() != frame_dims && a.ndim() != frame_dims + 1)
+		{
+			throw py::value_error(channels > 1 ? "expected an (H, W, 3) or (N, H, W, 3) array" : "expected an (H, W) or (N, H, W) array");
+		}
+		if (channels > 1 && a.shape(a.ndim() - 1) != channels)
+		{
+			throw py::value_error("expected 3 channels (BGR) in the last dimension");
+		}
+		if (channels == 1 && a.ndim() == 3 && a.shape(2) == 3)
+		{	// Would otherwise be read as a stack of H frames of (W, 3) depth, so an
+			// (N, H, 3) stack of depth frames 3 pixels wide is refused as well
+			throw py::value_error("expected single-channel depth, not an (H, W, 3) image "
+				"(pass depth frames 3 pixels wide one at a time)");
+		}
+
+		Frames f;
+		f.stacked = a.ndim() == frame_dims + 1;
+		f.count = f.stacked ? a.shape(0) : 1;
+		f.rows = a.shape(f.stacked ? 1 : 0);
+		f.cols = a.shape(f.stacked ? 2 : 1);
+		return f;
+	}
+
+	py::array contiguous(const py::array& a)
+	{	// The array itself if it is C-contiguous, otherwise a C-contiguous copy
+		return py::array::ensure(a, py::array::c_style);
+	}
+
+	py::array output_array(const py::object& out, const py::dtype& dtype, const std::vector<py::ssize_t>& shape)
+	{	// Use out if given (it must match exactly), otherwise allocate a new array
+		if (out.is_none()) return py::array(dtype, shape);
+
+		if (!py::isinstance<py::array>(out)) throw py::type_error("out must be a NumPy array");
+		py::array a = py::reinterpret_borrow<py::array>(out);
+		bool match = a.dtype().kind() == dtype.kind() && a.itemsize() == dtype.itemsize() && a.ndim() == (py::ssize_t)shape.size();
+		for (size_t i=0; match && i<shape.size(); i++) match = a.shape(i) == shape[i];
+		if (!match) throw py::value_error("out has the wrong shape or dtype");
+		if (!(a.flags() & py::array::c_style) || !a.writeable()) throw py::value_error("out must be C-contiguous and writeable");
+		return a;
+	}
+
+	uchar* data_of(const py::array& a)
+	{
+		return (uchar*)const_cast<void*>(a.data());
+	}
+
+	template <typename F>
+	void for_each_frame(const Frames& f, F process)
+	{	// Process every frame without holding the GIL
+		py::gil_scoped_release release;
+		if (f.count == 1)
+		{
+			process(0);
+			return;
+		}
+		cv::parallel_for_(cv::Range(0, (int)f.count), [&](const cv::Range& range)
+		{
+			for (int k=range.start; k<range.end; k++) process(k);
+		});
+	}
+
+	void write_back(const cv::Mat& result, cv::Mat& target)
+	{	// Copy the result into the output array if the function returned a different buffer
+		// (e.g. when filtering in place)
+		if (result.data != target.data) result.copyTo(target);
+	}
+
+	py::array encode(const HueCodec& codec, const py::array& depth, const py::object& out)
+	{
+		int type;
+		if      (py::isinstance<py::array_t<uint16_t>>(depth)) type = CV_16U;
+		else if (py::isinstance<py::array_t<float>>(depth))    type = CV_32F;
+		else throw py::type_error("depth must be uint16 (depth_scale units) or float32 (metres)");
+
+		py::array src = contiguous(depth);
+		Frames f = frames_of(src, 1);
+		py::array dst = output_array(out, py::dtype::of<uint8_t>(), f.shape(3));
+
+		uchar* s = data_of(src);
+		uchar* d = data_of(dst);
+		for_each_frame(f, [&](py::ssize_t k)
+		{
+			cv::Mat target = f.mat(d, k, CV_8UC3), result = target;
+			codec.encode(f.mat(s, k, type), result);
+			write_back(result, target);
+		});
+		return dst;
+	}
+
+	py::array decode(const HueCodec& codec, const py::array& encoded, const py::object& dtype, const py::object& out)
+	{
+		if (!py::isinstance<py::array_t<uint8_t>>(encoded)) throw py::type_error("encoded must be uint8");
+		py::dtype output_dtype = py::dtype::from_args(dtype);
+		int type;
+		if      (output_dtype.kind() == 'u' && output_dtype.itemsize() == 2) type = CV_16U;
+		else if (output_dtype.kind() == 'f' && output_dtype.itemsize() == 4) type = CV_32F;
+		else throw py::type_error("dtype must be uint16 (depth_scale units) or float32 (metres)");
+
+		py::array src = contiguous(encoded);
+		Frames f = frames_of(src, 3);
+		py::array dst = output_array(out, output_dtype, f.shape(1));
+
+		uchar* s = data_of(src);
+		uchar* d = data_of(dst);
+		for_each_frame(f, [&](py::ssize_t k)
+		{
+			cv::Mat target = f.mat(d, k, type), result = target;
+			codec.decode(f.mat(s, k, CV_8UC3), result, type);
+			write_back(result, target);
+		});
+		return dst;
+	}
+
+	py::array median_filter_frames(const py::array& depth, int kernel_size, float diff_threshold, const py::object& out)
+	{
+		if (!py::isinstance<py::array_t<uint16_t>>(depth)) throw py::type_error("depth must be uint16");
+		if (kernel_size < 0) throw py::value_error("kernel_size must not be negative");
+
+		py::array src = contiguous(depth);
+		Frames f = frames_of(src, 1);
+		py::array dst = output_array(out, py::dtype::of<uint16_t>(), f.shape(1));
+
+		uchar* s = data_of(src);
+		uchar* d = data_of(dst);
+		for_each_frame(f, [&](py::ssize_t k)
+		{
+			cv::Mat input = f.mat(s, k, CV_16U);
+			cv::Mat target = f.mat(d, k, CV_16U), result = target;
+			median_filter(input, result, kernel_size, diff_threshold);
+			write_back(result, target);
+		});
+		return dst;
+	}
+}
+
+PYBIND11_MODULE(hue_codec, m)
+{
+	m.doc() = "Hue encoding of depth images to and from 8-bit BGR images";
+
+	m.attr("HUE_MM_SCALE") = HUE_MM_SCALE;
+	m.attr("HUE_CM_SCALE") = HUE_CM_SCALE;
+
+	py::class_<HueCodec>(m, "HueCodec")
+		.def(py::init<float, float, float, bool>(),
+			py::arg("depth_min_m"), py::arg("depth_max_m"),
+			py::arg("depth_scale") = HUE_MM_SCALE, py::arg("inverse_colorization") = true)
+		.def_property_readonly("depth_min_m", &HueCodec::depth_min_m)
+		.def_property_readonly("depth_max_m", &HueCodec::depth_max_m)
+		.def_property_readonly("depth_scale", &HueCodec::depth_scale)
+		.def_readonly("inverse_colorization", &HueCodec::m_inverse_colorization)
+		.def("encode", &encode, py::arg("depth"), py::arg("out") = py::none(),
+			"Hue-encode uint16 depth (depth_scale units) or float32 depth (metres), "
+			"shaped (H, W) or (N, H, W), to uint8 BGR shaped (H, W, 3) or (N, H, W, 3). "
+			"Arrays shaped (N, H, 3) are refused as BGR images, so frames 3 pixels wide must be encoded one at a time.")
+		.def("decode", &decode, py::arg("encoded"), py::arg("dtype") = "uint16", py::arg("out") = py::none(),
+			"Decode uint8 BGR shaped (H, W, 3) or (N, H, W, 3) to uint16 depth (depth_scale units) "
+			"or float32 depth (metres).");
+
+	m.def("median_filter", &median_filter_frames,
+		py::arg("depth"), py::arg("kernel_size") = 1, py::arg("diff_threshold") = 0.02f, py::arg("out") = py::none(),
+		"Median filter uint16 depth shaped (H, W) or (N, H, W) to remove flying pixels "
+		"(see median_filter in hue_codec.h). out may be the input array to filter in place. "
+		"As for encode, (N, H, 3) stacks are refused, and kernel_size must not be negative.");
+}
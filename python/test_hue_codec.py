@@ -0,0 +1,122 @@
+# Tests of the hue_codec Python module
+#
+# Run by ctest when the module is built, or with the module on the path:
+#
+#     PYTHONPATH=build python3 -m pytest python
+
+import numpy as np
+import pytest
+
+import hue_codec
+
+
+def synthetic_depth(rows=120, cols=160, seed=0):
+	# A depth ramp in mm with 5% of the pixels without data
+	rng = np.random.default_rng(seed)
+	depth = np.linspace(400, 6000, cols)[None, :] + 10 * np.arange(rows)[:, None] + 50 * seed
+	depth = depth.astype(np.uint16)
+	depth[rng.random((rows, cols)) < 0.05] = 0
+	return depth
+
+
+@pytest.fixture
+def codec():
+	return hue_codec.HueCodec(0.3, 8.0, inverse_colorization=False)
+
+
+def test_encode_decode_round_trip(codec):
+	depth = synthetic_depth()
+	encoded = codec.encode(depth)
+	assert encoded.shape == depth.shape + (3,)
+	assert encoded.dtype == np.uint8
+
+	decoded = codec.decode(encoded)
+	assert decoded.shape == depth.shape
+	assert decoded.dtype == np.uint16
+	assert np.array_equal(decoded == 0, depth == 0)
+
+	# Standard colorization splits the depth range into 1530 equal steps
+	valid = depth > 0
+	step_mm = (8.0 - 0.3) * 1000 / 1530
+	assert np.abs(decoded[valid].astype(int) - depth[valid]).max() <= step_mm / 2 + 1
+
+	metres = codec.decode(encoded, dtype=np.float32)
+	assert metres.dtype == np.float32
+	assert np.allclose(metres, decoded * hue_codec.HUE_MM_SCALE, atol=1e-3)
+
+	# Arrays that are not C-contiguous are copied first
+	assert np.array_equal(codec.encode(depth[:, ::2]), codec.encode(np.ascontiguousarray(depth[:, ::2])))
+
+
+def test_output_reuse(codec):
+	depth = synthetic_depth()
+	encoded = np.empty(depth.shape + (3,), np.uint8)
+	decoded = np.empty(depth.shape, np.uint16)
+
+	assert codec.encode(depth, out=encoded) is encoded
+	assert np.array_equal(encoded, codec.encode(depth))
+	assert codec.decode(encoded, out=decoded) is decoded
+	assert np.array_equal(decoded, codec.decode(encoded))
+
+	with pytest.raises(ValueError):
+		codec.decode(encoded, out=np.empty((10, 10), np.uint16))		# wrong shape
+	with pytest.raises(ValueError):
+		codec.decode(encoded, out=np.empty(depth.shape, np.float32))	# wrong dtype for uint16 output
+	with pytest.raises(ValueError):
+		codec.decode(encoded, out=np.empty((depth.shape[0], 2 * depth.shape[1]), np.uint16)[:, ::2])	# not contiguous
+
+
+def test_median_filter_in_place():
+	depth = synthetic_depth()
+	depth[60, 80] = 60000	# a flying pixel
+	expected = hue_codec.median_filter(depth, 1, 0.02)
+	assert expected[60, 80] < 10000
+
+	assert hue_codec.median_filter(depth, 1, 0.02, out=depth) is depth
+	assert np.array_equal(depth, expected)
+
+
+def test_stacked_frames(codec):
+	stack = np.stack([synthetic_depth(seed=k) for k in range(4)])
+	encoded = codec.encode(stack)
+	assert encoded.shape == stack.shape + (3,)
+	decoded = codec.decode(encoded)
+	assert decoded.shape == stack.shape
+	filtered = hue_codec.median_filter(decoded, 1, 0.02)
+	assert filtered.shape == stack.shape
+
+	for k in range(len(stack)):
+		assert np.array_equal(encoded[k], codec.encode(stack[k]))
+		assert np.array_equal(decoded[k], codec.decode(encoded[k]))
+		assert np.array_equal(filtered[k], hue_codec.median_filter(decoded[k], 1, 0.02))
+
+
+def test_rejects_wrong_dtypes_and_shapes(codec):
+	depth = synthetic_depth()
+	encoded = codec.encode(depth)
+
+	with pytest.raises(TypeError):
+		codec.encode(depth.astype(np.int32))
+	with pytest.raises(TypeError):
+		codec.encode(depth.astype(np.float64))
+	with pytest.raises(TypeError):
+		codec.decode(encoded.astype(np.uint16))
+	with pytest.raises(TypeError):
+		codec.decode(encoded, dtype=np.float64)
+	with pytest.raises(TypeError):
+		hue_codec.median_filter(depth.astype(np.float32))
+
+	with pytest.raises(ValueError):
+		codec.encode(depth.ravel())
+	with pytest.raises(ValueError):
+		codec.encode(np.zeros((120, 160, 3), np.uint16))	# an image, not a stack of 120 frames
+	with pytest.raises(ValueError):
+		codec.encode(np.zeros((2, 120, 3), np.uint16))		# a stack of width-3 frames looks the same...
+	narrow = codec.encode(np.full((120, 3), 1000, np.uint16))	# ...so such frames go one at a time
+	assert narrow.shape == (120, 3, 3)
+	with pytest.raises(ValueError):
+		codec.decode(encoded[..., :2])
+	with pytest.raises(ValueError):
+		codec.decode(encoded[..., 0])
+	with pytest.raises(ValueError):
+		hue_codec.median_filter(depth, kernel_size=-1)
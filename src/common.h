@@ -1,4 +1,7 @@
 #include <opencv2/opencv.hpp>   // Include OpenCV API
+#include <hue_metrics.h>        // Depth quality metrics
+#include <hue_sequence.h>       // Raw depth sequence files
+#include <memory>
 
 // Used by tests and validation
 // Note that these code points are in OpenCV-standard BGR format
@@ -56,35 +59,11 @@ void imshow_depth(const std::string& name, const cv::Mat& src, float depth_min_m
 float psnr_depth(const cv::Mat& a, const cv::Mat& b, float depth_max_m, float depth_scale)
 {
 	// Calculate the Peak-Signal to Noise Ratio (PSNR) of a depth map
+	// See hue_metrics.h for the full set of depth quality metrics
 	if (a.empty() || b.empty() || a.size() != b.size()) return -1.0f;
 	if (a.type() != CV_16U || b.type() != CV_16U) return -1.0f;
 
-	// Calculate the maximum intensity
-	int max_i = depth_max_m / depth_scale;
-
-	// Calculate the MSE
-	float mse = 0.0f;
-	int count = 0;
-	for (int i=0; i<a.rows; i++)
-	{
-		for (int j=0; j<a.cols; j++)
-		{
-			int aval = a.at<uint16_t>(i, j);
-			int bval = b.at<uint16_t>(i, j);
-
-			if (aval < max_i && bval < max_i)
-			{	// Only consider values below max_i
-				int diff = aval - bval;
-				mse += diff * diff;
-				count++;
-			}
-		}
-	}
-	if (count == 0) mse = 0;
-	else mse = mse / count;
-
-	// Calculate and return the PSNR
-	return 20.0f * log10(max_i) - 10.0f * log10(mse);
+	return depth_quality(a, b, depth_max_m, depth_scale).psnr;
 }
 
 
@@ -106,16 +85,38 @@ cv::Mat generate_synthetic_depth(int w, int h, float vmin, float vmax, float inc
 	return data;
 }
 
-void load_reference_sequence(std::string seq_path, std::vector<cv::Mat>& sequence)
+bool load_mapped_sequence(const std::string& path, std::vector<cv::Mat>& sequence, int frame_count=-1)
+{
+	// Map a raw depth sequence file (see hue_sequence.h) and return views of its frames
+	// The file stays mapped for the lifetime of the process
+	static std::vector<std::unique_ptr<HueSequenceReader>> readers;
+	std::unique_ptr<HueSequenceReader> reader(new HueSequenceReader(path));
+	if (!reader->is_open()) return false;
+
+	reader->frames(sequence, frame_count);
+	readers.push_back(std::move(reader));
+	return true;
+}
+
+void load_reference_sequence(std::string seq_path, std::vector<cv::Mat>& sequence, int frame_count=26)
 {
 	// Read the sequence into memory
+	// seq_path is either a raw depth sequence file or a directory of frame_NNNNN.png files.
+	// A directory that contains a sequence.hds file (see convert_sequence) is mapped
+	// instead of decoding its PNGs.
+	// A negative frame_count reads frames until the next frame cannot be read
+	if (load_mapped_sequence(seq_path, sequence, frame_count)) return;
+	if (!seq_path.empty() && seq_path.back() != '/') seq_path += '/';
+	if (load_mapped_sequence(seq_path + "sequence.hds", sequence, frame_count)) return;
+
 	sequence.clear();
-	const int frame_count = 26;
-	for (int i=0; i<frame_count; i++)
+	for (int i=0; frame_count<0 || i<frame_count; i++)
 	{
 		std::stringstream ss_path;
 		ss_path << "frame_" << std::setfill('0') << std::setw(5) << i << ".png";
 		std::string path = seq_path + ss_path.str();
-		sequence.push_back( imread(path, cv::IMREAD_ANYDEPTH) );
+		cv::Mat frame = imread(path, cv::IMREAD_ANYDEPTH);
+		if (frame.empty() && frame_count<0) break;
+		sequence.push_back(frame);
 	}
 }
@@ -2,9 +2,22 @@
 #include <doctest/doctest.h>  				// This testing framework
 #include <fmt/color.h>	      				// formatted ANSI terminal output
 #include <fmt/core.h>	      				// formatted terminal output
+#include <hue_archive.h>	   				// Asynchronous image archives
 #include <hue_codec.h>	      				// The header-only hue codec
+#include <hue_codec_hb.h>	   				// High bit-depth hue codec
+#include <hue_dual.h>		   				// Dual-layer coarse/fine encoding
+#include <hue_near_lossless.h>	   			// Near-lossless encoding with a bounded error
+#include <hue_perf.h>		   				// Hardware performance counters
+#include <hue_pyramid.h>	   				// Multi-resolution pyramid encoding
+#include <hue_rate.h>		   				// Rate control for image compression
+#include <hue_rvl.h>		   				// Fast lossless depth compression
+#include <hue_schemes.h>	   				// Alternative encoding schemes
 #include <chrono>			  				// performance timing
+#include <cmath>				  				// INFINITY
+#include <thread>			  				// hardware thread count
 #include <cstdio>			  				// remove function
+#include <cstdlib>			  				// getenv
+#include <functional>		  				// stage functions
 #include <ios>				  				// for std::ios_base::bin
 #include <opencv2/core/utils/logger.hpp>  	// OpenCV logging controls
 #include <opencv2/videoio.hpp>		  		// OpenCV Video input/output
@@ -14,6 +27,10 @@
 #include <opencv2/cudacodec.hpp>			// OpenCV CUDA-accelerated input/output
 #endif
 
+#ifdef HUE_HAVE_LIBAV
+#include <hue_video.h>						// Native libav hue video input/output
+#endif
+
 // All benchmarks use the Peak Signal-to-Noise Ratio (PSNR) as a measure of fidelity/loss.
 // [https://en.wikipedia.org/wiki/Peak_signal-to-noise_ratio]
 // Standard (uniform) colorization is used as its error is increases linearly with increasing depth.
@@ -32,6 +49,7 @@ struct Performance
 	float time_co;	// compress   / media codec encoding
 	float time_de;	// decompress / media codec decoding
 	float time_hd;	// hue decode
+	HuePerfSample counters[4];	// hardware counters of the four stages above (see perf_counters)
 
 	float time_total() const { return time_he + time_co + time_de + time_hd; }
 	float time_save()  const { return time_he + time_co; }
@@ -41,38 +59,80 @@ struct Performance
 	float time_load_per(int count) const { return (float)time_load() / count; }
 	float save_rate(int count, float size_per) const { return size_per*count/(float)time_save(); }
 	float load_rate(int count, float size_per) const { return size_per*count/(float)time_load(); }
+
+	HuePerfSample counters_total() const
+	{
+		HuePerfSample total = counters[0];
+		for (int k=1; k<4; k++) total += counters[k];
+		return total;
+	}
 };
 
-Performance image_benchmark(const HueCodec& codec, const Mat& depth, const string& file_extension, const vector<int>& params)
+HuePerfCounters& perf_counters()
+{	// Hardware counters of the benchmark thread, enabled with HUE_PERF_COUNTERS=1
+	const char* env = getenv("HUE_PERF_COUNTERS");
+	static HuePerfCounters counters(env && string(env) != "0");
+	return counters;
+}
+
+string perf_column(double value, int width, int precision)
+{	// A counter column, or "-" for a counter that is not available
+	if (value < 0) return fmt::format("{:>{}}", "-", width);
+	return fmt::format("{:>{}.{}f}", value, width, precision);
+}
+
+string perf_columns(const HuePerfSample& sample, double pixels)
+{	// Per-pixel counter columns (see perf_header)
+	typedef HuePerfSample S;
+	return fmt::format(" {} | {} | {} | {} | {} | {} |",
+		perf_column(sample.per_pixel(S::CYCLES, pixels), 6, 1), perf_column(sample.ipc(), 4, 2),
+		perf_column(sample.per_pixel(S::BRANCH_MISSES, pixels), 10, 3), perf_column(sample.per_pixel(S::L1D_MISSES, pixels), 10, 3),
+		perf_column(sample.per_pixel(S::LLC_MISSES, pixels), 11, 4), perf_column(sample.bandwidth_gbs(), 5, 2));
+}
+
+const char* perf_header() { return " cyc/px | IPC  | br-miss/px | L1 miss/px | LLC miss/px | GB/s  |"; }
+
+template <typename Codec>
+Performance image_benchmark(const Codec& codec, const Mat& depth, const string& file_extension, const vector<int>& params)
 {
 	using namespace chrono;
 	vector<uchar> compressed;
 	Mat encoded, decompressed, decoded;
+	HuePerfCounters& counters = perf_counters();
+	HuePerfSample samples[4];
 
 	auto t1 = high_resolution_clock::now();
 
 	// Hue-encode the depth map
+	counters.start();
 	encoded = codec.encode(depth);
+	samples[0] = counters.stop();
 
 	auto t2 = high_resolution_clock::now();
 
 	// Compress the hue-encoded image to a buffer with an image format
+	counters.start();
 	if (file_extension != "")
 	{
 		imencode("." + file_extension, encoded, compressed, params);
 	}
+	samples[1] = counters.stop();
 
 	auto t3 = high_resolution_clock::now();
 
 	// Decompress the hue-encoded image from the buffer
+	counters.start();
 	if (file_extension != "")
 	{
-		decompressed = imdecode(compressed, IMREAD_COLOR);
+		// High bit-depth hue-encoded images must be read back without conversion to 8 bits
+		decompressed = imdecode(compressed, encoded.depth() == CV_16U ? IMREAD_UNCHANGED : IMREAD_COLOR);
 	}
+	samples[2] = counters.stop();
 
 	auto t4 = high_resolution_clock::now();
 
 	// Decode the hue-encoded image into a depth map
+	counters.start();
 	if (file_extension != "")
 	{
 		decoded = codec.decode(decompressed);
@@ -81,6 +141,7 @@ Performance image_benchmark(const HueCodec& codec, const Mat& depth, const strin
 	{
 		decoded = codec.decode(encoded);
 	}
+	samples[3] = counters.stop();
 
 	auto t5 = high_resolution_clock::now();
 
@@ -98,24 +159,65 @@ Performance image_benchmark(const HueCodec& codec, const Mat& depth, const strin
 	// Calculate the peak signal-to-noise ratio (PSNR) between the original and decoded depth maps
 	float psnr = psnr_depth(depth, decoded, codec.depth_max_m(), codec.depth_scale());
 
-	return Performance{psnr, osize, csize, time_he.count(), time_co.count(), time_de.count(), time_hd.count()};
+	return Performance{psnr, osize, csize, time_he.count(), time_co.count(), time_de.count(), time_hd.count(),
+		{ samples[0], samples[1], samples[2], samples[3] }};
 }
 
 
 void output_image_benchmark_header()
-{
-	fmt::print("| Encoding                 | PSNR  | CR    | save (ms) | load (ms) | save (kB/s) | load (kB/s) |\n");
+{	// With HUE_PERF_COUNTERS=1, hardware counters per pixel of all four stages follow
+	fmt::print("| Encoding                 | PSNR  | CR    | save (ms) | load (ms) | save (kB/s) | load (kB/s) |{}\n",
+		perf_counters().available() ? perf_header() : "");
 }
 
 void output_image_benchmark(string name, int q, float size, const Performance& perf)
 {
-	fmt::print("| Hue-encoded {:5}(Q={:>03}) | {:5.1f} | {:5.1f} | {:>9.1f} | {:>9.1f} | {:>11.1f} | {:>11.1f} |\n", 
+	fmt::print("| Hue-encoded {:5}(Q={:>03}) | {:5.1f} | {:5.1f} | {:>9.1f} | {:>9.1f} | {:>11.1f} | {:>11.1f} |{}\n", 
 		name, q, perf.psnr, perf.cr(), perf.time_save(), perf.time_load(), 
-		perf.save_rate(1, size), perf.load_rate(1, size));
+		perf.save_rate(1, size), perf.load_rate(1, size),
+		perf_counters().available() ? perf_columns(perf.counters_total(), size * 1000.0) : "");
 }
 
 
-void output_image_benchmark(const HueCodec& codec, const Mat& depth, string name, string ext, int param_flag, int qmin, int qmax, int qstep)
+Performance lossless_benchmark(const Mat& depth, int png_compression)
+{	// Compress the depth map itself without loss: with RVL (png_compression < 0) or as a 16-bit PNG
+	using namespace chrono;
+	HueRVLCodec rvl;
+	HuePerfCounters& counters = perf_counters();
+	HuePerfSample samples[4];
+	vector<uchar> compressed;
+	Mat decoded;
+
+	auto t1 = high_resolution_clock::now();
+	counters.start();
+	if (png_compression < 0) rvl.encode(depth, compressed);
+	else imencode(".png", depth, compressed, { IMWRITE_PNG_COMPRESSION, png_compression });
+	samples[1] = counters.stop();
+
+	auto t2 = high_resolution_clock::now();
+	counters.start();
+	if (png_compression < 0) rvl.decode(compressed, decoded);
+	else decoded = imdecode(compressed, IMREAD_ANYDEPTH);
+	samples[2] = counters.stop();
+	auto t3 = high_resolution_clock::now();
+
+	std::chrono::duration<float, std::milli> time_co = t2 - t1;
+	std::chrono::duration<float, std::milli> time_de = t3 - t2;
+	float psnr = norm(depth, decoded, NORM_INF) == 0 ? INFINITY : -1.0f;	// exact, or not lossless
+	return Performance{psnr, 2 * depth.size().area(), (int)compressed.size(), 0.0f, time_co.count(), time_de.count(), 0.0f,
+		{ samples[0], samples[1], samples[2], samples[3] }};
+}
+
+void output_lossless_benchmark(string name, float size, const Performance& perf)
+{	// A row of the image benchmark table for depth compressed without hue encoding
+	fmt::print("| {:24} | {:5.1f} | {:5.1f} | {:>9.1f} | {:>9.1f} | {:>11.1f} | {:>11.1f} |{}\n",
+		name, perf.psnr, perf.cr(), perf.time_save(), perf.time_load(),
+		perf.save_rate(1, size), perf.load_rate(1, size),
+		perf_counters().available() ? perf_columns(perf.counters_total(), size * 1000.0) : "");
+}
+
+template <typename Codec>
+void output_image_benchmark(const Codec& codec, const Mat& depth, string name, string ext, int param_flag, int qmin, int qmax, int qstep)
 {
 	float size = depth.size().area()/1000.0f;
 
@@ -149,8 +251,210 @@ TEST_CASE("image psnr test")
 	output_image_benchmark(codec, depth, "PNG",  "png",  IMWRITE_PNG_COMPRESSION, 10,   1, -1);
 	output_image_benchmark(codec, depth, "JPEG", "jpg",  IMWRITE_JPEG_QUALITY,     0, 100, 10);
 	output_image_benchmark(codec, depth, "WebP", "webp", IMWRITE_WEBP_QUALITY,     0, 100, 10);
+
+	// High bit-depth hue encoding to 16-bit PNG (6 x 1023 and 6 x 4095 hue levels)
+	for (int bits : { 10, 12 })
+	{
+		HueCodecHB codec_hb(depth_min_m, depth_max_m, depth_scale, false, bits);
+		perf = image_benchmark(codec_hb, depth, "", vector<int>());
+		output_image_benchmark(fmt::format("{}b", bits), 100, depth.size().area()/1000.0f, perf);
+		output_image_benchmark(codec_hb, depth, fmt::format("PNG{}", bits), "png", IMWRITE_PNG_COMPRESSION, 9, 1, -4);
+	}
+
+	// Lossless depth without hue encoding: RVL and 16-bit PNG
+	float size = depth.size().area()/1000.0f;
+	output_lossless_benchmark("RVL lossless depth", size, lossless_benchmark(depth, -1));
+	for (int q : { 9, 5, 1 })
+	{
+		output_lossless_benchmark(fmt::format("16-bit PNG depth (Q={})", q), size, lossless_benchmark(depth, q));
+	}
+}
+
+TEST_CASE("hardware counter test")
+{	// Hardware counters per pixel of each stage, to show whether it is limited by
+	// computation (low cycles and high IPC), branches, or memory
+	HuePerfCounters& counters = perf_counters();
+	fmt::print("\n{:-<{}}\n", "Hardware counters per stage on room reference depth map ", 80);
+	if (!counters.available())
+	{
+		fmt::print("Set HUE_PERF_COUNTERS=1 to count hardware events (Linux, with kernel.perf_event_paranoid 2 or less).\n");
+		return;
+	}
+
+	HueCodec codec(2.2f, 7.2f, HUE_MM_SCALE, false);
+	Mat depth = imread("../data/ref/room.png", IMREAD_ANYDEPTH);
+	Mat encoded = codec.encode(depth), decoded = codec.decode(encoded), filtered, decompressed;
+	vector<uchar> compressed;
+	const double pixels = (double)depth.total();
+	const int repeats = 10;
+
+	fmt::print("| Stage               | ms/frame |{}\n", perf_header());
+	auto stage = [&](const string& name, const function<void()>& run)
+	{
+		run();	// warm up caches and allocations
+		counters.start();
+		for (int k=0; k<repeats; k++) run();
+		HuePerfSample sample = counters.stop();
+		fmt::print("| {:19} | {:>8.2f} |{}\n", name, 1000.0 * sample.seconds / repeats, perf_columns(sample, pixels * repeats));
+	};
+
+	stage("hue encode", [&] { codec.encode(depth, encoded); });
+	stage("hue decode", [&] { codec.decode(encoded, decoded); });
+	for (int kernel_size : { 1, 2 })
+	{
+		stage(fmt::format("median filter (k={})", kernel_size), [&] { median_filter(decoded, filtered, kernel_size, 0.02f); });
+	}
+
+	struct Format { string name, ext; int flag, quality; };
+	for (const Format& f : { Format{ "PNG", ".png", IMWRITE_PNG_COMPRESSION, 1 },
+	                         Format{ "JPEG", ".jpg", IMWRITE_JPEG_QUALITY, 90 },
+	                         Format{ "WebP", ".webp", IMWRITE_WEBP_QUALITY, 90 } })
+	{
+		stage(f.name + " compress", [&] { imencode(f.ext, encoded, compressed, { f.flag, f.quality }); });
+		stage(f.name + " decompress", [&] { decompressed = imdecode(compressed, IMREAD_COLOR); });
+	}
+
+	HueRVLCodec rvl;
+	stage("RVL compress", [&] { rvl.encode(depth, compressed); });
+	stage("RVL decompress", [&] { rvl.decode(compressed, filtered); });
+}
+
+TEST_CASE("near-lossless test")
+{	// Storage for a guaranteed maximum error, between the hue layer alone and lossless RVL
+	using namespace chrono;
+	HueCodec codec(2.2f, 7.2f, HUE_MM_SCALE, false);
+	Mat depth = imread("../data/ref/room.png", IMREAD_ANYDEPTH);
+	const float osize = 2.0f * depth.size().area();
+
+	fmt::print("\n{:-<{}}\n", "Near-lossless benchmarks on room reference depth map ", 80);
+	fmt::print("WebP Q=90 hue layer with a PNG residual (RVL residual in brackets).\n");
+	fmt::print("| Max error (mm) | hue (kB) | residual (kB) | CR          | save (ms) | load (ms) | max error |\n");
+
+	for (int max_error : { 0, 1, 2, 5, 10 })
+	{
+		HueNearLosslessOptions options;
+		options.max_error = max_error;
+		HueNearLosslessCodec png(codec, options);
+		options.rvl_residual = true;
+		HueNearLosslessCodec rvl(codec, options);
+
+		vector<uchar> hue, residual, rvl_hue, rvl_residual;
+		Mat decoded;
+		auto t0 = high_resolution_clock::now();
+		png.encode(depth, hue, residual);
+		auto t1 = high_resolution_clock::now();
+		png.decode(hue, residual, decoded);
+		auto t2 = high_resolution_clock::now();
+		rvl.encode(depth, rvl_hue, rvl_residual);
+
+		double worst = norm(depth, decoded, NORM_INF);
+
+		std::chrono::duration<float, std::milli> save = t1 - t0, load = t2 - t1;
+		fmt::print("| {:>14} | {:>8.1f} | {:>5.1f} ({:>5.1f}) | {:>4.1f} ({:>4.1f}) | {:>9.1f} | {:>9.1f} | {:>9} |\n",
+			max_error, hue.size() / 1000.0, residual.size() / 1000.0, rvl_residual.size() / 1000.0,
+			osize / (hue.size() + residual.size()), osize / (rvl_hue.size() + rvl_residual.size()),
+			save.count(), load.count(), worst);
+	}
+
+	vector<uchar> lossless = HueRVLCodec().encode(depth);
+	fmt::print("| RVL lossless   | {:>8} | {:>13} | {:>4.1f}       | {:>9} | {:>9} | {:>9} |\n", "-", "-", osize / lossless.size(), "", "", 0);
+}
+
+
+TEST_CASE("encoding scheme test")
+{	// The same image formats and qualities with each per-pixel encoding scheme
+	const float depth_min_m = 2.2f;
+	const float depth_max_m = 7.2f;
+	HueCodec hue(depth_min_m, depth_max_m, HUE_MM_SCALE, false);
+	TriangleCodec triangle(depth_min_m, depth_max_m, HUE_MM_SCALE, false);
+
+	Mat depth = imread("../data/ref/room.png", IMREAD_ANYDEPTH);
+
+	fmt::print("\n{:-<{}}\n", "Encoding scheme benchmarks on room reference depth map", 80);
+	fmt::print("| Format     | Hue PSNR | Hue CR | Triangle PSNR | Triangle CR |\n");
+
+	auto output = [&](const string& name, const string& ext, int param_flag, int q)
+	{
+		vector<int> params { param_flag, q };
+		Performance h = image_benchmark(hue, depth, ext, params);
+		Performance t = image_benchmark(triangle, depth, ext, params);
+		fmt::print("| {:4} Q={:>3} | {:8.1f} | {:6.1f} | {:13.1f} | {:11.1f} |\n", name, q, h.psnr, h.cr(), t.psnr, t.cr());
+	};
+
+	output("PNG", "png", IMWRITE_PNG_COMPRESSION, 9);
+	for (int q=10; q<=100; q+=10) output("JPEG", "jpg", IMWRITE_JPEG_QUALITY, q);
+	for (int q=10; q<=100; q+=10) output("WebP", "webp", IMWRITE_WEBP_QUALITY, q);
 }
 
+TEST_CASE("dual-layer test")
+{	// Dual-layer hue encoding against single-layer hue encoding and 16-bit PNG
+	const float depth_min_m = 2.2f;
+	const float depth_max_m = 7.2f;
+	HueCodec hue(depth_min_m, depth_max_m, HUE_MM_SCALE, false);
+	HueDualCodec dual(depth_min_m, depth_max_m, HUE_MM_SCALE, false, 16);
+
+	Mat depth = imread("../data/ref/room.png", IMREAD_ANYDEPTH);
+	int osize = 2 * depth.size().area();
+
+	fmt::print("\n{:-<{}}\n", "Dual-layer benchmarks on room reference depth map", 80);
+	vector<uchar> png;
+	imencode(".png", depth, png, { IMWRITE_PNG_COMPRESSION, 9 });
+	fmt::print("16-bit PNG of the depth map: CR {:.1f}\n", (float)osize / png.size());
+	fmt::print("| Format     | Hue PSNR | Hue CR | Dual PSNR | Dual CR |\n");
+
+	auto output = [&](const string& name, const string& ext, int param_flag, int q)
+	{
+		vector<int> params { param_flag, q };
+		Performance h = image_benchmark(hue, depth, ext, params);
+
+		Mat coarse, fine, decoded;
+		vector<uchar> coarse_buffer, fine_buffer;
+		dual.encode(depth, coarse, fine);
+		imencode("." + ext, coarse, coarse_buffer, params);
+		imencode("." + ext, fine, fine_buffer, params);
+		dual.decode(imdecode(coarse_buffer, IMREAD_COLOR), imdecode(fine_buffer, IMREAD_COLOR), decoded);
+		float psnr = psnr_depth(depth, decoded, dual.depth_max_m(), dual.depth_scale());
+		float cr = (float)osize / (coarse_buffer.size() + fine_buffer.size());
+
+		fmt::print("| {:4} Q={:>3} | {:8.1f} | {:6.1f} | {:9.1f} | {:7.1f} |\n", name, q, h.psnr, h.cr(), psnr, cr);
+	};
+
+	output("PNG", "png", IMWRITE_PNG_COMPRESSION, 9);
+	for (int q=50; q<=100; q+=10) output("JPEG", "jpg", IMWRITE_JPEG_QUALITY, q);
+	for (int q=50; q<=100; q+=10) output("WebP", "webp", IMWRITE_WEBP_QUALITY, q);
+}
+
+TEST_CASE("pyramid test")
+{	// Bytes and load times of progressive decoding with WebP-compressed pyramid layers
+	using namespace chrono;
+	HueCodec codec(2.2f, 7.2f, HUE_MM_SCALE, false);
+	HuePyramid pyramid(codec, 3);
+	Mat depth = imread("../data/ref/room.png", IMREAD_ANYDEPTH);
+
+	vector<Mat> layers, decompressed(pyramid.levels());
+	vector<vector<uchar>> compressed(pyramid.levels());
+	pyramid.encode(depth, layers);
+	for (int l=0; l<pyramid.levels(); l++) imencode(".webp", layers[l], compressed[l], { IMWRITE_WEBP_QUALITY, 90 });
+
+	fmt::print("\n{:-<{}}\n", "Pyramid benchmarks on room reference depth map (WebP Q=90)", 80);
+	fmt::print("| Layers | Size        | PSNR  | kB    | load (ms) |\n");
+
+	size_t bytes = 0;
+	for (int n=1; n<=pyramid.levels(); n++)
+	{
+		bytes += compressed[n-1].size();
+		auto t1 = high_resolution_clock::now();
+		for (int l=0; l<n; l++) decompressed[l] = imdecode(compressed[l], IMREAD_COLOR);
+		Mat decoded;
+		pyramid.decode(decompressed, decoded, n);
+		std::chrono::duration<float, std::milli> time = high_resolution_clock::now() - t1;
+
+		Mat reference;
+		resize(depth, reference, decoded.size(), 0, 0, INTER_NEAREST);
+		float psnr = psnr_depth(reference, decoded, codec.depth_max_m(), codec.depth_scale());
+		fmt::print("| {:6} | {:>4} x {:<4} | {:5.1f} | {:5.1f} | {:9.1f} |\n", n, decoded.cols, decoded.rows, psnr, bytes / 1000.0f, time.count());
+	}
+}
 
 #if defined(HAVE_OPENCV_CUDACODEC) && defined(WIN32)
 Performance video_format_gpu_benchmark(const HueCodec& codec, const vector<Mat>& sequence)
@@ -233,7 +537,7 @@ Performance video_format_gpu_benchmark(const HueCodec& codec, const vector<Mat>&
 	// Delete the video file.
 	remove(video_path.c_str());
 
-	return Performance{mean_psnr, osize, csize, time_he, time_co, time_de, time_hd};
+	return Performance{mean_psnr, osize, csize, time_he, time_co, time_de, time_hd, {}};
 }
 
 void output_video_format_gpu_benchmark(const HueCodec& codec, const vector<Mat>& sequence)
@@ -358,7 +662,7 @@ Performance video_benchmark(const HueCodec& codec, const vector<Mat>& sequence,
 	// Delete the video file.
 	remove(video_path.c_str());
 
-	return Performance{mean_psnr, osize, csize, time_he.count(), time_co.count(), time_de.count(), time_hd.count()};
+	return Performance{mean_psnr, osize, csize, time_he.count(), time_co.count(), time_de.count(), time_hd.count(), {}};
 }
 
 void output_video_benchmark_header()
@@ -385,6 +689,112 @@ void output_video_benchmark(const HueCodec& codec, const vector<Mat>& sequence,
 }
 
 
+#ifdef HUE_HAVE_LIBAV
+template <typename Codec>
+Performance native_video_benchmark(const Codec& codec, const vector<Mat>& sequence, const string& ext, const HueVideoOptions& options)
+{
+	using namespace chrono;
+	const string video_path = "test_native_" + options.codec + "." + ext;
+
+	auto t1 = high_resolution_clock::now();
+
+	// Hue-encode the data
+	vector<Mat> encoded;
+	for (size_t i=0; i<sequence.size(); i++)
+	{
+		encoded.push_back(codec.encode(sequence[i]));
+	}
+
+	auto t2 = high_resolution_clock::now();
+
+	// Compress / write the video
+	HueVideoWriter vwriter;
+	if (!vwriter.open(video_path, encoded.back().size(), encoded.back().type(), options))
+	{
+		return Performance();
+	}
+	for (size_t i=0; i<encoded.size(); i++)
+	{
+		vwriter.write(encoded[i]);
+	}
+	vwriter.close();
+
+	auto t3 = high_resolution_clock::now();
+
+	HueVideoReader vreader;
+	if (!vreader.open(video_path, options.threads, options.slice_threads))
+	{
+		fmt::print("Could not open video file for reading.\n");
+		return Performance();
+	}
+
+	auto t4 = high_resolution_clock::now();
+
+	// Decompress the video
+	vector<Mat> decompressed;
+	for (size_t i=0; i<sequence.size(); i++)
+	{
+		Mat frame;
+		if (!vreader.read(frame)) break;
+		decompressed.push_back(frame);
+	}
+
+	auto t5 = high_resolution_clock::now();
+
+	// Decode the video and get the cumulative psnr
+	Mat decoded;
+	float cum_psnr = 0.0f;
+	for (size_t i=0; i<decompressed.size(); i++)
+	{
+		codec.decode(decompressed[i], decoded);
+		cum_psnr += psnr_depth(decoded, sequence[i], codec.depth_max_m(), codec.depth_scale());
+	}
+
+	auto t6 = high_resolution_clock::now();
+
+	float mean_psnr = cum_psnr / sequence.size();
+
+	// Calculate the original size
+	int osize = 2 * sequence.size() * sequence.back().size().area();
+
+	// Get the video file size.
+	ifstream ifs(video_path, ios_base::binary);
+	ifs.seekg(0, ios::end);
+	int csize = ifs.tellg();
+	ifs.close();
+
+	// Calculate durations
+	std::chrono::duration<float, std::milli> time_he = t2 - t1;	// hue encode
+	std::chrono::duration<float, std::milli> time_co = t3 - t2;	// compress
+	std::chrono::duration<float, std::milli> time_de = t5 - t4;	// decompress
+	std::chrono::duration<float, std::milli> time_hd = t6 - t5;	// hue decode
+
+	// Delete the video file.
+	remove(video_path.c_str());
+
+	return Performance{mean_psnr, osize, csize, time_he.count(), time_co.count(), time_de.count(), time_hd.count(), {}};
+}
+
+template <typename Codec>
+void output_native_video_benchmark(const Codec& codec, const vector<Mat>& sequence, const string& name, const string& ext, const HueVideoOptions& options)
+{	// Rows are labelled "libav <name>" in place of "Hue-encoded <fourcc>/<ext>"
+	auto perf = native_video_benchmark(codec, sequence, ext, options);
+	if (perf.csize == 0)
+	{
+		fmt::print("| libav {:<14} | encoder {} is not available\n", name, options.codec);
+		return;
+	}
+
+	int count = sequence.size();
+	float size_per = sequence.front().size().area() * 2 / 1000.0f;
+	fmt::print("| libav {:<14} | {:9.1f} | {:>5.1f} | {:>9.1f} | {:>9.1f} | {:>11.1f} | {:>11.1f} |\n",
+			name, perf.psnr, perf.cr(),
+			perf.time_save_per(count), perf.time_load_per(count),
+			perf.save_rate(count, size_per), perf.load_rate(count, size_per)
+			);
+}
+#endif
+
 TEST_CASE("video psnr test")
 {
 	const float depth_min_m = 0.8f;
@@ -421,6 +831,27 @@ TEST_CASE("video psnr test")
 	output_video_benchmark(codec, sequence, "mp4", "vp09");	// VP9
 	output_video_benchmark(codec, sequence, "mp4", "hvc1");	// H.265
 
+	#ifdef HUE_HAVE_LIBAV
+	// Native libav encoders with explicit settings
+	HueVideoOptions x264_medium;
+	x264_medium.preset = "medium";
+	x264_medium.crf = 23;
+	output_native_video_benchmark(codec, sequence, "x264 medium", "mkv", x264_medium);						// H.264 4:2:0
+	output_native_video_benchmark(codec, sequence, "x264 zerolat", "mkv", HueVideoOptions::low_latency());	// H.264 low latency
+	output_native_video_benchmark(codec, sequence, "x265 zerolat", "mkv", HueVideoOptions::low_latency("libx265", 28));
+
+	HueVideoOptions x264rgb = HueVideoOptions::low_latency("libx264rgb", 10);
+	output_native_video_benchmark(codec, sequence, "x264rgb crf10", "mkv", x264rgb);						// H.264 RGB, no chroma subsampling
+	output_native_video_benchmark(codec, sequence, "x264rgb lossls", "mkv", HueVideoOptions::lossless_rgb());
+	output_native_video_benchmark(codec, sequence, "ffv1", "mkv", HueVideoOptions::lossless_rgb("ffv1"));
+
+	// High bit-depth hue encoding with 10-bit RGB H.265
+	HueCodecHB codec_hb(codec.depth_min_m(), codec.depth_max_m(), codec.depth_scale(), false, 10);
+	HueVideoOptions x265_10 = HueVideoOptions::low_latency("libx265", 20);
+	x265_10.bits = 10;
+	output_native_video_benchmark(codec_hb, sequence, "x265 10b crf20", "mkv", x265_10);
+	#endif
+
 	/*
 	#if defined(HAVE_OPENCV_CUDACODEC) && defined(WIN32)
 	// CUDA-accelerated video codecs
@@ -443,3 +874,119 @@ TEST_CASE("video psnr test")
 	#endif
 	*/
 }
+
+
+void output_rate_benchmark(const HueCodec& codec, const vector<Mat>& sequence, const string& name, const HueRateOptions& options)
+{	// Compress the sequence at a target size or PSNR and report how closely it was met
+	HueRateController rate(codec, options);
+	vector<uchar> buffer;
+	Mat decoded;
+	double total_bytes = 0.0, total_quality = 0.0, total_psnr = 0.0;
+	size_t max_bytes = 0;
+
+	for (const Mat& depth : sequence)
+	{
+		rate.encode(depth, buffer);
+		codec.decode(imdecode(buffer, IMREAD_COLOR), decoded);
+		total_bytes += buffer.size();
+		max_bytes = max(max_bytes, buffer.size());
+		total_quality += rate.quality();
+		total_psnr += psnr_depth(depth, decoded, codec.depth_max_m(), codec.depth_scale());
+	}
+
+	double n = (double)sequence.size();
+	string target = options.target_bytes ? fmt::format("{:.1f} kB", options.target_bytes / 1000.0) : fmt::format("{:.1f} dB", options.target_psnr);
+	fmt::print("| {:5} | {:>9} | {:>10.1f} | {:>9.1f} | {:>6.1f} | {:9.1f} |\n",
+		name, target, total_bytes / n / 1000.0, max_bytes / 1000.0, total_quality / n, total_psnr / n);
+}
+
+TEST_CASE("rate control test")
+{
+	const float depth_min_m = 0.8f;
+	const float depth_max_m = 5.8f;
+	HueCodec codec(depth_min_m, depth_max_m, HUE_MM_SCALE, false);
+
+	vector<Mat> sequence;
+	load_reference_sequence("../data/seq/", sequence);
+
+	fmt::print("\n{:-<{}}\n", "Rate control benchmarks ", 80);
+	fmt::print("Each frame is compressed once at the quality picked by HueRateController.\n");
+	fmt::print("| Codec | Target    | mean (kB)  | max (kB)  | mean Q | mean PSNR |\n");
+
+	for (string format : { ".jpg", ".webp" })
+	{
+		string name = format == ".jpg" ? "JPEG" : "WebP";
+		HueRateOptions options;
+		options.format = format;
+		for (size_t target_bytes : { 10000, 20000, 40000 })
+		{
+			options.target_bytes = target_bytes;
+			output_rate_benchmark(codec, sequence, name, options);
+		}
+
+		options.target_bytes = 0;
+		for (double target_psnr : { 40.0, 50.0 })
+		{
+			options.target_psnr = target_psnr;
+			output_rate_benchmark(codec, sequence, name, options);
+		}
+	}
+}
+
+void output_archive_benchmark(const HueCodec& codec, const vector<Mat>& sequence, int frames, unsigned threads)
+{	// Archive frames as fast as the writer accepts them (threads 0: serial imencode and fwrite)
+	using namespace chrono;
+	const string path = "benchmark_archive.hca";
+	HueArchiveOptions options;
+	options.threads = threads;
+	uint64_t bytes = 0;
+
+	auto t0 = high_resolution_clock::now();
+	if (threads == 0)
+	{
+		FILE* file = fopen(path.c_str(), "wb");
+		vector<uchar> buffer;
+		for (int k=0; k<frames; k++)
+		{
+			imencode(options.format, codec.encode(sequence[k % sequence.size()]), buffer, options.params);
+			bytes += fwrite(buffer.data(), 1, buffer.size(), file);
+		}
+		fclose(file);
+	}
+	else
+	{
+		HueArchiveWriter archive(codec, options);
+		archive.open(path, sequence[0].size());
+		for (int k=0; k<frames; k++) archive.write(sequence[k % sequence.size()], k);
+		archive.close();
+		bytes = archive.bytes();
+		for (uint32_t chunk=0; chunk<=bytes / options.chunk_bytes + 1; chunk++) remove(hue_archive_detail::chunk_path(path, chunk).c_str());
+	}
+	auto t1 = high_resolution_clock::now();
+	remove(path.c_str());
+
+	double seconds = duration_cast<duration<double>>(t1 - t0).count();
+	string name = threads ? fmt::format("{} threads", threads) : "serial";
+	fmt::print("| {:10} | {:>7.1f} | {:>8.2f} | {:>7.1f} |\n", name, frames / seconds, 1000.0 * seconds / frames, bytes / seconds / 1E6);
+}
+
+TEST_CASE("archive test")
+{
+	HueCodec codec(0.8f, 5.8f, HUE_MM_SCALE, false);
+
+	vector<Mat> sequence;
+	load_reference_sequence("../data/seq/", sequence);
+	const int frames = 300;
+
+	fmt::print("\n{:-<{}}\n", "WebP archive benchmarks ", 80);
+	fmt::print("Sustained rate of HueArchiveWriter (WebP Q=90, {} frames) against serial compression.\n", frames);
+	fmt::print("| Writer     | fps     | ms/frame | MB/s    |\n");
+
+	output_archive_benchmark(codec, sequence, frames, 0);
+	unsigned hardware = max(1u, thread::hardware_concurrency());
+	for (unsigned threads : { 1u, 2u, 4u, hardware })
+	{
+		if (threads <= hardware) output_archive_benchmark(codec, sequence, frames, threads);
+		if (threads == hardware) break;
+	}
+}
@@ -0,0 +1,85 @@
+#include <hue_sequence.h>	      				// Raw depth sequence files
+#include <fmt/core.h>	      				// formatted terminal output
+#include <string>
+#include <vector>
+#include <opencv2/core/utils/logger.hpp>  	// OpenCV logging controls
+
+// Depth sequence converter
+//
+// Converts a directory of 16-bit depth PNGs (in file name order) to a raw depth
+// sequence file that HueSequenceReader maps without decoding:
+//
+//   ./convert_sequence ../data/seq/                    # writes ../data/seq/sequence.hds
+//   ./convert_sequence /data/run42/ run42.hds --scale 0.0001
+//
+// load_reference_sequence uses sequence.hds in place of the PNGs when it exists.
+
+using namespace cv;
+using namespace std;
+
+int main(int argc, char** argv)
+{
+	utils::logging::setLogLevel(utils::logging::LogLevel::LOG_LEVEL_SILENT);
+
+	vector<string> paths;
+	float depth_scale = HUE_MM_SCALE;
+	bool valid = true;
+	for (int i=1; i<argc; i++)
+	{
+		string arg = argv[i];
+		if (arg == "--scale" && i+1 < argc) depth_scale = stof(argv[++i]);
+		else if (arg.size() > 1 && arg[0] == '-') valid = false;
+		else paths.push_back(arg);
+	}
+
+	if (!valid || paths.empty() || paths.size() > 2)
+	{
+		fmt::print("Usage: convert_sequence PNG_DIRECTORY [OUTPUT.hds] [--scale METRES_PER_UNIT]\n");
+		return EXIT_FAILURE;
+	}
+
+	string directory = paths[0];
+	if (directory.back() != '/') directory += '/';
+	string output = paths.size() > 1 ? paths[1] : directory + "sequence.hds";
+
+	vector<String> files;
+	glob(directory + "*.png", files, false);
+	if (files.empty())
+	{
+		fmt::print("No PNG files in {}\n", directory);
+		return EXIT_FAILURE;
+	}
+
+	HueSequenceWriter writer;
+	for (const String& file : files)
+	{
+		Mat frame = imread(file, IMREAD_ANYDEPTH);
+		if (frame.empty() || frame.channels() != 1)
+		{
+			fmt::print("Could not read a depth frame from {}\n", file);
+			return EXIT_FAILURE;
+		}
+
+		if (!writer.is_open() && !writer.open(output, frame.size(), frame.type(), depth_scale))
+		{
+			fmt::print("Could not create {}\n", output);
+			return EXIT_FAILURE;
+		}
+
+		if (!writer.write(frame))
+		{
+			fmt::print("Could not write {} (all frames must have the same size and type)\n", file);
+			return EXIT_FAILURE;
+		}
+	}
+
+	uint64_t count = writer.size();
+	if (!writer.close())
+	{
+		fmt::print("Could not write {}\n", output);
+		return EXIT_FAILURE;
+	}
+
+	fmt::print("Wrote {} frames to {}\n", count, output);
+	return EXIT_SUCCESS;
+}
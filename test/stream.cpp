@@ -0,0 +1,266 @@
+#include <hue_codec.h>	      				// The header-only hue codec
+#include <hue_stream.h>	      				// Depth streaming over TCP or UDP
+#include <hue_monitor.h>	      				// Online quality monitoring
+#include <fmt/core.h>	      				// formatted terminal output
+#include <algorithm>
+#include <chrono>			  				// frame pacing
+#include <thread>							// loopback receiver thread
+#include <opencv2/core/utils/logger.hpp>  	// OpenCV logging controls
+#include "../src/common.h"  				// common code
+
+// Depth streaming latency and throughput
+//
+// Streams a depth sequence from a HueStreamSender to a HueStreamReceiver at a
+// fixed frame rate and reports the end-to-end latency (capture to decoded depth),
+// the frame rate, the bitrate, and the number of dropped frames.
+//
+//   ./stream --mode loopback --fps 90 --udp        # both ends in this process
+//   ./stream --mode receive --port 5000            # on the processing node
+//   ./stream --mode send --host 10.0.0.2 --port 5000 --fps 90
+//
+// Across machines, latency is measured with the system clocks of both nodes.
+
+using namespace cv;
+using namespace std;
+
+struct StreamToolOptions
+{
+	string mode = "loopback";
+	string host = "127.0.0.1";
+	int port = 5000;
+	string seq_path = "../data/seq/";
+	int frame_count = -1;
+	int repeat = 10;				// times to send the sequence
+	float fps = 90.0f;
+	float depth_min_m = 0.3f;
+	float depth_max_m = 6.0f;
+	bool monitor = false;			// estimate the stream quality while sending
+	HueStreamOptions stream;
+};
+
+void print_usage()
+{
+	fmt::print("Usage: stream [options]\n"
+		"  --mode MODE         loopback, send, or receive (default loopback)\n"
+		"  --host HOST         receiver address for send mode (default 127.0.0.1)\n"
+		"  --port N            port (default 5000, loopback picks a free port)\n"
+		"  --udp               use UDP instead of TCP\n"
+		"  --format EXT        image format: png, jpg, webp, or raw (default webp)\n"
+		"  --quality Q         image format quality or PNG compression level\n"
+		"  --fps F             frame rate (default 90)\n"
+		"  --range MIN:MAX     depth range in metres (default 0.3:6.0)\n"
+		"  --seq PATH          depth sequence file (.hds) or directory (default ../data/seq/)\n"
+		"  --frames N          number of frames to read from the sequence (default: all)\n"
+		"  --repeat N          times to send the sequence (default 10)\n"
+		"  --monitor           estimate the PSNR of the stream while sending\n");
+}
+
+bool parse_option(const string& arg, const string& value, StreamToolOptions& o, string& format, int& quality)
+{	// Parse one option and its value (throws if a number does not parse)
+	if      (arg == "--mode")    o.mode = value;
+	else if (arg == "--host")    o.host = value;
+	else if (arg == "--port")    o.port = stoi(value);
+	else if (arg == "--format")  format = value;
+	else if (arg == "--quality") quality = stoi(value);
+	else if (arg == "--fps")     o.fps = stof(value);
+	else if (arg == "--seq")     o.seq_path = value;
+	else if (arg == "--frames")  o.frame_count = stoi(value);
+	else if (arg == "--repeat")  o.repeat = max(1, stoi(value));
+	else if (arg == "--range")
+	{
+		size_t colon = value.find(':');
+		if (colon == string::npos)
+		{
+			fmt::print("Invalid value for {}: {} (expected MIN:MAX)\n", arg, value);
+			return false;
+		}
+		o.depth_min_m = stof(value.substr(0, colon));
+		o.depth_max_m = stof(value.substr(colon+1));
+	}
+	else
+	{
+		fmt::print("Unknown option {}\n", arg);
+		return false;
+	}
+	return true;
+}
+
+bool parse_options(int argc, char** argv, StreamToolOptions& o)
+{
+	string format = "webp";
+	int quality = -1;
+	for (int i=1; i<argc; i++)
+	{
+		string arg = argv[i];
+		if (arg == "-h" || arg == "--help") return false;
+		if (arg == "--udp") { o.stream.transport = HueTransport::UDP; continue; }
+		if (arg == "--monitor") { o.monitor = true; continue; }
+		if (i+1 >= argc)
+		{
+			fmt::print("Missing value for {}\n", arg);
+			return false;
+		}
+
+		string value = argv[++i];
+		try
+		{
+			if (!parse_option(arg, value, o, format, quality)) return false;
+		}
+		catch (const exception&)
+		{	// stoi and stof throw on values that are not numbers or are out of range
+			fmt::print("Invalid value for {}: {}\n", arg, value);
+			return false;
+		}
+	}
+
+	if (!(o.fps > 0.0f))
+	{	// the frame period is 1/fps
+		fmt::print("Invalid value for --fps: {} (must be above 0)\n", o.fps);
+		return false;
+	}
+
+	if      (format == "raw")  { o.stream.format = "";      o.stream.params.clear(); }
+	else if (format == "png")  { o.stream.format = ".png";  o.stream.params = { IMWRITE_PNG_COMPRESSION, quality < 0 ? 1 : quality }; }
+	else if (format == "jpg")  { o.stream.format = ".jpg";  o.stream.params = { IMWRITE_JPEG_QUALITY, quality < 0 ? 90 : quality }; }
+	else if (format == "webp") { o.stream.format = ".webp"; o.stream.params = { IMWRITE_WEBP_QUALITY, quality < 0 ? 90 : quality }; }
+	else return false;
+
+	return o.mode == "loopback" || o.mode == "send" || o.mode == "receive";
+}
+
+void receive_frames(HueStreamReceiver& receiver, uint64_t count, float fps)
+{	// Receive until count frames arrived (0: forever) or the stream stops, then print statistics
+	Mat depth;
+	HueFrameInfo info;
+	vector<double> latencies;
+	while (count == 0 || receiver.stats().frames + receiver.stats().dropped < count)
+	{
+		if (!receiver.receive(depth, info, latencies.empty() ? 10000 : 1000)) break;
+		latencies.push_back(info.latency_ms());
+	}
+
+	const HueStreamStats& stats = receiver.stats();
+	if (latencies.empty())
+	{
+		fmt::print("No frames received.\n");
+		return;
+	}
+
+	sort(latencies.begin(), latencies.end());
+	auto percentile = [&](double p) { return latencies[min(latencies.size()-1, (size_t)(p * latencies.size()))]; };
+	fmt::print("Received {} frames ({} dropped) at {:.1f} fps, {:.1f} Mbps, {:.1f} kB per frame\n",
+		stats.frames, stats.dropped, stats.fps(), stats.mbps(), stats.bytes / 1000.0 / stats.frames);
+	fmt::print("Latency (capture to decoded depth): mean {:.2f} ms | p50 {:.2f} ms | p99 {:.2f} ms | max {:.2f} ms\n",
+		stats.mean_latency_ms(), percentile(0.5), percentile(0.99), stats.latency_max_ms);
+	fmt::print("Frame period at {:.0f} fps: {:.2f} ms\n", fps, 1000.0f / fps);
+}
+
+bool send_frames(HueStreamSender& sender, const vector<Mat>& sequence, int repeat, float fps, HueQualityMonitor* monitor=nullptr)
+{	// Send the sequence at a fixed frame rate
+	using namespace chrono;
+	auto period = duration_cast<steady_clock::duration>(duration<double>(1.0 / fps));
+	auto next = steady_clock::now();
+	for (int r=0; r<repeat; r++)
+	{
+		for (const Mat& depth : sequence)
+		{
+			this_thread::sleep_until(next);
+			next += period;
+			if (!sender.send(depth)) return false;
+			if (monitor) monitor->sample(0, depth);
+		}
+	}
+	sender.flush();
+
+	HueStreamStats stats = sender.stats();
+	fmt::print("Sent {} frames ({} dropped by the send queue) at {:.1f} fps, {:.1f} Mbps\n",
+		stats.frames, stats.dropped, stats.fps(), stats.mbps());
+
+	if (monitor)
+	{
+		monitor->flush();
+		HueQualityEstimate q = monitor->estimate(0);
+		if (!q.valid()) fmt::print("Too few frames were sampled for a quality estimate\n");
+		else
+		{
+			fmt::print("Estimated PSNR {:.2f} dB ({:.2f} to {:.2f}) from {} tiles of {} frames, {:.1f}% of a core\n",
+				q.psnr, q.psnr_low, q.psnr_high, q.tiles, q.frames_sampled, 100.0 * monitor->cpu_fraction());
+			for (const HueErrorPercentile& e : q.percentiles)
+			{
+				fmt::print("  p{:<4} error {:.1f} ({:.1f} to {:.1f})\n", e.p * 100.0, e.error, e.low, e.high);
+			}
+		}
+	}
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	utils::logging::setLogLevel(utils::logging::LogLevel::LOG_LEVEL_SILENT);
+
+	StreamToolOptions o;
+	if (!parse_options(argc, argv, o))
+	{
+		print_usage();
+		return EXIT_FAILURE;
+	}
+
+	if (o.mode == "receive")
+	{
+		HueStreamReceiver receiver(o.stream.transport);
+		if (!receiver.listen(o.port))
+		{
+			fmt::print("Could not listen on port {}\n", o.port);
+			return EXIT_FAILURE;
+		}
+		fmt::print("Listening on port {}\n", receiver.port());
+		receive_frames(receiver, 0, o.fps);
+		return EXIT_SUCCESS;
+	}
+
+	vector<Mat> sequence;
+	load_reference_sequence(o.seq_path, sequence, o.frame_count);
+	if (sequence.empty() || sequence.front().type() != CV_16U)
+	{
+		fmt::print("Could not read a 16-bit depth sequence from {}\n", o.seq_path);
+		return EXIT_FAILURE;
+	}
+
+	HueCodec codec(o.depth_min_m, o.depth_max_m);
+	HueStreamSender sender(codec, o.stream);
+
+	unique_ptr<HueQualityMonitor> monitor;
+	if (o.monitor)
+	{
+		HueMonitorOptions monitor_options;
+		monitor_options.format = o.stream.format;
+		monitor_options.params = o.stream.params;
+		if (o.stream.format.empty()) monitor_options.round_trip = [](const Mat& bgr) { return bgr; };
+		monitor.reset(new HueQualityMonitor());
+		monitor->add_stream(codec, monitor_options);
+	}
+
+	if (o.mode == "send")
+	{
+		if (!sender.connect(o.host, o.port))
+		{
+			fmt::print("Could not connect to {}:{}\n", o.host, o.port);
+			return EXIT_FAILURE;
+		}
+		return send_frames(sender, sequence, o.repeat, o.fps, monitor.get()) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	// Loopback: receive on a second thread in this process
+	HueStreamReceiver receiver(o.stream.transport);
+	if (!receiver.listen(0, "127.0.0.1") || !sender.connect("127.0.0.1", receiver.port()))
+	{
+		fmt::print("Could not open a loopback connection\n");
+		return EXIT_FAILURE;
+	}
+
+	uint64_t total = (uint64_t)sequence.size() * o.repeat;
+	thread receiver_thread([&] { receive_frames(receiver, total, o.fps); });
+	bool ok = send_frames(sender, sequence, o.repeat, o.fps, monitor.get());
+	receiver_thread.join();
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,431 @@
+#include <hue_codec.h>	      				// The header-only hue codec
+#include <hue_metrics.h>	   				// Depth quality metrics
+#include <fmt/core.h>	      				// formatted terminal output
+#include <atomic>							// work distribution between threads
+#include <chrono>			  				// performance timing
+#include <fstream>							// csv output
+#include <thread>							// worker threads
+#include <opencv2/core/utils/logger.hpp>  	// OpenCV logging controls
+#include "../src/common.h"  				// common code
+
+// Rate-distortion sweep
+//
+// Searches the image format x quality x depth range x colourization space for
+// a depth sequence and reports the Pareto front of (PSNR, bitrate, ms/frame)
+// along with a recommended configuration that satisfies the given constraints.
+//
+// Each (format, depth range, colourization) combination is a "chain" of
+// increasing quality settings. Chains are evaluated in parallel. Within a chain,
+// every setting is first evaluated on a few probe frames. Settings that clearly
+// violate a constraint are pruned without a full evaluation, and once a setting
+// exceeds a constraint that can only get worse with increasing quality, the rest
+// of the chain is skipped.
+//
+// Note that timings are measured while chains run concurrently; use --jobs 1 for
+// timings that are comparable to the benchmarks.
+
+using namespace cv;
+using namespace std;
+
+struct SweepFormat
+{
+	string name;
+	string ext;
+	int param_flag;
+	string param_name;
+	vector<int> qualities;	// ordered from cheapest to most expensive to encode
+	bool size_grows;		// the compressed size grows along the quality order
+	bool lossy;				// the PSNR changes along the quality order
+};
+
+struct SweepConfig
+{
+	const SweepFormat* format;
+	int quality;
+	float depth_min_m;
+	float depth_max_m;
+	bool inverted;
+};
+
+struct SweepResult
+{
+	SweepConfig config;
+	float psnr;			// pooled PSNR over the evaluated frames
+	float kbps;			// bitrate at the given frame rate
+	float bytes;		// mean compressed bytes per frame
+	float ms_save;		// mean hue encode + compress time per frame
+	float ms_load;		// mean decompress + hue decode time per frame
+	bool probe_only;	// only evaluated on the probe frames (pruned)
+
+	float ms() const { return ms_save + ms_load; }
+};
+
+struct SweepOptions
+{
+	string seq_path = "../data/seq/";
+	int frame_count = -1;
+	float depth_scale = HUE_MM_SCALE;
+	float psnr_max_m = 0.0f;	// PSNR peak depth (0 = sequence maximum)
+	float fps = 30.0f;
+	float min_psnr = 0.0f;		// constraints (0 = unconstrained)
+	float max_ms = 0.0f;
+	float max_kbps = 0.0f;
+	int probe_frames = 3;
+	int jobs = 0;
+	string csv_path;
+	vector<pair<float, float>> ranges;
+	vector<string> formats { "jpg", "webp", "png" };
+};
+
+const vector<SweepFormat> SWEEP_FORMATS {
+	{ "PNG",  "png",  IMWRITE_PNG_COMPRESSION, "IMWRITE_PNG_COMPRESSION", { 1, 3, 5, 7, 9 },                             false, false },
+	{ "JPEG", "jpg",  IMWRITE_JPEG_QUALITY,    "IMWRITE_JPEG_QUALITY",    { 10, 20, 30, 40, 50, 60, 70, 80, 90, 95, 100 }, true,  true  },
+	{ "WebP", "webp", IMWRITE_WEBP_QUALITY,    "IMWRITE_WEBP_QUALITY",    { 10, 20, 30, 40, 50, 60, 70, 80, 90, 95, 100 }, true,  true  },
+};
+
+SweepResult evaluate(const SweepConfig& config, const vector<Mat>& sequence, const vector<int>& frames, const DepthMetrics& metrics, float fps)
+{	// Round-trip the selected frames through hue encoding, compression,
+	// decompression and hue decoding, pooling the error over all frames.
+	using namespace chrono;
+
+	HueCodec codec(config.depth_min_m, config.depth_max_m, metrics.depth_scale(), config.inverted);
+	vector<int> params { config.format->param_flag, config.quality };
+	vector<uchar> compressed;
+	Mat encoded, decompressed, decoded;
+
+	DepthErrorStats error;
+	size_t bytes = 0;
+	duration<float, milli> time_save(0), time_load(0);
+
+	for (int f : frames)
+	{
+		auto t1 = high_resolution_clock::now();
+		codec.encode(sequence[f], encoded);
+		imencode("." + config.format->ext, encoded, compressed, params);
+		auto t2 = high_resolution_clock::now();
+		decompressed = imdecode(compressed, IMREAD_COLOR);
+		codec.decode(decompressed, decoded);
+		auto t3 = high_resolution_clock::now();
+
+		time_save += t2 - t1;
+		time_load += t3 - t2;
+		bytes += compressed.size();
+		error.merge(metrics.compare(sequence[f], decoded).error);
+	}
+
+	const float count = frames.size();
+	const float max_i = metrics.depth_max_m() / metrics.depth_scale();
+
+	SweepResult result;
+	result.config = config;
+	result.psnr = 20.0f * log10(max_i) - 10.0f * log10(error.mse());
+	result.bytes = bytes / count;
+	result.kbps = result.bytes * 8.0f * fps / 1000.0f;
+	result.ms_save = time_save.count() / count;
+	result.ms_load = time_load.count() / count;
+	result.probe_only = false;
+	return result;
+}
+
+bool meets_psnr(const SweepResult& r, const SweepOptions& o, float margin=0.0f) { return o.min_psnr <= 0 || r.psnr + margin >= o.min_psnr; }
+bool meets_ms  (const SweepResult& r, const SweepOptions& o, float margin=1.0f) { return o.max_ms   <= 0 || r.ms()   <= o.max_ms   * margin; }
+bool meets_kbps(const SweepResult& r, const SweepOptions& o, float margin=1.0f) { return o.max_kbps <= 0 || r.kbps   <= o.max_kbps * margin; }
+bool feasible  (const SweepResult& r, const SweepOptions& o) { return !r.probe_only && meets_psnr(r, o) && meets_ms(r, o) && meets_kbps(r, o); }
+
+void sweep_chain(const SweepFormat& format, float dmin, float dmax, bool inverted, const vector<Mat>& sequence,
+	const vector<int>& probe, const vector<int>& all, const DepthMetrics& metrics, const SweepOptions& o, vector<SweepResult>& results)
+{	// Evaluate a chain of quality settings with early pruning.
+	// Probe results are allowed some slack before a setting is pruned,
+	// as a few frames are not always representative of the whole sequence.
+	const float psnr_slack = 3.0f;	// dB
+	const float rate_slack = 1.25f;	// ratio
+
+	for (int q : format.qualities)
+	{
+		SweepConfig config { &format, q, dmin, dmax, inverted };
+		SweepResult r = evaluate(config, sequence, probe, metrics, o.fps);
+
+		// Every later setting in the chain is at least as slow (and for most formats, as large).
+		bool stop = !meets_ms(r, o, rate_slack) || (format.size_grows && !meets_kbps(r, o, rate_slack));
+		bool prune = stop || !meets_psnr(r, o, psnr_slack) || !meets_kbps(r, o, rate_slack);
+
+		if (!prune && probe.size() != all.size()) r = evaluate(config, sequence, all, metrics, o.fps);
+		r.probe_only = prune && probe.size() != all.size();
+		results.push_back(r);
+
+		if (stop) break;
+		if (!prune && !meets_ms(r, o)) break;
+		if (!format.lossy && !meets_psnr(r, o, psnr_slack)) break;	// every setting decodes identically
+	}
+}
+
+vector<SweepResult> pareto_front(const vector<SweepResult>& results)
+{	// A result is on the Pareto front if no other result has a higher or equal PSNR,
+	// a lower or equal bitrate, and a lower or equal time, while being strictly better in one.
+	vector<SweepResult> front;
+	for (const SweepResult& a : results)
+	{
+		if (a.probe_only) continue;
+		bool dominated = false;
+		for (const SweepResult& b : results)
+		{
+			if (b.probe_only) continue;
+			bool no_worse = b.psnr >= a.psnr && b.kbps <= a.kbps && b.ms() <= a.ms();
+			bool better   = b.psnr >  a.psnr || b.kbps <  a.kbps || b.ms() <  a.ms();
+			if (no_worse && better) { dominated = true; break; }
+		}
+		if (!dominated) front.push_back(a);
+	}
+	sort(front.begin(), front.end(), [](const SweepResult& a, const SweepResult& b) { return a.kbps < b.kbps; });
+	return front;
+}
+
+const SweepResult* recommend(const vector<SweepResult>& front, const SweepOptions& o)
+{	// If a bitrate budget is given without a PSNR target, maximize the PSNR within the budget.
+	// Otherwise, minimize the bitrate while meeting the remaining constraints.
+	// Ties are broken by the per-frame time.
+	const bool maximize_psnr = o.max_kbps > 0 && o.min_psnr <= 0;
+	const SweepResult* best = nullptr;
+	for (const SweepResult& r : front)
+	{
+		if (!feasible(r, o)) continue;
+		if (best == nullptr) { best = &r; continue; }
+
+		float gain = maximize_psnr ? r.psnr - best->psnr : best->kbps - r.kbps;
+		if (gain > 0 || (gain == 0 && r.ms() < best->ms())) best = &r;
+	}
+	return best;
+}
+
+void depth_percentiles(const vector<Mat>& sequence, float lower, float upper, int& vlower, int& vupper)
+{	// Calculate percentiles of the non-zero depth values over the whole sequence.
+	vector<uint64_t> histogram(65536, 0);
+	uint64_t count = 0;
+	for (const Mat& frame : sequence)
+	{
+		for (int i=0; i<frame.rows; i++)
+		{
+			const uint16_t* row = frame.ptr<uint16_t>(i);
+			for (int j=0; j<frame.cols; j++) histogram[row[j]]++;
+		}
+	}
+	histogram[0] = 0;
+	for (uint64_t h : histogram) count += h;
+
+	vlower = vupper = 0;
+	uint64_t cum = 0;
+	for (int v=1; v<65536; v++)
+	{
+		cum += histogram[v];
+		if (vlower == 0 && cum > lower * count) vlower = v;
+		if (cum >= upper * count) { vupper = v; break; }
+	}
+}
+
+void print_result_header()
+{
+	fmt::print("| Format | Q   | depth range (m) | inv | PSNR  | kB/frame | kbps     | save (ms) | load (ms) |\n");
+}
+
+void print_result(const SweepResult& r)
+{
+	fmt::print("| {:<6} | {:>3} | {:>6.2f} - {:<6.2f} | {:>3} | {:5.1f} | {:>8.1f} | {:>8.0f} | {:>9.1f} | {:>9.1f} |\n",
+		r.config.format->name, r.config.quality, r.config.depth_min_m, r.config.depth_max_m,
+		r.config.inverted ? "yes" : "no", r.psnr, r.bytes / 1000.0f, r.kbps, r.ms_save, r.ms_load);
+}
+
+void write_csv(const string& path, const vector<SweepResult>& results)
+{
+	ofstream ofs(path);
+	ofs << "format,quality,depth_min_m,depth_max_m,inverted,psnr,bytes_per_frame,kbps,ms_save,ms_load,probe_only\n";
+	for (const SweepResult& r : results)
+	{
+		ofs << fmt::format("{},{},{},{},{},{},{},{},{},{},{}\n", r.config.format->ext, r.config.quality,
+			r.config.depth_min_m, r.config.depth_max_m, (int)r.config.inverted, r.psnr, r.bytes, r.kbps,
+			r.ms_save, r.ms_load, (int)r.probe_only);
+	}
+}
+
+void print_usage()
+{
+	fmt::print(
+		"Usage: sweep [options]\n"
+		"  --seq PATH          depth sequence file (.hds) or directory containing frame_00000.png... (default ../data/seq/)\n"
+		"  --frames N          number of frames to read (default: all)\n"
+		"  --scale S           depth scale in metres per unit (default 0.001)\n"
+		"  --range MIN:MAX     depth range in metres to try (repeatable, default: derived from the data)\n"
+		"  --formats LIST      comma-separated image formats from png,jpg,webp (default: jpg,webp,png)\n"
+		"  --fps F             frame rate used for bitrates (default 30)\n"
+		"  --min-psnr DB       minimum PSNR constraint\n"
+		"  --max-ms MS         maximum save + load time per frame constraint\n"
+		"  --max-kbps KBPS     maximum bitrate constraint\n"
+		"  --psnr-max M        PSNR peak depth in metres (default: sequence maximum)\n"
+		"  --probe N           number of probe frames used for pruning (default 3)\n"
+		"  --jobs N            number of worker threads (default: hardware concurrency)\n"
+		"  --csv PATH          write every evaluated configuration to a csv file\n");
+}
+
+bool parse_option(const string& arg, const string& value, SweepOptions& o)
+{	// Parse one option and its value (throws if a number does not parse)
+	if      (arg == "--seq")      o.seq_path = value;
+	else if (arg == "--frames")   o.frame_count = stoi(value);
+	else if (arg == "--scale")    o.depth_scale = stof(value);
+	else if (arg == "--fps")      o.fps = stof(value);
+	else if (arg == "--min-psnr") o.min_psnr = stof(value);
+	else if (arg == "--max-ms")   o.max_ms = stof(value);
+	else if (arg == "--max-kbps") o.max_kbps = stof(value);
+	else if (arg == "--psnr-max") o.psnr_max_m = stof(value);
+	else if (arg == "--probe")    o.probe_frames = max(1, stoi(value));
+	else if (arg == "--jobs")     o.jobs = stoi(value);
+	else if (arg == "--csv")      o.csv_path = value;
+	else if (arg == "--range")
+	{
+		size_t sep = value.find(':');
+		if (sep == string::npos)
+		{
+			fmt::print("Invalid value for {}: {} (expected MIN:MAX)\n", arg, value);
+			return false;
+		}
+		o.ranges.emplace_back(stof(value.substr(0, sep)), stof(value.substr(sep+1)));
+	}
+	else if (arg == "--formats")
+	{
+		o.formats.clear();
+		stringstream ss(value);
+		for (string f; getline(ss, f, ',');) o.formats.push_back(f);
+	}
+	else
+	{
+		fmt::print("Unknown option {}\n", arg);
+		return false;
+	}
+	return true;
+}
+
+bool parse_options(int argc, char** argv, SweepOptions& o)
+{
+	for (int i=1; i<argc; i++)
+	{
+		string arg = argv[i];
+		if (arg == "-h" || arg == "--help") return false;
+		if (i+1 >= argc)
+		{
+			fmt::print("Missing value for {}\n", arg);
+			return false;
+		}
+
+		string value = argv[++i];
+		try
+		{
+			if (!parse_option(arg, value, o)) return false;
+		}
+		catch (const exception&)
+		{	// stoi and stof throw on values that are not numbers or are out of range
+			fmt::print("Invalid value for {}: {}\n", arg, value);
+			return false;
+		}
+	}
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	utils::logging::setLogLevel(utils::logging::LogLevel::LOG_LEVEL_SILENT);
+
+	SweepOptions o;
+	if (!parse_options(argc, argv, o))
+	{
+		print_usage();
+		return EXIT_FAILURE;
+	}
+
+	vector<Mat> sequence;
+	load_reference_sequence(o.seq_path, sequence, o.frame_count);
+	if (sequence.empty() || sequence.front().type() != CV_16U)
+	{
+		fmt::print("Could not read a 16-bit depth sequence from {}\n", o.seq_path);
+		return EXIT_FAILURE;
+	}
+
+	// Candidate depth ranges: the full data range and a 1-99 percentile range unless specified
+	int vmin, vmax, vlow, vhigh;
+	depth_percentiles(sequence, 0.0f, 1.0f, vmin, vmax);
+	depth_percentiles(sequence, 0.01f, 0.99f, vlow, vhigh);
+	if (o.ranges.empty())
+	{
+		o.ranges.emplace_back(vmin * o.depth_scale, vmax * o.depth_scale);
+		if (vlow != vmin || vhigh != vmax) o.ranges.emplace_back(vlow * o.depth_scale, vhigh * o.depth_scale);
+	}
+	if (o.psnr_max_m <= 0) o.psnr_max_m = (vmax + 1) * o.depth_scale;
+
+	vector<const SweepFormat*> formats;
+	for (const string& f : o.formats)
+	{
+		auto it = find_if(SWEEP_FORMATS.begin(), SWEEP_FORMATS.end(), [&](const SweepFormat& s) { return s.ext == f; });
+		if (it != SWEEP_FORMATS.end()) formats.push_back(&*it);
+		else fmt::print("Skipping unknown format {}\n", f);
+	}
+
+	// Probe frames are spread evenly over the sequence
+	vector<int> all(sequence.size()), probe;
+	for (size_t i=0; i<all.size(); i++) all[i] = i;
+	int probe_count = min<int>(o.probe_frames, all.size());
+	for (int i=0; i<probe_count; i++) probe.push_back(all.size() * (2*i + 1) / (2*probe_count));
+
+	struct Chain { const SweepFormat* format; float dmin; float dmax; bool inverted; };
+	vector<Chain> chains;
+	for (const SweepFormat* f : formats)
+		for (const auto& range : o.ranges)
+			for (bool inverted : { false, true })
+				chains.push_back({ f, range.first, range.second, inverted });
+
+	fmt::print("Sweeping {} chains over {} frames of size {} x {}...\n", chains.size(), sequence.size(), sequence.front().cols, sequence.front().rows);
+
+	// Evaluate the chains in parallel
+	// OpenCV threading is disabled within workers to avoid oversubscription.
+	int jobs = o.jobs > 0 ? o.jobs : max(1u, thread::hardware_concurrency());
+	if (jobs > 1) cv::setNumThreads(1);
+
+	DepthMetrics metrics(o.psnr_max_m, o.depth_scale);
+	vector<vector<SweepResult>> chain_results(chains.size());
+	atomic<size_t> next(0);
+	vector<thread> workers;
+	for (int t=0; t<jobs; t++)
+	{
+		workers.emplace_back([&]()
+		{
+			for (size_t c=next++; c<chains.size(); c=next++)
+			{
+				const Chain& ch = chains[c];
+				sweep_chain(*ch.format, ch.dmin, ch.dmax, ch.inverted, sequence, probe, all, metrics, o, chain_results[c]);
+			}
+		});
+	}
+	for (thread& w : workers) w.join();
+
+	vector<SweepResult> results;
+	for (const auto& cr : chain_results) results.insert(results.end(), cr.begin(), cr.end());
+	size_t pruned = count_if(results.begin(), results.end(), [](const SweepResult& r) { return r.probe_only; });
+
+	fmt::print("Evaluated {} configurations ({} pruned after probing).\n", results.size(), pruned);
+	if (!o.csv_path.empty()) write_csv(o.csv_path, results);
+
+	vector<SweepResult> front = pareto_front(results);
+	fmt::print("\n{:-<{}}\n", "Pareto front (PSNR / bitrate / time) ", 80);
+	print_result_header();
+	for (const SweepResult& r : front) print_result(r);
+
+	const SweepResult* best = recommend(front, o);
+	fmt::print("\n{:-<{}}\n", "Recommended configuration ", 80);
+	if (best == nullptr)
+	{
+		fmt::print("No configuration satisfies the constraints.\n");
+		return EXIT_FAILURE;
+	}
+	print_result_header();
+	print_result(*best);
+	fmt::print("\nHueCodec codec({:.2f}f, {:.2f}f, {}f, {});\n", best->config.depth_min_m, best->config.depth_max_m,
+		o.depth_scale, best->config.inverted ? "true" : "false");
+	fmt::print("vector<int> params {{ {}, {} }};  // .{}\n", best->config.format->param_name, best->config.quality, best->config.format->ext);
+	return EXIT_SUCCESS;
+}
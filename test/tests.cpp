@@ -3,11 +3,52 @@
 #include <fmt/core.h>	      	// formatted terminal output
 #include <fmt/color.h>	      	// formatted ANSI terminal output
 #include <hue_codec.h>	      	// The header-only hue codec
+#include <hue_archive.h>      	// Asynchronous image archives
+#include <hue_async.h>        	// Asynchronous encoding and decoding
+#include <hue_codec_hb.h>     	// High bit-depth hue codec
+#include <hue_curve.h>        	// Custom transfer curves
+#include <hue_dual.h>         	// Dual-layer coarse/fine encoding
+#include <hue_monitor.h>      	// Online quality monitoring
+#include <hue_mosaic.h>       	// Multi-stream mosaic packing
+#include <hue_near_lossless.h>	// Near-lossless encoding with a bounded error
+#include <hue_perf.h>         	// Hardware performance counters
+#include <hue_pool.h>         	// Frame buffer pool
+#include <hue_pyramid.h>      	// Multi-resolution pyramid encoding
+#include <hue_rate.h>         	// Rate control for image compression
+#include <hue_rvl.h>          	// Fast lossless depth compression
+#include <hue_schemes.h>      	// Alternative encoding schemes
+#include <hue_sequence.h>     	// Raw depth sequence files
+#include <hue_stream.h>       	// Depth streaming over TCP or UDP
+#include <hue_strip.h>        	// Row-strip streaming encoding and decoding
+#ifdef HUE_HAVE_LIBAV
+#include <hue_video.h>        	// Native libav video input/output
+#endif
+#include <atomic>
+#include <chrono>
 #include <cmath>				// ceil function
+#include <cstdlib>
+#include <future>
+#include <new>
 #include "../src/common.h"		// common code
 
 using namespace cv;
 
+// Test hook: count every heap allocation made through operator new
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"	// false positive with replaced operator new
+#endif
+static std::atomic<size_t> heap_allocations(0);
+
+void* operator new(size_t size)
+{
+	heap_allocations++;
+	if (void* p = std::malloc(size ? size : 1)) return p;
+	throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
 TEST_CASE("test encoder code points")
 {
 	for (auto i(code_points_bgr.begin()); i!=code_points_bgr.end(); ++i)
@@ -62,3 +103,1468 @@ TEST_CASE("test HueCodec encode against decode")
 		}
 	}
 }
+
+TEST_CASE("test DepthMetrics against a naive comparison")
+{	// Compare the single-pass metrics against a straightforward per-pixel loop.
+
+	const float depth_max_m = 6.0f;
+	const float depth_scale = HUE_MM_SCALE;
+	const int max_i = depth_max_m / depth_scale;
+
+	Mat ref  = generate_synthetic_depth(97, 61, 0, 7000);
+	Mat test = ref.clone();
+	for (int i=0; i<test.rows; i++)
+	{
+		for (int j=0; j<test.cols; j++)
+		{
+			uint16_t& v = test.at<uint16_t>(i, j);
+			if ((i + j) % 7 == 0) v = 0;
+			else if ((i * j) % 5 == 0) v += (i % 3) * 11;
+			else if (v != 0 && (i + 2*j) % 11 == 0) v -= 1;
+		}
+	}
+
+	std::vector<float> edges { 0.0f, 2.0f, 4.0f, 6.0f };
+	DepthMetrics metrics(depth_max_m, depth_scale, edges);
+	DepthQuality q = metrics.compare(ref, test);
+
+	uint64_t count = 0, sum_abs = 0, sum_sq = 0, holes_filled = 0, holes_created = 0;
+	uint32_t max_abs = 0;
+	std::vector<uint64_t> bucket_count(3, 0);
+	for (int i=0; i<ref.rows; i++)
+	{
+		for (int j=0; j<ref.cols; j++)
+		{
+			int a = ref.at<uint16_t>(i, j);
+			int b = test.at<uint16_t>(i, j);
+			if (a == 0 && b != 0) holes_filled++;
+			if (a != 0 && b == 0) holes_created++;
+			if (a >= max_i || b >= max_i) continue;
+
+			uint32_t diff = std::abs(a - b);
+			count++;
+			sum_abs += diff;
+			sum_sq  += diff * diff;
+			max_abs = std::max(max_abs, diff);
+			bucket_count[(int)(a * depth_scale / 2.0f)]++;
+		}
+	}
+
+	CHECK(q.total == ref.total());
+	CHECK(q.error.count == count);
+	CHECK(q.error.sum_abs == sum_abs);
+	CHECK(q.error.sum_sq == sum_sq);
+	CHECK(q.error.max_abs == max_abs);
+	CHECK(q.holes_filled == holes_filled);
+	CHECK(q.holes_created == holes_created);
+	REQUIRE(q.buckets.size() == 3);
+	for (size_t k=0; k<q.buckets.size(); k++) CHECK(q.buckets[k].count == bucket_count[k]);
+
+	// Identical frames have no error
+	DepthQuality same = metrics.compare(ref, ref);
+	CHECK(same.error.max_abs == 0);
+	CHECK(same.error.mae() == 0.0);
+	CHECK(same.hole_rate_change() == 0.0);
+}
+
+TEST_CASE("test compile-time hue encoding table")
+{
+	static_assert(HUE_ENCODE_TABLE.bgr[256][0] == 0 && HUE_ENCODE_TABLE.bgr[256][1] == 255 && HUE_ENCODE_TABLE.bgr[256][2] == 255, "yellow");
+	static_assert(hue_decode_value(255, 0, 255) == 1276, "purple");
+
+	for (int v=0; v<=HUE_ENCODER_MAX; v++)
+	{
+		const uint8_t* bgr = HUE_ENCODE_TABLE.bgr[v];
+		CHECK(Vec3b(bgr[0], bgr[1], bgr[2]) == hue_encode_value(v));
+	}
+}
+
+TEST_CASE("test branchless decoder against decoder")
+{	// Exhaustively compare both decoders over all 8-bit RGB colours
+	int mismatches = 0;
+	for (int r=0; r<256; r++)
+		for (int g=0; g<256; g++)
+			for (int b=0; b<256; b++)
+				mismatches += hue_decode_value(r, g, b) != hue_decode_value_branchless(r, g, b);
+	CHECK(mismatches == 0);
+}
+
+TEST_CASE("test HueRVLCodec encode against decode")
+{	// Lossless for smooth depth with holes, noise, and edge cases
+	HueRVLCodec rvl;
+	Mat depth = generate_synthetic_depth(161, 97, 300, 9000);
+	depth(Rect(20, 10, 30, 40)).setTo(0);
+	depth.row(96).setTo(0);	// ends with a run of zeros
+	Mat noise(depth.size(), CV_16U);
+	uint32_t seed = 12345;
+	for (int i=0; i<noise.rows; i++)
+	{
+		for (int j=0; j<noise.cols; j++) noise.at<uint16_t>(i, j) = (seed = seed * 1664525u + 1013904223u) >> 16;
+	}
+
+	for (const Mat& frame : { depth, noise, Mat(Mat::zeros(7, 5, CV_16U)), Mat(1, 1, CV_16U, Scalar(65535)), Mat(depth(Rect(3, 5, 50, 20))) })
+	{
+		std::vector<uchar> compressed;
+		rvl.encode(frame, compressed);
+		Mat decoded;
+		REQUIRE(rvl.decode(compressed, decoded));
+		CHECK(decoded.size() == frame.size());
+		CHECK(cv::norm(decoded, frame, NORM_INF) == 0);
+	}
+
+	std::vector<uchar> compressed = rvl.encode(depth);
+	CHECK(compressed.size() < depth.total() / 2);	// under a nibble per pixel of smooth depth
+
+	Mat metres = rvl.decode(compressed, CV_32F);
+	REQUIRE(metres.type() == CV_32F);
+	CHECK(metres.at<float>(50, 100) == doctest::Approx(depth.at<uint16_t>(50, 100) * HUE_MM_SCALE));
+
+	Mat decoded;
+	CHECK(!rvl.decode(compressed.data(), compressed.size() / 2, decoded));	// truncated
+	compressed[0] = 'X';
+	CHECK(!rvl.decode(compressed, decoded));
+	CHECK(rvl.decode(std::vector<uchar>()).empty());
+}
+
+TEST_CASE("test TriangleScheme encoder against decoder")
+{	// Exact for every value, and robust to small channel errors
+	CHECK(TriangleScheme::decode(0, 0, 0) == 0);
+	for (int v=1; v<=TriangleScheme::MAX; v++)
+	{
+		const uint8_t* bgr = TriangleScheme::encode(v);
+		REQUIRE(TriangleScheme::decode(bgr[2], bgr[1], bgr[0]) == v);
+		CHECK(TriangleScheme::error(bgr[2], bgr[1], bgr[0]) == 0);
+
+		int r = std::min(255, bgr[2] + 3), g = std::max(0, bgr[1] - 2), b = std::max(0, bgr[0] - 2);
+		CHECK(std::abs(TriangleScheme::decode(r, g, b) - v) <= 2);
+	}
+
+	HueCodec hue(0.3f, 8.0f);
+	TriangleCodec triangle(0.3f, 8.0f);
+	Mat depth = generate_synthetic_depth(160, 120, 400, 7000);
+	Mat confidence;
+	Mat decoded_hue = hue.decode(hue.encode(depth));
+	Mat decoded_triangle;
+	triangle.decode(triangle.encode(depth), decoded_triangle, confidence);
+	CHECK(cv::norm(depth, decoded_triangle, NORM_INF) < cv::norm(depth, decoded_hue, NORM_INF));
+	CHECK(cv::countNonZero(confidence < 255) == 0);
+}
+
+template <bool Inverse>
+void encode_decode_t(const Mat& depth, const Mat& colours, Mat& encoded, Mat& decoded, Mat& encoded_bgra, Mat& decoded_bgra)
+{	// Run the specialised kernels for one colorization mode: encode and decode the
+	// depth as BGR and BGRA, and decode arbitrary colours (as after lossy compression)
+	HueCodecT<Inverse> codec(0.3f, 8.0f, HUE_MM_SCALE);
+	codec.encode(depth, encoded);
+	codec.decode(colours, decoded);
+
+	HueCodecT<Inverse, uint16_t, Vec4b> codec_bgra(0.3f, 8.0f, HUE_MM_SCALE);
+	codec_bgra.encode(depth, encoded_bgra);
+	codec_bgra.decode(encoded_bgra, decoded_bgra);
+}
+
+TEST_CASE("test HueCodecT against the scalar reference")
+{	// HueCodec dispatches into HueCodecT, so the kernels are compared per pixel with
+	// the scalar hue_encode_value and hue_decode_value and the depth scaling of
+	// the original per-pixel codec.
+	Mat depth = generate_synthetic_depth(160, 120, 0, 9000);
+
+	Mat colours(depth.size(), CV_8UC3);	// pseudo-random colours, mostly off the hue curve
+	uint32_t state = 1;
+	for (int i=0; i<colours.rows; i++)
+		for (int j=0; j<colours.cols; j++)
+			for (int c=0; c<3; c++)
+				colours.at<Vec3b>(i, j)[c] = (uchar)((state = state * 1664525u + 1013904223u) >> 24);
+
+	for (bool inverted : { false, true })
+	{
+		float min_u = 0.3f / HUE_MM_SCALE, max_u = 8.0f / HUE_MM_SCALE;
+		if (inverted)
+		{
+			min_u = 1.0f / min_u;
+			max_u = 1.0f / max_u;
+		}
+		const float range_u = max_u - min_u;
+
+		auto reference_encode = [&](uint16_t d)
+		{
+			if (d == 0) return hue_encode_value(0);
+			float u = inverted ? 1.0f / d : d;
+			return hue_encode_value((uint16_t)std::round(HUE_ENCODER_MAX * clamp((u - min_u) / range_u, 0.0f, 1.0f)));
+		};
+		auto reference_decode = [&](const Vec3b& bgr)
+		{
+			uint16_t v = hue_decode_value(bgr);
+			if (v == 0) return (uint16_t)0;
+			float u = min_u + (range_u * v / HUE_ENCODER_MAX);
+			return (uint16_t)std::min(std::round(inverted ? 1.0f / u : u), 65535.0f);
+		};
+
+		Mat encoded, decoded, encoded_bgra, decoded_bgra;
+		if (inverted) encode_decode_t<true>(depth, colours, encoded, decoded, encoded_bgra, decoded_bgra);
+		else          encode_decode_t<false>(depth, colours, encoded, decoded, encoded_bgra, decoded_bgra);
+		REQUIRE(encoded.type() == CV_8UC3);
+		REQUIRE(decoded.type() == CV_16U);
+		REQUIRE(encoded_bgra.type() == CV_8UC4);
+		REQUIRE(decoded_bgra.type() == CV_16U);
+
+		int encode_mismatches = 0, decode_mismatches = 0, bgra_mismatches = 0;
+		for (int i=0; i<depth.rows; i++)
+		{
+			for (int j=0; j<depth.cols; j++)
+			{
+				Vec3b bgr = reference_encode(depth.at<uint16_t>(i, j));
+				Vec4b bgra = encoded_bgra.at<Vec4b>(i, j);
+				encode_mismatches += encoded.at<Vec3b>(i, j) != bgr;
+				bgra_mismatches += Vec3b(bgra[0], bgra[1], bgra[2]) != bgr || bgra[3] != 255;
+				bgra_mismatches += decoded_bgra.at<uint16_t>(i, j) != reference_decode(bgr);
+				decode_mismatches += decoded.at<uint16_t>(i, j) != reference_decode(colours.at<Vec3b>(i, j));
+			}
+		}
+		CHECK(encode_mismatches == 0);
+		CHECK(decode_mismatches == 0);
+		CHECK(bgra_mismatches == 0);
+	}
+}
+
+TEST_CASE("test HueCodec float metre input and output")
+{	// Float metre input must encode the same as the equivalent integer depth.
+	Mat depth = generate_synthetic_depth(160, 120, 0, 9000);
+	Mat depth_m(depth.size(), CV_32F);
+	for (int i=0; i<depth.rows; i++)
+		for (int j=0; j<depth.cols; j++)
+			depth_m.at<float>(i, j) = depth.at<uint16_t>(i, j) * HUE_MM_SCALE;
+
+	for (bool inverted : { false, true })
+	{
+		HueCodec codec(0.3f, 8.0f, HUE_MM_SCALE, inverted);
+		Mat encoded   = codec.encode(depth);
+		Mat encoded_m = codec.encode(depth_m);
+		REQUIRE(encoded_m.type() == CV_8UC3);
+
+		Mat decoded = codec.decode(encoded);
+		Mat decoded_m;
+		codec.decode(encoded_m, decoded_m, CV_32F);
+		REQUIRE(decoded_m.type() == CV_32F);
+
+		int max_index_diff = 0;
+		float max_m_diff = 0.0f;
+		for (int i=0; i<depth.rows; i++)
+		{
+			for (int j=0; j<depth.cols; j++)
+			{
+				int a = hue_decode_value(encoded.at<Vec3b>(i, j));
+				int b = hue_decode_value(encoded_m.at<Vec3b>(i, j));
+				max_index_diff = std::max(max_index_diff, std::abs(a - b));
+				if (a == b) max_m_diff = std::max(max_m_diff, std::abs(decoded.at<uint16_t>(i, j) * HUE_MM_SCALE - decoded_m.at<float>(i, j)));
+			}
+		}
+		CHECK(max_index_diff <= 1);
+		CHECK(max_m_diff <= 0.0006f);	// rounding to the nearest mm
+	}
+}
+
+TEST_CASE("test HueCodec point cloud decoding against deprojection")
+{
+	const int width = 64, height = 48;
+	Mat depth(height, width, CV_16U);
+	for (int i=0; i<height; i++)
+		for (int j=0; j<width; j++) depth.at<uint16_t>(i, j) = ((i * j) % 7 == 0) ? 0 : 500 + 37*i + 11*j;
+
+	HueIntrinsics k { 60.0f, 62.0f, 31.5f, 24.0f };
+	for (bool inverse : { false, true })
+	{
+		HueCodec codec(0.3f, 4.0f, HUE_MM_SCALE, inverse);
+		Mat encoded = codec.encode(depth);
+		Mat depth_m, cloud;
+		codec.decode(encoded, depth_m, CV_32F);
+		codec.decode_points(encoded, cloud, k);
+		REQUIRE(cloud.type() == CV_32FC3);
+
+		std::vector<Point3f> points;
+		codec.decode_points(encoded, points, k);
+
+		size_t n = 0;
+		for (int i=0; i<height; i++)
+		{
+			for (int j=0; j<width; j++)
+			{
+				float d = depth_m.at<float>(i, j);
+				Vec3f p = cloud.at<Vec3f>(i, j);
+				if (d == 0.0f)
+				{
+					CHECK(std::isnan(p[2]));
+					continue;
+				}
+
+				CHECK(p[0] == doctest::Approx((j - k.cx) * d / k.fx).epsilon(1e-5));
+				CHECK(p[1] == doctest::Approx((i - k.cy) * d / k.fy).epsilon(1e-5));
+				CHECK(p[2] == doctest::Approx(d).epsilon(1e-5));
+
+				REQUIRE(n < points.size());
+				CHECK(points[n].x == p[0]);
+				CHECK(points[n].z == p[2]);
+				n++;
+			}
+		}
+		CHECK(n == points.size());
+	}
+}
+
+TEST_CASE("test HueCodec decoding confidence")
+{	// Exact hue colours have full confidence, colours pushed off the hue curve do not.
+	CHECK(hue_decode_confidence(255, 0, 0) == 255);
+	CHECK(hue_decode_confidence(0, 0, 0) == 255);
+	CHECK(hue_decode_confidence(240, 100, 10) == 230);	// max 15 too low, min 10 too high
+	CHECK(hue_decode_confidence(40, 40, 40) == 215);	// no data, 40 away from black
+	CHECK(hue_decode_confidence(128, 128, 128) == 0);
+
+	Mat depth = generate_synthetic_depth(160, 120, 0, 9000);
+	HueCodec codec(0.3f, 8.0f);
+	Mat encoded = codec.encode(depth);
+
+	Mat decoded, confidence;
+	codec.decode(encoded, decoded, confidence);
+	REQUIRE(confidence.type() == CV_8U);
+	CHECK(countNonZero(decoded != codec.decode(encoded)) == 0);
+	CHECK(countNonZero(confidence < 255) == 0);
+
+	// Damage a block of pixels and repair only those
+	for (int i=44; i<47; i++)
+		for (int j=64; j<67; j++) encoded.at<Vec3b>(i, j) = Vec3b(120, 60, 230);	// decodes to far depth
+
+	Mat decoded_m;
+	codec.decode(encoded, decoded_m, confidence, CV_32F);
+	REQUIRE(decoded_m.type() == CV_32F);
+	Mat mask = confidence < 224;
+	CHECK(countNonZero(mask) == 9);
+
+	codec.decode(encoded, decoded, confidence);
+	Mat filtered;
+	median_filter(decoded, filtered, 2, 0.0f, mask);
+	CHECK(filtered.at<uint16_t>(20, 20) == decoded.at<uint16_t>(20, 20));
+	CHECK(filtered.at<uint16_t>(45, 65) != decoded.at<uint16_t>(45, 65));
+	CHECK(countNonZero(decoded.row(decoded.rows-1)) > 0);
+	CHECK(countNonZero(filtered.row(decoded.rows-1) != decoded.row(decoded.rows-1)) == 0);	// border rows and columns
+	CHECK(countNonZero(filtered.col(decoded.cols-1) != decoded.col(decoded.cols-1)) == 0);
+
+	// Without a mask the border is zero, and a negative kernel_size is refused
+	median_filter(decoded, filtered, 2, 0.0f);
+	CHECK(countNonZero(filtered.row(decoded.rows-1)) == 0);
+	CHECK(countNonZero(filtered.col(decoded.cols-1)) == 0);
+	Mat untouched;
+	median_filter(decoded, untouched, -1);
+	CHECK(untouched.empty());
+}
+
+TEST_CASE("test HueCodec disparity input and output")
+{	// Disparity must encode the same as the equivalent depth map.
+	const float disparity_depth_m = 0.05f * 640.0f * 32.0f;	// baseline x focal length x subpixel factor
+	Mat depth = generate_synthetic_depth(160, 120, 500, 7000);
+	Mat disparity(depth.size(), CV_32F);
+	for (int i=0; i<depth.rows; i++)
+		for (int j=0; j<depth.cols; j++)
+			disparity.at<float>(i, j) = disparity_depth_m / (depth.at<uint16_t>(i, j) * HUE_MM_SCALE);
+
+	for (int test=0; test<4; test++)
+	{	// A depth_min of 0 is clamped as for depth input, so the range stays finite
+		const bool inverted = test & 1;
+		const float depth_min_m = test < 2 ? 0.5f : 0.0f;
+		HueCodec codec(depth_min_m, 7.0f, HUE_MM_SCALE, inverted);
+		Mat encoded = codec.encode(depth);
+		Mat encoded_disparity;
+		codec.encode_disparity(disparity, encoded_disparity, disparity_depth_m);
+		REQUIRE(encoded_disparity.type() == CV_8UC3);
+
+		Mat decoded_disparity;
+		codec.decode_disparity(encoded_disparity, decoded_disparity, disparity_depth_m, CV_32F);
+		REQUIRE(decoded_disparity.type() == CV_32F);
+
+		int max_index_diff = 0, valid = 0, non_finite = 0;
+		float max_rel_error = 0.0f;
+		for (int i=0; i<depth.rows; i++)
+		{
+			for (int j=0; j<depth.cols; j++)
+			{
+				int a = hue_decode_value(encoded.at<Vec3b>(i, j));
+				int b = hue_decode_value(encoded_disparity.at<Vec3b>(i, j));
+				max_index_diff = std::max(max_index_diff, std::abs(a - b));
+				valid += b != 0;
+
+				// Depths at or below depth_min encode to 0 (no data), as in HueCodec::encode
+				float ds = disparity.at<float>(i, j);
+				float dd = decoded_disparity.at<float>(i, j);
+				non_finite += !std::isfinite(dd);
+				if (a != 0) max_rel_error = std::max(max_rel_error, std::abs(dd - ds) / ds);
+			}
+		}
+		CHECK(max_index_diff <= 1);
+		CHECK(valid > 0);
+		CHECK(non_finite == 0);
+		if (depth_min_m > 0.0f || !inverted) CHECK(max_rel_error < 0.01f);	// an inverse range from 0 has no precision left
+	}
+}
+
+TEST_CASE("test high bit-depth value encoder against value decoder")
+{
+	for (uint32_t n : { 255u, 1023u, 4095u })
+	{
+		int mismatches = 0;
+		for (uint32_t value=0; value<=6*n; value++)
+		{
+			uint16_t r, g, b;
+			hue_encode_value_n(value, n, r, g, b);
+			mismatches += hue_decode_value_n(r, g, b, n) != value;
+
+			// With 8-bit channels the scheme is the same as hue_encode_value
+			if (n == 255) CHECK(Vec3b(b, g, r) == hue_encode_value(value));
+		}
+		CHECK(mismatches == 0);
+	}
+}
+
+TEST_CASE("test HueCodecHB encode against decode")
+{	// 10-bit and 12-bit channels give 4x and 16x finer quantization than 8-bit channels.
+	Mat depth = generate_synthetic_depth(200, 150, 0, 25000);
+
+	for (int bits : { 10, 12 })
+	{
+		HueCodecHB codec(0.0f, 25.0f, HUE_MM_SCALE, false, bits);
+		Mat encoded = codec.encode(depth);
+		REQUIRE(encoded.type() == CV_16UC3);
+		Mat decoded = codec.decode(encoded);
+		REQUIRE(decoded.type() == CV_16U);
+
+		// Maximum error is half of a quantization step
+		float step = 25000.0f / codec.encoder_max();
+		DepthQuality q = depth_quality(depth, decoded, 65.535f);
+		CHECK(q.error.max_abs <= (uint32_t)ceil(step / 2));
+	}
+
+	// P010 samples of a depth gradient match BT.709 limited range computed in double precision
+	HueCodecHB codec(0.5f, 5.0f, HUE_MM_SCALE, true, 10);
+	Mat gradient(4, 64, CV_16U);
+	for (int i=0; i<gradient.rows; i++)
+	{
+		for (int j=0; j<gradient.cols; j++) gradient.at<uint16_t>(i, j) = (uint16_t)(500 + 70*j + 3*i);
+	}
+	Mat encoded = codec.encode(gradient), p010;
+	codec.to_p010(encoded, p010);
+	REQUIRE(p010.rows == 6);
+	REQUIRE(p010.type() == CV_16UC1);
+
+	auto sample = [](double v) { return (uint16_t)((int)std::floor(std::min(std::max(v + 0.5, 0.0), 1023.0)) << 6); };
+	const double n = (1 << codec.bits()) - 1;
+	int mismatches = 0;
+	for (int i=0; i<gradient.rows; i+=2)
+	{
+		for (int j=0; j<gradient.cols; j+=2)
+		{
+			double pb = 0.0, pr = 0.0;
+			for (int k=0; k<2; k++)
+			{
+				for (int l=0; l<2; l++)
+				{
+					Vec3w p = encoded.at<Vec3w>(i+k, j+l);
+					double b = p[0] / n, g = p[1] / n, r = p[2] / n;
+					double luma = 0.2126*r + 0.7152*g + 0.0722*b;
+					mismatches += p010.at<uint16_t>(i+k, j+l) != sample(64.0 + 876.0 * luma);
+					pb += (b - luma) / 1.8556;
+					pr += (r - luma) / 1.5748;
+				}
+			}
+			mismatches += p010.at<uint16_t>(gradient.rows + i/2, j)   != sample(512.0 + 896.0 * pb / 4);
+			mismatches += p010.at<uint16_t>(gradient.rows + i/2, j+1) != sample(512.0 + 896.0 * pr / 4);
+		}
+	}
+	CHECK(mismatches == 0);
+
+	// Flat areas of colour survive the round trip through P010
+	Mat flat(8, 8, CV_16U, Scalar(1700));
+	Mat restored;
+	codec.to_p010(codec.encode(flat), p010);
+	REQUIRE(p010.rows == 12);
+	codec.from_p010(p010, restored);
+	Mat decoded = codec.decode(restored);
+	CHECK(std::abs(decoded.at<uint16_t>(3, 3) - 1700) < 10);
+
+	// Reallocation keeps the allocator of dst (e.g. a HueFramePool)
+	HueFramePool pool;
+	Mat pooled;
+	pooled.allocator = &pool;
+	codec.encode(gradient, pooled);
+	CHECK(pooled.allocator == &pool);
+	CHECK(pool.allocations() == 1);
+	codec.decode(encoded, pooled);
+	CHECK(pooled.allocator == &pool);
+}
+
+TEST_CASE("test HueCurveCodec against HueCodec")
+{	// Linear and inverse curves match HueCodec, and other curves move the error
+	const float depth_min_m = 0.3f, depth_max_m = 8.0f;
+	Mat depth = generate_synthetic_depth(320, 240, 400, 8000);
+
+	for (bool inverse : { false, true })
+	{
+		HueCodec codec(depth_min_m, depth_max_m, HUE_MM_SCALE, inverse);
+		HueCurve curve = inverse ? HueCurve::inverse(depth_min_m, depth_max_m) : HueCurve::linear(depth_min_m, depth_max_m);
+		REQUIRE(curve.valid());
+		HueCurveCodec curve_codec(curve);
+
+		Mat encoded = codec.encode(depth);
+		Mat curve_encoded = curve_codec.encode(depth);
+		int mismatches = 0;
+		for (int i=0; i<depth.rows; i++)
+		{
+			for (int j=0; j<depth.cols; j++)
+			{
+				int a = hue_decode_value(encoded.at<Vec3b>(i, j)), b = hue_decode_value(curve_encoded.at<Vec3b>(i, j));
+				mismatches += std::abs(a - b) > 1;
+			}
+		}
+		CHECK(mismatches == 0);
+		CHECK(cv::norm(depth, curve_codec.decode(curve_encoded), NORM_INF) <= cv::norm(depth, codec.decode(encoded), NORM_INF));
+
+		Mat metres;
+		curve_codec.decode(curve_encoded, metres, CV_32F);
+		REQUIRE(metres.type() == CV_32F);
+		CHECK(curve_codec.encode(metres).size() == depth.size());
+	}
+
+	// Curves that spend more levels near the sensor have smaller near errors
+	HueCurveCodec linear(HueCurve::linear(depth_min_m, depth_max_m));
+	Mat near = generate_synthetic_depth(100, 100, 400, 1000);
+	double linear_error = cv::norm(near, linear.decode(linear.encode(near)), NORM_INF);
+	std::vector<HueCurve> curves {
+		HueCurve::log(depth_min_m, depth_max_m),
+		HueCurve::power(depth_min_m, depth_max_m, 0.5f),
+		HueCurve::piecewise({ Point2f(0.3f, 0.0f), Point2f(1.0f, 0.5f), Point2f(8.0f, 1.0f) }),
+		HueCurve::accuracy({ Point2f(0.3f, 0.001f), Point2f(8.0f, 0.02f) }),
+	};
+	for (const HueCurve& curve : curves)
+	{
+		REQUIRE(curve.valid());
+		HueCurveCodec codec(curve);
+		CHECK(cv::norm(near, codec.decode(codec.encode(near)), NORM_INF) < linear_error);
+		for (int v=2; v<=HUE_ENCODER_MAX; v++) CHECK(curve.depth(v) >= curve.depth(v-1));
+	}
+
+	// User tables must have 65536 non-decreasing levels
+	std::vector<uint16_t> levels(65536);
+	for (int d=0; d<65536; d++) levels[d] = std::min(d / 4, (int)HUE_ENCODER_MAX);
+	HueCurve table = HueCurve::table(levels);
+	REQUIRE(table.valid());
+	CHECK(table.level(400) == 100);
+	CHECK(table.depth(100) == 402);
+	levels[1000] = 0;
+	CHECK(!HueCurve::table(levels).valid());
+	CHECK(!HueCurve::table(std::vector<uint16_t>(100)).valid());
+}
+
+TEST_CASE("test HueDualCodec encode against decode")
+{	// Fine precision with both layers, coarse precision when the fine layer is damaged
+	const float depth_min_m = 0.5f, depth_max_m = 60.0f;
+	Mat depth = generate_synthetic_depth(320, 240, 500, 60000);
+	for (bool inverse : { false, true })
+	{
+		HueDualCodec dual(depth_min_m, depth_max_m, HUE_MM_SCALE, inverse, 16);
+		HueCodec hue = dual.coarse_codec();
+		CHECK(dual.levels() == 1530 * 16 + 1);
+
+		Mat coarse, fine, decoded;
+		dual.encode(depth, coarse, fine);
+		REQUIRE(coarse.type() == CV_8UC3);
+		REQUIRE(fine.type() == CV_8UC3);
+		dual.decode(coarse, fine, decoded);
+		REQUIRE(decoded.type() == CV_16U);
+
+		Mat decoded_coarse = hue.decode(coarse);
+		Mat decoded_hue = hue.decode(hue.encode(depth));
+		double error_dual = cv::norm(depth, decoded, NORM_INF);
+		double error_hue = cv::norm(depth, decoded_hue, NORM_INF);
+		CHECK(error_dual * 8 < error_hue);
+		CHECK(cv::norm(depth, decoded_coarse, NORM_INF) <= error_hue);
+
+		// The coarse layer alone decodes to the coarse precision
+		Mat coarse_only;
+		dual.decode(coarse, Mat(), coarse_only);
+		CHECK(cv::norm(depth, coarse_only, NORM_INF) <= error_hue);
+
+		// Coarse errors of a few hue levels do not change the result
+		Mat shifted = depth.clone();
+		float level_m = (depth_max_m - depth_min_m) / 1530;
+		if (!inverse)
+		{
+			int offset = (int)(3 * level_m / HUE_MM_SCALE);
+			for (int i=0; i<shifted.rows; i++)
+				for (int j=0; j<shifted.cols; j++)
+					shifted.at<uint16_t>(i, j) = std::min(shifted.at<uint16_t>(i, j) + offset, 60000);
+			Mat shifted_coarse, unused, decoded_shifted;
+			dual.encode(shifted, shifted_coarse, unused);
+			dual.decode(shifted_coarse, fine, decoded_shifted);
+			CHECK(cv::norm(decoded, decoded_shifted, NORM_INF) == 0);
+		}
+
+		// A corrupted block of the fine layer falls back to the coarse layer
+		Mat damaged = fine.clone();
+		Rect block(100, 100, 40, 40);
+		damaged(block).setTo(Scalar(128, 128, 128));
+		Mat repaired;
+		dual.decode(coarse, damaged, repaired);
+		CHECK(cv::norm(depth(block), repaired(block), NORM_INF) <= error_hue);
+		CHECK(cv::norm(depth(Rect(0, 0, 100, 100)), repaired(Rect(0, 0, 100, 100)), NORM_INF) <= error_dual);
+
+		Mat metres;
+		dual.decode(coarse, fine, metres, CV_32F);
+		CHECK(metres.type() == CV_32F);
+	}
+}
+
+TEST_CASE("test HueNearLosslessCodec error bound")
+{	// Every pixel is within max_error of the original, and no-data pixels stay 0
+	HueCodec codec(0.3f, 8.0f);
+	Mat depth = generate_synthetic_depth(160, 120, 300, 9000);
+	depth(Rect(40, 30, 20, 20)).setTo(0);
+	depth.at<uint16_t>(5, 5) = 65535;	// beyond the hue range
+	depth.at<uint16_t>(6, 6) = 1;		// below the hue range
+
+	HueNearLosslessOptions options;
+	options.format = ".jpg";
+	options.params = { IMWRITE_JPEG_QUALITY, 50 };
+	for (bool rvl : { false, true })
+	{
+		options.rvl_residual = rvl;
+		size_t lossless_size = 0;
+		for (int max_error : { 0, 1, 2, 10 })
+		{
+			options.max_error = max_error;
+			HueNearLosslessCodec near_lossless(codec, options);
+			std::vector<uchar> hue, residual;
+			REQUIRE(near_lossless.encode(depth, hue, residual));
+
+			Mat decoded;
+			REQUIRE(near_lossless.decode(hue, residual, decoded));
+			REQUIRE(decoded.size() == depth.size());
+			int worst = 0, invalid = 0;
+			for (int i=0; i<depth.rows; i++)
+			{
+				for (int j=0; j<depth.cols; j++)
+				{
+					int v = depth.at<uint16_t>(i, j), d = decoded.at<uint16_t>(i, j);
+					worst = std::max(worst, std::abs(v - d));
+					invalid += v == 0 && d != 0;
+				}
+			}
+			CHECK(worst <= max_error);
+			CHECK(invalid == 0);
+			if (max_error == 0) lossless_size = residual.size();
+			if (max_error == 10) CHECK(residual.size() <= lossless_size);	// a large bound needs no more bits
+
+			Mat metres;
+			REQUIRE(near_lossless.decode(hue, residual, metres, CV_32F));
+			CHECK(metres.at<float>(60, 80) == doctest::Approx(decoded.at<uint16_t>(60, 80) * HUE_MM_SCALE));
+		}
+	}
+
+	HueNearLosslessCodec near_lossless(codec, options);
+	std::vector<uchar> hue, residual;
+	REQUIRE(near_lossless.encode(depth, hue, residual));
+	Mat hue_only;
+	REQUIRE(near_lossless.decode(hue, std::vector<uchar>(), hue_only));
+	CHECK(cv::norm(hue_only, codec.decode(imdecode(hue, IMREAD_COLOR)), NORM_INF) == 0);
+
+	residual.resize(residual.size() / 2);
+	Mat decoded;
+	CHECK(!near_lossless.decode(hue, residual, decoded));
+}
+
+TEST_CASE("test HueMosaic pack against unpack")
+{	// Tiles must decode exactly as if each stream was encoded on its own.
+	std::vector<Mat> depth {
+		generate_synthetic_depth(100, 60, 0, 5000),
+		generate_synthetic_depth(90, 70, 300, 9000),
+		generate_synthetic_depth(100, 60, 1000, 3000),
+	};
+	std::vector<Mat> ir { Mat(50, 40, CV_8U, Scalar(77)) };
+	std::vector<HueCodec> codecs {
+		HueCodec(0.0f, 5.0f, HUE_MM_SCALE, false),
+		HueCodec(0.3f, 9.0f, HUE_MM_SCALE, true),
+		HueCodec(1.0f, 3.0f, HUE_MM_SCALE, false),
+	};
+
+	std::vector<Size> depth_sizes, ir_sizes { ir[0].size() };
+	for (const Mat& d : depth) depth_sizes.push_back(d.size());
+	MosaicLayout layout = MosaicLayout::grid(depth_sizes, ir_sizes);
+	REQUIRE(layout.tiles.size() == 4);
+	CHECK(layout.size == Size(2*112, 2*80));
+
+	// The layout survives serialization
+	MosaicLayout parsed;
+	REQUIRE(MosaicLayout::from_string(layout.to_string(), parsed));
+	REQUIRE(parsed.tiles.size() == layout.tiles.size());
+	for (size_t k=0; k<layout.tiles.size(); k++)
+	{
+		CHECK(parsed.tiles[k].kind == layout.tiles[k].kind);
+		CHECK(parsed.tiles[k].rect == layout.tiles[k].rect);
+	}
+	CHECK_FALSE(MosaicLayout::from_string("hue-mosaic 1 10 10 1\ndepth 0 0 20 20", parsed));
+
+	HueMosaic packer(layout, codecs);
+	Mat mosaic;
+	packer.pack(depth, ir, mosaic);
+	REQUIRE(mosaic.size() == layout.size);
+
+	HueMosaic unpacker(parsed, codecs);
+	std::vector<Mat> depth_out, ir_out;
+	unpacker.unpack(mosaic, depth_out, ir_out);
+	REQUIRE(depth_out.size() == depth.size());
+	REQUIRE(ir_out.size() == 1);
+
+	for (size_t k=0; k<depth.size(); k++)
+	{
+		Mat expected = codecs[k].decode(codecs[k].encode(depth[k]));
+		CHECK(depth_quality(expected, depth_out[k], 65.535f).error.max_abs == 0);
+	}
+	CHECK(ir_out[0].at<uint8_t>(10, 10) == 77);
+}
+
+TEST_CASE("test zero allocation steady state with HueFramePool")
+{
+	const int width = 320, height = 240;
+	Mat depth(height, width, CV_16U);
+	for (int i=0; i<height; i++)
+		for (int j=0; j<width; j++) depth.at<uint16_t>(i, j) = ((i + j) % 11 == 0) ? 0 : 500 + 7*i + 3*j;
+
+	HueCodec codec(0.3f, 4.0f);
+	HueFramePool pool;
+
+	// Filtering into a reused buffer must match filtering into a fresh buffer
+	Mat fresh = median_filter(depth, 1, 0.02f);
+	Mat reused(depth.size(), CV_16U, Scalar(12345));
+	median_filter(depth, reused, 1, 0.02f);
+	CHECK(countNonZero(fresh != reused) == 0);
+
+	size_t new_before = 0, pool_before = 0;
+	const uchar* first_encoded = nullptr;
+	Mat last;
+	for (int frame=0; frame<12; frame++)
+	{	// A new set of output buffers per frame, as a pipeline with frames in flight would use
+		if (frame == 2)
+		{	// Warmed up
+			new_before = heap_allocations;
+			pool_before = pool.allocations();
+		}
+
+		Mat encoded, decoded, filtered;
+		encoded.allocator = decoded.allocator = filtered.allocator = &pool;
+		codec.encode(depth, encoded);
+		codec.decode(encoded, decoded);
+		median_filter(decoded, filtered, 1, 0.02f);
+
+		if (frame == 2) first_encoded = encoded.data;
+		if (frame > 2) CHECK(encoded.data == first_encoded);
+		last = filtered;
+	}
+
+	CHECK(heap_allocations - new_before == 0);
+	CHECK(pool.allocations() == pool_before);
+	CHECK(pool.reused() >= 30);
+	Mat expected = codec.decode(codec.encode(depth));
+	expected = median_filter(expected, 1, 0.02f);
+	CHECK(countNonZero(last != expected) == 0);
+	last.release();
+
+	pool.trim();
+	CHECK(pool.bytes() == 0);
+}
+
+TEST_CASE("test HuePerfCounters")
+{	// Events that are not counted read as -1, and counted events measure the work
+	HuePerfCounters disabled(false);
+	CHECK(!disabled.available());
+	disabled.start();
+	HuePerfSample none = disabled.stop();
+	for (int c=0; c<HuePerfSample::COUNT; c++) CHECK(!none.has((HuePerfSample::Counter)c));
+	CHECK(none.ipc() == -1.0);
+	CHECK(none.bandwidth_gbs() == -1.0);
+
+	HueCodec codec(0.3f, 8.0f);
+	Mat depth = generate_synthetic_depth(320, 240, 300, 7000), encoded;
+	HuePerfCounters counters;
+	counters.start();
+	codec.encode(depth, encoded);
+	HuePerfSample sample = counters.stop();
+	CHECK(sample.seconds > 0.0);
+	if (sample.has(HuePerfSample::INSTRUCTIONS))
+	{
+		CHECK(sample.per_pixel(HuePerfSample::INSTRUCTIONS, (double)depth.total()) > 1.0);
+	}
+
+	HuePerfSample total = sample;
+	total += none;
+	CHECK(!total.has(HuePerfSample::CYCLES));
+	CHECK(total.seconds == doctest::Approx(sample.seconds + none.seconds));
+}
+
+TEST_CASE("test HuePyramid against HueCodec")
+{	// Every level is the subsampled full-resolution decode, at even and odd sizes
+	HueCodec codec(0.3f, 8.0f);
+	for (Size size : { Size(160, 120), Size(157, 101) })
+	{
+		Mat depth = generate_synthetic_depth(size.width, size.height, 300, 7000);
+		Mat expected = codec.decode(codec.encode(depth));
+
+		HuePyramid pyramid(codec, 3);
+		std::vector<Mat> layers;
+		pyramid.encode(depth, layers);
+		REQUIRE(layers.size() == 3);
+		CHECK(layers[0].size() == Size((size.width + 3) / 4, (size.height + 3) / 4));
+		CHECK(layers[2].size() == size);
+
+		for (int n=1; n<=3; n++)
+		{
+			Mat decoded;
+			pyramid.decode(layers, decoded, n);
+			REQUIRE(decoded.size() == HuePyramid::level_size(size, n-1, 3));
+			int step = 1 << (3 - n);
+			int mismatches = 0;
+			for (int i=0; i<decoded.rows; i++)
+			{
+				for (int j=0; j<decoded.cols; j++)
+				{
+					mismatches += decoded.at<uint16_t>(i, j) != expected.at<uint16_t>(i*step, j*step);
+				}
+			}
+			CHECK(mismatches == 0);
+		}
+
+		Mat progressive, metres;
+		pyramid.decode(layers, progressive, 2);
+		pyramid.refine(progressive, layers[2], progressive);
+		CHECK(cv::norm(progressive, expected, NORM_INF) == 0);
+
+		pyramid.decode(layers, metres, -1, CV_32F);
+		CHECK(metres.size() == size);
+		CHECK(metres.type() == CV_32F);
+	}
+}
+
+TEST_CASE("test HueSequenceWriter against HueSequenceReader")
+{
+	const std::string path = "test_sequence.hds";
+	const int width = 161, height = 37;	// rows are not a multiple of the frame alignment
+	std::vector<Mat> sequence;
+	for (int k=0; k<5; k++) sequence.push_back(generate_synthetic_depth(width, height, 100*k, 9000 + 100*k));
+
+	HueSequenceWriter writer;
+	REQUIRE(writer.open(path, sequence[0].size(), CV_16U, HUE_CM_SCALE));
+	for (const Mat& frame : sequence) CHECK(writer.write(frame));
+	CHECK(!writer.write(Mat(10, 10, CV_16U)));
+	CHECK(writer.close());
+
+	{
+		HueSequenceReader reader(path);
+		REQUIRE(reader.is_open());
+		CHECK(reader.size() == sequence.size());
+		CHECK(reader.frame_size() == sequence[0].size());
+		CHECK(reader.type() == CV_16U);
+		CHECK(reader.depth_scale() == HUE_CM_SCALE);
+		CHECK(reader.frame(sequence.size()).empty());
+
+		std::vector<Mat> mapped;
+		reader.frames(mapped, 3);
+		REQUIRE(mapped.size() == 3);
+		for (size_t k=0; k<mapped.size(); k++) CHECK(countNonZero(mapped[k] != sequence[k]) == 0);
+		CHECK(mapped[1].data == reader.frame(1).data);	// views, not copies
+		CHECK((size_t)mapped[1].data % 64 == 0);
+
+		// Writes to a frame are private to the mapping
+		mapped[2].setTo(Scalar(0));
+	}
+
+	HueSequenceReader reader(path);
+	std::vector<Mat> reloaded;
+	reader.frames(reloaded);
+	REQUIRE(reloaded.size() == sequence.size());
+	for (size_t k=0; k<reloaded.size(); k++) CHECK(countNonZero(reloaded[k] != sequence[k]) == 0);
+	reader.close();
+
+	// Corrupt headers are refused rather than giving views past the end of the file
+	std::vector<uint8_t> file;
+	{
+		std::FILE* f = std::fopen(path.c_str(), "rb");
+		REQUIRE(f);
+		for (int c; (c = std::fgetc(f)) != EOF;) file.push_back((uint8_t)c);
+		std::fclose(f);
+	}
+	auto opens_with = [&](size_t offset, uint64_t value, size_t bytes)
+	{
+		std::vector<uint8_t> corrupt = file;
+		for (size_t k=0; k<bytes; k++) corrupt[offset + k] = (uint8_t)(value >> (8*k));
+		const std::string corrupt_path = "test_sequence_corrupt.hds";
+		std::FILE* f = std::fopen(corrupt_path.c_str(), "wb");
+		std::fwrite(corrupt.data(), 1, corrupt.size(), f);
+		std::fclose(f);
+		bool ok = HueSequenceReader(corrupt_path).is_open();
+		std::remove(corrupt_path.c_str());
+		return ok;
+	};
+	CHECK(opens_with(12, CV_16U, 4));
+	CHECK(!opens_with(12, 0x1000, 4));					// not an OpenCV type
+	CHECK(!opens_with(12, CV_16UC3, 4));
+	CHECK(!opens_with(4, 0xFFFFFFFF, 4));				// negative as an int
+	CHECK(!opens_with(4, 0x7FFFFFFF, 4));				// frame larger than the file
+	CHECK(!opens_with(24, 64, 8));						// stride smaller than a frame
+	CHECK(!opens_with(32, file.size() + 1, 8));		// first frame past the end
+
+	std::remove(path.c_str());
+	CHECK(!HueSequenceReader(path).is_open());
+}
+
+TEST_CASE("test HueStripEncoder and HueStripDecoder against whole frames")
+{	// Strips of any height give the same rows as encoding, decoding, and median
+	// filtering the whole frame, including across strip boundaries
+	HueCodec codec(0.3f, 8.0f);
+	Mat depth = generate_synthetic_depth(53, 37, 300, 7000);
+	depth(Rect(10, 10, 6, 5)).setTo(0);	// a hole for the median filter to fill
+	Mat encoded = codec.encode(depth);
+	Mat decoded = codec.decode(encoded);
+
+	for (int kernel_size : { 0, 1, 2 })
+	{
+		Mat expected;
+		median_filter(decoded, expected, kernel_size, 0.02f);
+
+		for (int strip_rows : { 1, 4, 16, 37 })
+		{
+			Mat strip_encoded(depth.size(), CV_8UC3), strip_decoded(depth.size(), CV_16U);
+			int encoded_rows = 0, decoded_rows = 0;
+			bool in_order = true;
+
+			HueStripEncoder encoder(codec, depth.size(), [&](int row, const Mat& rows)
+			{
+				in_order &= row == encoded_rows;
+				rows.copyTo(strip_encoded.rowRange(row, row + rows.rows));
+				encoded_rows += rows.rows;
+			});
+			HueStripDecoder decoder(codec, depth.size(), [&](int row, const Mat& rows)
+			{
+				in_order &= row == decoded_rows;
+				rows.copyTo(strip_decoded.rowRange(row, row + rows.rows));
+				decoded_rows += rows.rows;
+			}, kernel_size, 0.02f);
+
+			for (int frame=0; frame<2; frame++)
+			{
+				encoded_rows = decoded_rows = 0;
+				for (int i=0; i<depth.rows; i+=strip_rows)
+				{
+					int n = std::min(strip_rows, depth.rows - i);
+					CHECK(encoder.push(depth.rowRange(i, i + n)));
+					CHECK(decoder.push(encoded.rowRange(i, i + n)));
+				}
+				CHECK(in_order);
+				CHECK(encoded_rows == depth.rows);
+				CHECK(decoded_rows == depth.rows);
+				CHECK(encoder.row() == 0);
+				CHECK(decoder.row() == 0);
+				CHECK(cv::norm(strip_encoded, encoded, NORM_INF) == 0);
+				CHECK(cv::norm(strip_decoded, expected, NORM_INF) == 0);
+			}
+		}
+	}
+
+	HueStripDecoder decoder(codec, depth.size(), [](int, const Mat&) {}, 1);
+	CHECK_FALSE(decoder.push(encoded.colRange(0, 20)));	// wrong width
+	CHECK_FALSE(decoder.push(depth.rowRange(0, 4)));	// wrong type
+	CHECK(decoder.push(encoded.rowRange(0, 30)));
+	CHECK_FALSE(decoder.push(encoded.rowRange(0, 8)));	// past the end of the frame
+}
+
+TEST_CASE("test HueQualityMonitor against DepthMetrics")
+{	// Once every tile is in the window, the estimate is exact for the tiled area
+	const int width = 320, height = 240, tile = 32;	// 10 x 7 tiles
+	Mat depth = generate_synthetic_depth(width, height, 300, 7000);
+	HueCodec codec(0.3f, 8.0f);
+
+	HueQualityMonitor monitor(1.0);
+	HueMonitorOptions options;
+	options.round_trip = [](const Mat& bgr) { return bgr.clone(); };	// lossless
+	options.tile_size = tile;
+	options.tiles_per_frame = 10;
+	options.window_tiles = 70;
+	int lossless = monitor.add_stream(codec, options);
+
+	options.round_trip = [](const Mat& bgr) { Mat noisy = bgr.clone(); noisy.setTo(Scalar(0, 0, 255)); return noisy; };
+	int broken = monitor.add_stream(codec, options);
+
+	CHECK(!monitor.estimate(lossless).valid());
+	for (int frame=0; frame<7; frame++)
+	{
+		CHECK(monitor.sample(lossless, depth));
+		monitor.flush();
+		CHECK(monitor.sample(broken, depth));
+		monitor.flush();
+	}
+
+	Rect tiled(0, 0, width, height / tile * tile);
+	Mat reference = depth(tiled).clone();
+	Mat decoded = codec.decode(codec.encode(reference));
+	DepthQuality exact = depth_quality(reference, decoded, 8.0f);
+
+	HueQualityEstimate q = monitor.estimate(lossless);
+	REQUIRE(q.valid());
+	CHECK(q.frames == 7);
+	CHECK(q.tiles == 70);
+	CHECK(q.pixels == exact.error.count);
+	CHECK(q.psnr == doctest::Approx(exact.psnr));
+	CHECK(q.psnr_low <= q.psnr);
+	CHECK(q.psnr_high >= q.psnr);
+	CHECK(q.mae == doctest::Approx(exact.error.mae()));
+	REQUIRE(q.percentiles.size() == 3);
+	CHECK(q.percentiles[2].error <= exact.error.max_abs);
+	CHECK(q.percentiles[0].low <= q.percentiles[0].error);
+	CHECK(q.percentiles[0].error <= q.percentiles[0].high);
+
+	HueQualityEstimate b = monitor.estimate(broken);
+	REQUIRE(b.valid());
+	CHECK(b.psnr_high < q.psnr_low);
+	CHECK(b.percentiles[0].error > 100);
+	CHECK(monitor.cpu_fraction() > 0.0);
+}
+
+TEST_CASE("test HueRateController limits")
+{	// The quality moves at most max_step per frame towards a target it cannot reach
+	Mat depth = generate_synthetic_depth(160, 120, 300, 7000);
+	HueCodec codec(0.3f, 8.0f);
+	std::vector<uchar> buffer;
+
+	HueRateOptions options;
+	options.initial_quality = 80;
+	options.max_step = 15;
+	options.target_bytes = 100;		// far below any compressed frame
+	HueRateController low(codec, options);
+	int quality = options.initial_quality;
+	for (int frame=0; frame<10; frame++)
+	{
+		REQUIRE(low.encode(depth, buffer));
+		CHECK(low.last().bytes == buffer.size());
+		CHECK(low.quality() <= quality);
+		CHECK(quality - low.quality() <= options.max_step);
+		quality = low.quality();
+	}
+	CHECK(low.quality() == options.min_quality);
+	CHECK(low.buffer_bytes() > 0.0);
+	CHECK(low.last().target == doctest::Approx(0.25 * options.target_bytes));
+
+	options.target_bytes = 100000000;	// far above any compressed frame
+	HueRateController high(codec, options);
+	for (int frame=0; frame<5; frame++) REQUIRE(high.encode(depth, buffer));
+	CHECK(high.quality() == options.max_quality);
+	CHECK(high.buffer_bytes() == doctest::Approx(-(double)options.target_bytes));	// limited to one frame
+
+	options.target_bytes = 0;
+	options.target_psnr = 300.0;		// above the PSNR of a lossless frame
+	HueRateController psnr(codec, options);
+	CHECK(psnr.psnr_mode());
+	for (int frame=0; frame<5; frame++) REQUIRE(psnr.encode(depth, buffer));
+	CHECK(psnr.last().psnr > 0.0);
+	CHECK(psnr.quality() == options.max_quality);
+
+	psnr.reset();
+	CHECK(psnr.quality() == options.initial_quality);
+
+	HueRateController none(codec, HueRateOptions());	// neither target set
+	CHECK(!none.has_target());
+	CHECK(!none.encode(depth, buffer));
+	CHECK(none.last().bytes == 0);
+}
+
+TEST_CASE("test HueRateController convergence")
+{	// On a fixed scene, the mean size (or PSNR) reaches a target that a quality
+	// within the limits can hit
+	Mat depth = generate_synthetic_depth(320, 240, 300, 7000);
+	HueCodec codec(0.3f, 8.0f);
+	Mat encoded = codec.encode(depth);
+	const int frames = 30;
+
+	// Size and PSNR of the scene at quality 60, as reachable targets
+	std::vector<uchar> buffer;
+	REQUIRE(cv::imencode(".jpg", encoded, buffer, { IMWRITE_JPEG_QUALITY, 60 }));
+	const size_t target_bytes = buffer.size();
+	const double target_psnr = depth_quality(depth, codec.decode(cv::imdecode(buffer, IMREAD_COLOR)), codec.depth_max_m(), codec.depth_scale()).psnr;
+	REQUIRE(std::isfinite(target_psnr));
+
+	HueRateOptions options;
+	options.format = ".jpg";
+	options.initial_quality = 90;
+	options.target_bytes = target_bytes;
+	HueRateController size_rate(codec, options);
+	double bytes = 0.0;
+	for (int frame=0; frame<frames; frame++)
+	{
+		REQUIRE(size_rate.encode(depth, buffer));
+		bytes += buffer.size();
+	}
+	CHECK(bytes / frames == doctest::Approx((double)target_bytes).epsilon(0.1));
+	CHECK(std::abs(size_rate.quality() - 60) <= 10);
+
+	options.target_bytes = 0;
+	options.target_psnr = target_psnr;
+	HueRateController psnr_rate(codec, options);
+	double psnr = 0.0;
+	for (int frame=0; frame<frames; frame++)
+	{
+		REQUIRE(psnr_rate.encode(depth, buffer));
+		if (frame >= frames - 10) psnr += psnr_rate.last().psnr;
+	}
+	CHECK(std::abs(psnr / 10 - target_psnr) < 1.0);
+}
+
+TEST_CASE("test HueStreamSender against HueStreamReceiver on localhost")
+{
+	const int width = 160, height = 120;
+	Mat depth(height, width, CV_16U);
+	for (int i=0; i<height; i++)
+		for (int j=0; j<width; j++) depth.at<uint16_t>(i, j) = 400 + 20*i + 3*j;
+
+	HueCodec codec(0.3f, 4.0f, HUE_MM_SCALE, false);
+	Mat expected = codec.decode(codec.encode(depth));
+
+	for (HueTransport transport : { HueTransport::TCP, HueTransport::UDP })
+	{
+		HueStreamReceiver receiver(transport);
+		REQUIRE(receiver.listen(0, "127.0.0.1"));
+
+		HueStreamOptions options;
+		options.transport = transport;
+		options.format = ".png";	// lossless, so the received depth matches the hue round trip
+		options.params = { IMWRITE_PNG_COMPRESSION, 1 };
+		options.queue_depth = 8;
+		options.udp_payload = 1000;	// several fragments per frame
+		HueStreamSender sender(codec, options);
+		REQUIRE(sender.connect("127.0.0.1", receiver.port()));
+
+		const int frames = 5;
+		for (int k=0; k<frames; k++) CHECK(sender.send(depth));
+		sender.flush();
+		CHECK(sender.stats().frames == frames);
+
+		Mat received;
+		HueFrameInfo info;
+		int count = 0;
+		while (receiver.receive(received, info, 500))
+		{
+			CHECK(info.frame_id == (uint32_t)count);
+			CHECK(info.capture_us <= info.send_us);
+			CHECK(info.send_us <= info.decode_us);
+			CHECK(received.size() == depth.size());
+			CHECK(countNonZero(received != expected) == 0);
+			if (++count == frames) break;
+		}
+		CHECK(count == frames);
+		CHECK(receiver.stats().frames == (uint64_t)frames);
+		CHECK(receiver.stats().dropped == 0);
+	}
+}
+
+TEST_CASE("test HueStreamSender with invalid frames and a stalled receiver")
+{	// Invalid frames are refused, and close() returns while the receiver is not reading
+	HueCodec codec(0.3f, 4.0f, HUE_MM_SCALE, false);
+	HueStreamReceiver receiver(HueTransport::TCP);
+	REQUIRE(receiver.listen(0, "127.0.0.1"));
+
+	HueStreamOptions options;
+	options.format = "";	// raw, so the frames are large
+	HueStreamSender sender(codec, options);
+	REQUIRE(sender.connect("127.0.0.1", receiver.port()));
+
+	CHECK(!sender.send(Mat()));
+	CHECK(!sender.send(Mat(8, 8, CV_8UC3)));
+	CHECK(!sender.send(Mat(1, 70000, CV_16U, Scalar(1000))));
+	CHECK(sender.stats().frames == 0);
+
+	// 4 raw frames of 6.75 MB are more than the socket buffers hold
+	Mat depth = generate_synthetic_depth(1500, 1500, 400, 3000);
+	for (int k=0; k<4; k++) CHECK(sender.send(depth));
+	auto start = std::chrono::steady_clock::now();
+	sender.close();
+	CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(5));
+	CHECK(!sender.send(depth));
+}
+
+std::vector<uint8_t> raw_stream_datagram(const HueCodec& codec, const Mat& depth, uint32_t frame_id)
+{	// A frame with a raw hue-encoded payload in a single UDP datagram, as HueStreamSender sends it
+	using namespace hue_stream_detail;
+	Mat encoded = codec.encode(depth);
+	const size_t payload = encoded.total() * 3;
+	std::vector<uint8_t> datagram(FRAGMENT_HEADER_SIZE + HEADER_SIZE + payload, 0);
+
+	uint8_t* f = datagram.data();
+	std::memcpy(f, "HUEF", 4);
+	put<uint32_t>(f + 4, frame_id);
+	put<uint16_t>(f + 10, 1);	// fragment 0 of 1 at offset 0
+
+	uint8_t* h = f + FRAGMENT_HEADER_SIZE;
+	std::memcpy(h, "HUE1", 4);
+	put<uint32_t>(h + 4, frame_id);
+	put<float>(h + 24, codec.depth_min_m());
+	put<float>(h + 28, codec.depth_max_m());
+	put<float>(h + 32, codec.depth_scale());
+	put<uint32_t>(h + 36, codec.m_inverse_colorization ? 1 : 0);
+	put<uint16_t>(h + 48, depth.cols);
+	put<uint16_t>(h + 50, depth.rows);
+	put<uint32_t>(h + 52, payload);
+	for (int i=0; i<encoded.rows; i++) std::memcpy(h + HEADER_SIZE + i * encoded.cols * 3, encoded.ptr(i), encoded.cols * 3);
+	return datagram;
+}
+
+TEST_CASE("test HueStreamReceiver with duplicate and late UDP datagrams")
+{	// A duplicated datagram must not deliver its frame twice, and a late frame
+	// must not be delivered after a newer one
+	using namespace hue_stream_detail;
+	HueCodec codec(0.3f, 4.0f, HUE_MM_SCALE, false);
+	Mat depth = generate_synthetic_depth(32, 24, 400, 3000);
+
+	HueStreamReceiver receiver(HueTransport::UDP);
+	REQUIRE(receiver.listen(0, "127.0.0.1"));
+
+	sockaddr_storage addr;
+	socklen_t len;
+	REQUIRE(resolve("127.0.0.1", receiver.port(), SOCK_DGRAM, addr, len));
+	socket_t s = socket(addr.ss_family, SOCK_DGRAM, 0);
+	REQUIRE(s != INVALID);
+	REQUIRE(::connect(s, (const sockaddr*)&addr, len) == 0);
+	for (uint32_t id : { 7, 7, 6, 8, 8 })
+	{
+		std::vector<uint8_t> datagram = raw_stream_datagram(codec, depth, id);
+		CHECK(::send(s, (const char*)datagram.data(), (int)datagram.size(), 0) == (int)datagram.size());
+	}
+	close_socket(s);
+
+	Mat received;
+	HueFrameInfo info;
+	REQUIRE(receiver.receive(received, info, 500));
+	CHECK(info.frame_id == 7);
+	REQUIRE(receiver.receive(received, info, 500));
+	CHECK(info.frame_id == 8);
+	CHECK(countNonZero(received != codec.decode(codec.encode(depth))) == 0);
+	CHECK(!receiver.receive(received, info, 200));
+	CHECK(receiver.stats().frames == 2);
+}
+
+#ifdef HUE_ASYNC_COROUTINES
+struct DetachedCoroutine
+{	// Minimal fire-and-forget coroutine type for awaiting a HueTask
+	struct promise_type
+	{
+		DetachedCoroutine get_return_object() { return {}; }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() {}
+		void unhandled_exception() { std::terminate(); }
+	};
+};
+
+DetachedCoroutine await_encode(HueAsyncCodec& async_codec, Mat depth, std::promise<Mat>& result)
+{
+	Mat encoded = co_await async_codec.encode(depth);
+	result.set_value(encoded);
+}
+#endif
+
+TEST_CASE("test HueArchiveWriter against HueArchiveReader")
+{	// Frames are stored in order across several chunks while the writer applies
+	// back-pressure, and decode with the codec settings stored in the archive
+	const std::string path = "test_archive.hca";
+	HueCodec codec(0.3f, 8.0f, HUE_MM_SCALE, false);
+	std::vector<Mat> sequence;
+	for (int k=0; k<12; k++) sequence.push_back(generate_synthetic_depth(160, 120, 300 + 50*k, 7000));
+
+	HueArchiveOptions options;
+	options.format = ".png";	// lossless
+	options.params = { IMWRITE_PNG_COMPRESSION, 1 };
+	options.threads = 3;
+	options.max_pending = 2;
+	options.chunk_bytes = 40000;	// a few frames per chunk
+
+	HueArchiveWriter writer(codec, options);
+	REQUIRE(writer.open(path, sequence[0].size()));
+	CHECK(!writer.write(Mat(10, 10, CV_16U)));
+	for (size_t k=0; k<sequence.size(); k++)
+	{
+		CHECK(writer.write(sequence[k], 1000 + k));
+		CHECK(writer.pending() <= 2);
+	}
+	CHECK(writer.close());
+	CHECK(writer.size() == sequence.size());
+	CHECK(writer.dropped() == 0);
+
+	HueArchiveReader reader(path);
+	REQUIRE(reader.is_open());
+	REQUIRE(reader.size() == sequence.size());
+	CHECK(reader.frame_size() == sequence[0].size());
+	CHECK(reader.format() == ".png");
+	CHECK(reader.codec().depth_max_m() == 8.0f);
+	CHECK(!reader.codec().m_inverse_colorization);
+	for (size_t k=0; k<sequence.size(); k++)
+	{
+		CHECK(reader.timestamp(k) == 1000 + k);
+		CHECK(cv::norm(reader.depth(k), codec.decode(codec.encode(sequence[k])), NORM_INF) == 0);
+	}
+	CHECK(reader.depth(sequence.size()).empty());
+
+	// try_write drops frames instead of waiting
+	options.max_pending = 1;
+	HueArchiveWriter dropping(codec, options);
+	REQUIRE(dropping.open(path, sequence[0].size()));
+	int accepted = 0;
+	for (const Mat& frame : sequence) accepted += dropping.try_write(frame);
+	CHECK(dropping.close());
+	CHECK(dropping.size() == (uint64_t)accepted);
+	CHECK(dropping.size() + dropping.dropped() == sequence.size());
+
+	// Frames that cannot be compressed are dropped without failing the archive
+	options.format = ".nosuchformat";
+	options.max_pending = 2;
+	HueArchiveWriter unknown(codec, options);
+	REQUIRE(unknown.open(path, sequence[0].size()));
+	for (int k=0; k<3; k++) CHECK(unknown.write(sequence[k]));
+	CHECK(unknown.close());
+	CHECK(!unknown.failed());
+	CHECK(unknown.size() == 0);
+	CHECK(unknown.dropped() == 3);
+	CHECK(HueArchiveReader(path).size() == 0);
+
+	for (uint32_t chunk=0; chunk<(uint32_t)sequence.size(); chunk++) std::remove(hue_archive_detail::chunk_path(path, chunk).c_str());
+	std::remove(path.c_str());
+	CHECK(!HueArchiveReader(path).is_open());
+}
+
+#ifdef HUE_HAVE_LIBAV
+TEST_CASE("test HueVideoWriter against HueVideoReader")
+{	// Lossless RGB encoders must return the hue-encoded frames exactly, so the
+	// depth decodes the same as without video compression
+	HueCodec codec(0.3f, 8.0f, HUE_MM_SCALE, false);
+	std::vector<Mat> sequence;
+	for (int k=0; k<5; k++) sequence.push_back(generate_synthetic_depth(160, 120, 300 + 100*k, 7000));
+
+	for (std::string encoder : { "ffv1", "libx264rgb" })
+	{
+		if (!avcodec_find_encoder_by_name(encoder.c_str())) continue;	// FFmpeg built without this encoder
+		const std::string path = "test_video_" + encoder + ".mkv";
+
+		HueVideoWriter writer;
+		REQUIRE(writer.open(path, sequence[0].size(), CV_8UC3, HueVideoOptions::lossless_rgb(encoder)));
+		CHECK(writer.pixel_format().find("yuv") == std::string::npos);
+		for (const Mat& depth : sequence) CHECK(writer.write(codec.encode(depth)));
+		CHECK(!writer.write(Mat(10, 10, CV_8UC3)));
+		writer.close();
+
+		HueVideoReader reader;
+		REQUIRE(reader.open(path));
+		CHECK(reader.size() == sequence[0].size());
+		Mat frame;
+		size_t count = 0;
+		for (; reader.read(frame) && count < sequence.size(); count++)
+		{
+			REQUIRE(frame.type() == CV_8UC3);
+			CHECK(cv::norm(codec.decode(frame), codec.decode(codec.encode(sequence[count])), NORM_INF) == 0);
+		}
+		CHECK(count == sequence.size());
+		reader.close();
+		std::remove(path.c_str());
+	}
+
+	// Unknown encoders and missing files fail without throwing
+	HueVideoOptions unknown;
+	unknown.codec = "no_such_encoder";
+	HueVideoWriter writer;
+	CHECK(!writer.open("test_video_unknown.mkv", Size(160, 120), CV_8UC3, unknown));
+	CHECK(!writer.is_open());
+	CHECK(!writer.write(Mat(120, 160, CV_8UC3, Scalar(0, 0, 255))));
+
+	HueVideoReader reader;
+	CHECK(!reader.open("test_video_missing.mkv"));
+	CHECK(!reader.is_open());
+	Mat frame;
+	CHECK(!reader.read(frame));
+}
+#endif
+
+TEST_CASE("test HueAsyncCodec against HueCodec")
+{
+	Mat depth = generate_synthetic_depth(160, 120, 0, 9000);
+	HueCodec codec(0.3f, 8.0f);
+	Mat encoded = codec.encode(depth);
+	Mat decoded = codec.decode(encoded);
+
+	HueAsyncCodec async_codec(codec, 1);
+	std::atomic<int> callbacks(0);
+	HueTask<Mat> encode_task = async_codec.encode(depth, HuePriority::Normal, [&](const Mat&) { callbacks++; });
+	HueTask<Mat> decode_task = async_codec.decode(encoded);
+	CHECK(countNonZero(encode_task.get() != encoded) == 0);
+	CHECK(countNonZero(decode_task.get() != decoded) == 0);
+	CHECK(callbacks == 1);
+
+	// Priority order and cancellation on a single worker that is kept busy
+	std::mutex gate;
+	std::unique_lock<std::mutex> closed(gate);
+	HueExecutor& executor = async_codec.executor();
+	HueTask<int> blocker = executor.submit([&] { std::lock_guard<std::mutex> lock(gate); return 0; });
+	while (executor.pending() > 0) std::this_thread::yield();	// the worker has taken the blocker
+
+	std::vector<int> order;
+	auto record = [&](int id) { return [&order, id] { order.push_back(id); return id; }; };
+	HueTask<int> low    = executor.submit(record(1), HuePriority::Low);
+	HueTask<int> normal = executor.submit(record(2), HuePriority::Normal);
+	HueTask<int> high   = executor.submit(record(3), HuePriority::High);
+	HueTask<Mat> filter = async_codec.decode_filtered(encoded, 1, 0.02f, HuePriority::High, [&](const Mat&) { callbacks++; });
+	CHECK(normal.cancel());
+	CHECK(normal.ready());
+	CHECK(normal.cancelled());
+	CHECK(!high.ready());
+
+	closed.unlock();
+	CHECK(low.get() == 1);
+	CHECK(high.get() == 3);
+	CHECK(normal.get() == 0);
+	CHECK(!filter.get().empty());
+	CHECK(!high.cancel());
+	CHECK(callbacks == 2);
+	REQUIRE(order.size() == 2);
+	CHECK(order[0] == 3);
+	CHECK(order[1] == 1);
+
+#ifdef HUE_ASYNC_COROUTINES
+	std::promise<Mat> awaited;
+	await_encode(async_codec, depth, awaited);
+	CHECK(countNonZero(awaited.get_future().get() != encoded) == 0);
+#endif
+}
+
+TEST_CASE("test HueExecutor with throwing jobs")
+{	// An exception in a job or its callback reaches get() instead of terminating
+	// the worker, and the worker goes on to run later jobs
+	HueExecutor executor(1);
+	HueTask<int> failing = executor.submit([]() -> int { throw std::runtime_error("job"); });
+	HueTask<int> failing_callback = executor.submit([] { return 1; }, HuePriority::Normal,
+		[](const int&) { throw std::runtime_error("callback"); });
+	HueTask<int> next = executor.submit([] { return 2; });
+
+	CHECK_THROWS_AS(failing.get(), std::runtime_error);
+	CHECK(failing.ready());
+	CHECK(!failing.cancelled());
+	CHECK_THROWS_AS(failing_callback.get(), std::runtime_error);
+	CHECK(next.get() == 2);
+
+	// A default-constructed task has no job, as for an invalid std::future
+	HueTask<int> empty;
+	CHECK(!empty.valid());
+	CHECK(!empty.ready());
+	CHECK(!empty.wait_for(std::chrono::milliseconds(1)));
+	CHECK(!empty.cancel());
+	CHECK(!empty.cancelled());
+	CHECK_THROWS_AS(empty.wait(), std::future_error);
+	CHECK_THROWS_AS(empty.get(), std::future_error);
+}